@@ -0,0 +1,201 @@
+/*
+* Overlay message throughput through the engine, with and without workers (hc_engine_start_workers).
+* A feeder task plays the receive handler and a drain task plays the send handler, everything between them is
+* the real engine: the filter stand-in below, dedup, the route record, forwarding and the delivery task.
+* Messages come from BENCH_SOURCES sources, each numbering its own, so the callback can check every source's
+* messages still arrive in the order they were sent however many workers share them out.
+* The protocol layer is stubbed out, nothing here is a beacon and every overlay message passes the filter.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "hc_engine.h"
+#include "hc_overlay.h"
+#include "hc_send.h"
+#include "hc_fragment.h"
+#include "hc_aggregate.h"
+#include "hc_delivery.h"
+#include "hc_timer.h"
+
+#define BENCH_SOURCES 64
+#define BENCH_MESSAGES 200000 // Unique ones, copies come on top
+#define BENCH_COPY_EVERY 10 // Every tenth message also comes in over a second path, when dedup can catch it
+#define BENCH_PAYLOAD_SIZE 64
+#define BENCH_POOL_SIZE 512
+#define BENCH_RECEIVE_DEPTH 64 // Like the receive buffer's data lane, the feeder waits when it's full
+#define BENCH_TIMEOUT_S 60 // A run that hasn't finished by then has lost something, and is reported as it stands
+
+typedef struct bench_message {
+    char data[HC_BUFFER_DATA_MAX];
+    int size;
+} bench_message_t;
+
+static hypercast_t hypercast;
+static hc_sender_table_t senderTable;
+static hc_buffer_t *receiveBuffer, *sendBuffer;
+static hc_dedup_cache_t dedupCache;
+static hc_fragment_state_t fragments;
+static hc_aggregator_t aggregator;
+static hc_timer_queue_t timers;
+
+static uint32_t lastSequence[BENCH_SOURCES];
+static atomic_int delivered, outOfOrder, forwarded;
+
+// What the engine needs from the protocol layer, every overlay message is let through as it is
+int hc_filter_packet(hypercast_t *hypercast, const hc_packet_t *packet) { return HC_FILTER_ACCEPT; }
+void hc_protocol_parse(hc_packet_t *packet, long protocolId, hypercast_t *hypercast) {}
+
+static void bench_callback(char *data, int length) {
+    // Only the delivery task gets here, so the per source state needs no lock
+    uint32_t source, sequence;
+    memcpy(&source, data, sizeof(source));
+    memcpy(&sequence, data + sizeof(source), sizeof(sequence));
+    if (sequence <= lastSequence[source]) { outOfOrder++; }
+    lastSequence[source] = sequence;
+    delivered++;
+}
+
+static double bench_elapsed(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void bench_engine_task(void *parameters) {
+    hc_engine_handler(&hypercast);
+}
+
+static void bench_drain_task(void *parameters) {
+    // Stands in for the send handler, anything forwarded is just counted
+    hc_packet_t *packets[HC_ENGINE_BATCH_SIZE];
+    while (1) {
+        int count = hc_pop_buffer_batch_wait(sendBuffer, packets, HC_ENGINE_BATCH_SIZE, 10);
+        for (int i = 0; i < count; i++) { free_packet(packets[i]); }
+        forwarded += count;
+    }
+}
+
+static int bench_build_messages(bench_message_t *messages) {
+    // Built with hc_send, so they're what another node running this code puts on the wire
+    uint32_t sequence[BENCH_SOURCES] = {0};
+    int total = 0;
+    for (int i = 0; i < BENCH_MESSAGES; i++) {
+        uint32_t source = (i * 7919) % BENCH_SOURCES;
+        char payload[BENCH_PAYLOAD_SIZE] = {0};
+        sequence[source]++;
+        memcpy(payload, &source, sizeof(source));
+        memcpy(payload + sizeof(source), &sequence[source], sizeof(sequence[source]));
+        senderTable.sourceAddressLogical = 1000 + source;
+        hc_send(&hypercast, payload, sizeof(payload), HC_SEND_DEFAULT);
+        hc_packet_t *packet = hc_pop_buffer(sendBuffer);
+        memcpy(messages[total].data, packet->data, packet->size);
+        messages[total].size = packet->size;
+        total++;
+        free_packet(packet);
+        // Without sequence numbers on the wire there's no telling a copy from a repeat, so nothing is copied
+        if (HC_OVERLAY_NATIVE_EXTENSIONS && i % BENCH_COPY_EVERY == 0) {
+            messages[total] = messages[total - 1];
+            total++;
+        }
+    }
+    senderTable.sourceAddressLogical = 42;
+    return total;
+}
+
+int main(int argc, char **argv) {
+    int workers = argc > 1 ? atoi(argv[1]) : 0;
+
+    hc_packet_pool_init(BENCH_POOL_SIZE);
+    receiveBuffer = hc_buffer_aligned_alloc(sizeof(hc_buffer_t));
+    sendBuffer = hc_buffer_aligned_alloc(sizeof(hc_buffer_t));
+    hc_allocate_buffer_lanes(receiveBuffer, HC_BUFFER_CONTROL_LANE_SIZE, BENCH_RECEIVE_DEPTH, HC_BUFFER_MODE_SPSC);
+    hc_allocate_buffer_lanes(sendBuffer, HC_BUFFER_CONTROL_LANE_SIZE, 128, HC_BUFFER_MODE_LOCKED);
+    // Same as the delivery queue below, a drain task that falls behind holds the engine up rather than losing messages
+    hc_buffer_set_overflow_policy(sendBuffer, HC_BUFFER_OVERFLOW_BLOCK, 1000);
+    hypercast.receiveBuffer = receiveBuffer;
+    hypercast.sendBuffer = sendBuffer;
+    hypercast.senderTable = &senderTable;
+    hypercast.dedupCache = &dedupCache;
+    hypercast.fragments = &fragments;
+    hypercast.aggregator = &aggregator;
+    hypercast.timers = &timers;
+    hypercast.callback = bench_callback;
+    hc_dedup_init(&dedupCache);
+    hc_fragment_init(&fragments);
+    hc_aggregate_init(&aggregator);
+    hc_timer_queue_init(&timers);
+
+    bench_message_t *messages = malloc(sizeof(bench_message_t) * BENCH_MESSAGES * 2);
+    int total = bench_build_messages(messages);
+
+    // Nothing is dropped on the way to the application, a full queue holds the sender up instead
+    hc_delivery_config_t deliveryConfig = {
+        .depth = HC_DELIVERY_MAX_DEPTH,
+        .mode = workers > 0 ? HC_BUFFER_MODE_LOCKED : HC_BUFFER_MODE_SPSC, // Every worker delivers
+        .overflowPolicy = HC_BUFFER_OVERFLOW_BLOCK,
+        .blockTimeoutMs = 1000,
+        .batchCallback = NULL,
+    };
+    hc_delivery_start(&hypercast, &deliveryConfig);
+    if (workers > 0 && hc_engine_start_workers(&hypercast, workers) < 0) {
+        printf("Workers didn't start\n");
+        return 1;
+    }
+    xTaskCreate(bench_engine_task, "engine", HC_ENGINE_WORKER_STACK, NULL, HC_ENGINE_WORKER_PRIORITY, NULL);
+    xTaskCreate(bench_drain_task, "drain", HC_ENGINE_WORKER_STACK, NULL, HC_ENGINE_WORKER_PRIORITY, NULL);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool timedOut = false;
+    unsigned int feederMisses = 0; // The feeder waiting for a free slot isn't a loss, so it's taken out of the pool's count
+    int fed = 0;
+    for (; fed < total && !timedOut; fed++) {
+        // Only this task pushes, like the receive handler
+        while (hc_buffer_lane_size(receiveBuffer, HC_BUFFER_LANE_DATA) >= BENCH_RECEIVE_DEPTH
+               && !(timedOut = bench_elapsed(&start) > BENCH_TIMEOUT_S)) { sched_yield(); }
+        hc_packet_t *packet = NULL;
+        while (!timedOut && (packet = hc_packet_acquire()) == NULL) {
+            feederMisses++;
+            timedOut = bench_elapsed(&start) > BENCH_TIMEOUT_S;
+            sched_yield();
+        }
+        if (packet == NULL) { break; }
+        memcpy(packet->data, messages[fed].data, messages[fed].size);
+        packet->size = messages[fed].size;
+        hc_push_buffer_packet(receiveBuffer, packet);
+    }
+    while ((delivered < BENCH_MESSAGES || forwarded < BENCH_MESSAGES)
+           && !(timedOut = timedOut || bench_elapsed(&start) > BENCH_TIMEOUT_S)) { sched_yield(); }
+    double seconds = bench_elapsed(&start);
+
+    // Everything that can lose a message on the way: the worker queues, the send buffer the drain task empties,
+    // the delivery queue, the pool running dry under the engine (delivery->failed counts those same misses, so it
+    // isn't added again) and anything the engine couldn't forward
+    hc_buffer_lane_stats_t stats;
+    uint32_t workerDrops = 0;
+    for (int i = 0; hypercast.workers != NULL && i < hypercast.workers->count; i++) {
+        hc_buffer_get_lane_stats(&hypercast.workers->workers[i].queue, HC_BUFFER_LANE_DATA, &stats);
+        workerDrops += stats.dropped;
+    }
+    hc_buffer_get_lane_stats(sendBuffer, HC_BUFFER_LANE_DATA, &stats);
+    uint32_t sendDrops = stats.dropped;
+    hc_buffer_get_lane_stats(&hypercast.delivery->buffer, HC_BUFFER_LANE_DATA, &stats);
+    uint32_t deliveryDrops = stats.dropped;
+    hc_packet_pool_stats_t poolStats;
+    hc_packet_pool_get_stats(&poolStats);
+    uint32_t poolFailures = poolStats.exhausted - feederMisses;
+    uint32_t dropped = workerDrops + sendDrops + deliveryDrops + poolFailures + hypercast.forwardStats.failed;
+
+    if (timedOut) { printf("Timed out after %d s\n", BENCH_TIMEOUT_S); }
+    printf("workers %d on %d cores: %d in (%d unique), %d delivered, %d forwarded, %d out of order, %u dropped, %.0f msg/s\n",
+           workers, portNUM_PROCESSORS, fed, BENCH_MESSAGES, (int)delivered, (int)forwarded, (int)outOfOrder, dropped, fed / seconds);
+    if (dropped > 0) {
+        printf("dropped by worker queues %u, send buffer %u, delivery queue %u, pool %u, forwarding %u\n",
+               workerDrops, sendDrops, deliveryDrops, poolFailures, (unsigned)hypercast.forwardStats.failed);
+    }
+    return !timedOut && delivered == BENCH_MESSAGES && forwarded == BENCH_MESSAGES && outOfOrder == 0 && dropped == 0 ? 0 : 1;
+}
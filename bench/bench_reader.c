@@ -0,0 +1,169 @@
+/*
+* Parsing a beacon-sized message field by field, the way spt_parse reads one: through hc_reader_t, and through
+* packet_snip_to_bytes/packet_to_int, the path it replaced (kept below as it was, bar freeing with free).
+* Both decode the same fields from the same bytes, and their sums have to agree before any timing counts.
+*/
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "hc_buffer.h"
+
+#define BENCH_ADJACENCY_ENTRIES 8 // A busy neighborhood, each entry is 40 bits
+#define BENCH_ITERATIONS 200000
+
+static const char* TAG = "BENCH_READER";
+
+// The old path. Every field is a malloc'd copy, nibble by nibble, turned into an integer and freed
+static hc_packet_t* packet_snip_to_bytes(hc_packet_t *packet, int lengthBits, int offsetBits) {
+    if (lengthBits < 4 || offsetBits % 4 != 0) {
+        ESP_LOGE(TAG, "Invalid packet digest parameters");
+        return NULL;
+    }
+    if (packet->size < (lengthBits / 8) + (offsetBits / 8)) {
+        ESP_LOGE(TAG, "Packet not large enough to digest");
+        return NULL;
+    }
+    char *digest = malloc(sizeof(char) * (ceil((double)lengthBits / 8)));
+    int remainingBits = lengthBits;
+    int currentBit = offsetBits;
+    char byteTarget = 0x00;
+    while (remainingBits > 0) {
+        byteTarget = packet->data[currentBit / 8];
+        if (currentBit % 8 == 0) { byteTarget = byteTarget >> 4; }
+        else { byteTarget = byteTarget & 0x0F; }
+        if ((lengthBits - remainingBits) % 8 == 0) {
+            digest[(lengthBits - remainingBits) / 8] = byteTarget;
+        } else {
+            digest[(lengthBits - remainingBits) / 8] = (digest[(lengthBits - remainingBits) / 8] << 4) | byteTarget;
+        }
+        remainingBits -= 4;
+        currentBit += 4;
+    }
+    hc_packet_t *snipped_packet = (hc_packet_t *)malloc(sizeof(hc_packet_t));
+    snipped_packet->data = digest;
+    snipped_packet->size = ceil((double)lengthBits / 8);
+    return snipped_packet;
+}
+
+static long long int packet_to_int(hc_packet_t* packet) {
+    if (packet == NULL) {
+        return -1;
+    }
+    long long int result = 0;
+    for (int i = 0; i < packet->size; i++) {
+        result = result << 8;
+        result += packet->data[i];
+    }
+    free(packet->data);
+    free(packet);
+    return result;
+}
+
+// The beacon fields after the protocol header, in order: one sender entry, the tree state, then the adjacency table
+static uint64_t parse_legacy(hc_packet_t *packet) {
+    uint64_t sum = 0;
+    int offset = 0;
+    sum += packet_to_int(packet_snip_to_bytes(packet, 16, offset)); // hash
+    sum += packet_to_int(packet_snip_to_bytes(packet, 8, offset + 16)); // address length
+    for (int j = 0; j < 4; j++) {
+        sum += packet_to_int(packet_snip_to_bytes(packet, 8, offset + 24 + j * 8));
+    }
+    sum += packet_to_int(packet_snip_to_bytes(packet, 16, offset + 56)); // port
+    offset += 72;
+    sum += packet_to_int(packet_snip_to_bytes(packet, 32, offset)); // source
+    sum += packet_to_int(packet_snip_to_bytes(packet, 32, offset + 32)); // root
+    sum += packet_to_int(packet_snip_to_bytes(packet, 32, offset + 64)); // parent
+    sum += packet_to_int(packet_snip_to_bytes(packet, 32, offset + 96)); // cost
+    sum += packet_to_int(packet_snip_to_bytes(packet, 64, offset + 128)); // timestamp
+    uint32_t tableSize = packet_to_int(packet_snip_to_bytes(packet, 32, offset + 192));
+    sum += tableSize;
+    offset += 224;
+    for (uint32_t i = 0; i < tableSize; i++) {
+        sum += packet_to_int(packet_snip_to_bytes(packet, 32, offset + i * 40)); // id
+        sum += packet_to_int(packet_snip_to_bytes(packet, 8, offset + i * 40 + 32)); // quality
+    }
+    offset += tableSize * 40;
+    sum += packet_to_int(packet_snip_to_bytes(packet, 16, offset)); // reliability
+    return sum;
+}
+
+static uint64_t parse_reader(hc_packet_t *packet) {
+    hc_reader_t reader;
+    hc_reader_init(&reader, packet);
+    uint64_t sum = 0;
+    sum += hc_read_bits(&reader, 16);
+    sum += hc_read_bits(&reader, 8);
+    for (int j = 0; j < 4; j++) {
+        sum += hc_read_bits(&reader, 8);
+    }
+    sum += hc_read_bits(&reader, 16);
+    for (int j = 0; j < 4; j++) {
+        sum += hc_read_bits(&reader, 32);
+    }
+    sum += hc_read_bits(&reader, 64);
+    uint32_t tableSize = hc_read_bits(&reader, 32);
+    sum += tableSize;
+    for (uint32_t i = 0; i < tableSize && !reader.error; i++) {
+        sum += hc_read_bits(&reader, 32);
+        sum += hc_read_bits(&reader, 8);
+    }
+    sum += hc_read_bits(&reader, 16);
+    return reader.error ? 0 : sum;
+}
+
+static void build_beacon(hc_packet_t *packet, char *data) {
+    hc_writer_t writer;
+    hc_writer_init(&writer, data, HC_BUFFER_DATA_MAX);
+    // Every byte stays under 0x80, the old path sign extended anything above and the sums wouldn't match
+    hc_write_bits(&writer, 0x1234, 16);
+    hc_write_bits(&writer, 6, 8);
+    hc_write_bits(&writer, 0x7F0A0B0C, 32);
+    hc_write_bits(&writer, 9472 & 0x7F7F, 16);
+    hc_write_bits(&writer, 0x00000155, 32);
+    hc_write_bits(&writer, 0x0000002A, 32);
+    hc_write_bits(&writer, 0x0000002A, 32);
+    hc_write_bits(&writer, 3, 32);
+    hc_write_bits(&writer, 0x0000017F7F7F7F7F, 64);
+    hc_write_bits(&writer, BENCH_ADJACENCY_ENTRIES, 32);
+    for (int i = 0; i < BENCH_ADJACENCY_ENTRIES; i++) {
+        hc_write_bits(&writer, 0x100 + i, 32);
+        hc_write_bits(&writer, 0x7F - i, 8);
+    }
+    hc_write_bits(&writer, 0x0102, 16);
+    packet->data = data;
+    packet->size = hc_writer_length(&writer);
+    packet->segmentCount = 0;
+}
+
+static double bench_ns(uint64_t (*parse)(hc_packet_t*), hc_packet_t *packet, uint64_t *sum) {
+    struct timespec start, end;
+    uint64_t total = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        total += parse(packet);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *sum = total / BENCH_ITERATIONS;
+    return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / BENCH_ITERATIONS;
+}
+
+int main() {
+    char data[HC_BUFFER_DATA_MAX];
+    hc_packet_t packet;
+    build_beacon(&packet, data);
+    uint64_t legacySum, readerSum;
+    // Once each to warm up, then for real
+    parse_legacy(&packet);
+    parse_reader(&packet);
+    double legacyNs = bench_ns(parse_legacy, &packet, &legacySum);
+    double readerNs = bench_ns(parse_reader, &packet, &readerSum);
+    if (legacySum != readerSum) {
+        printf("Mismatch: legacy %llu, reader %llu\n", (unsigned long long)legacySum, (unsigned long long)readerSum);
+        return 1;
+    }
+    printf("Beacon of %d bytes (%d adjacency entries), %d parses each\n", packet.size, BENCH_ADJACENCY_ENTRIES, BENCH_ITERATIONS);
+    printf("  packet_snip_to_bytes/packet_to_int: %8.1f ns/parse\n", legacyNs);
+    printf("  hc_reader_t:                        %8.1f ns/parse (%.1fx)\n", readerNs, legacyNs / readerNs);
+    return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef __HC_HOST_ESP_HEAP_CAPS_H__
+#define __HC_HOST_ESP_HEAP_CAPS_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MALLOC_CAP_DEFAULT 0
+
+static inline void* heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps) {
+    // aligned_alloc wants the size rounded up to the alignment
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+static inline void heap_caps_aligned_free(void *memory) {
+    free(memory);
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef __HC_HOST_ESP_LOG_H__
+#define __HC_HOST_ESP_LOG_H__
+
+// Host stand-in for ESP-IDF logging. Logging per packet would swamp anything we're timing, so it all compiles out
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define ESP_LOG_VERBOSE 5
+#define ESP_LOGE(tag, ...) ((void)(tag))
+#define ESP_LOGW(tag, ...) ((void)(tag))
+#define ESP_LOGI(tag, ...) ((void)(tag))
+#define ESP_LOGD(tag, ...) ((void)(tag))
+#define ESP_LOGV(tag, ...) ((void)(tag))
+
+typedef int esp_err_t;
+#define ESP_OK 0
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef __HC_HOST_ESP_TIMER_H__
+#define __HC_HOST_ESP_TIMER_H__
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void); // us since start, from CLOCK_MONOTONIC (see host_rtos.c)
+
+#endif
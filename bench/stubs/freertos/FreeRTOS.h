@@ -0,0 +1,26 @@
+#ifndef __HC_HOST_FREERTOS_H__
+#define __HC_HOST_FREERTOS_H__
+
+// Just enough FreeRTOS for the hypercast component to run on a host, tasks are pthreads (see host_rtos.c)
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void* TaskHandle_t;
+
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY 0xFFFFFFFFu
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)((ms) / portTICK_PERIOD_MS))
+// Workers are pinned core by core, so this is however many the host has
+#define portNUM_PROCESSORS hc_host_cores()
+
+int hc_host_cores(void);
+size_t xPortGetFreeHeapSize(void);
+
+#endif
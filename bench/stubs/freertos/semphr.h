@@ -0,0 +1,13 @@
+#ifndef __HC_HOST_SEMPHR_H__
+#define __HC_HOST_SEMPHR_H__
+
+#include "FreeRTOS.h"
+
+typedef struct hc_host_semaphore* SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t);
+void vSemaphoreDelete(SemaphoreHandle_t);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef __HC_HOST_TASK_H__
+#define __HC_HOST_TASK_H__
+
+#include "FreeRTOS.h"
+
+TickType_t xTaskGetTickCount(void);
+BaseType_t xTaskCreate(void (*)(void*), const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*);
+BaseType_t xTaskCreatePinnedToCore(void (*)(void*), const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*, BaseType_t);
+void vTaskDelay(TickType_t);
+
+#endif
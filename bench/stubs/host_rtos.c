@@ -0,0 +1,126 @@
+/*
+* FreeRTOS calls the hypercast component makes, done with pthreads so it runs (and can be timed) on a host.
+* Tasks are detached threads, pinned to a core when asked, and binary semaphores are a flag under a condition variable
+*/
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+
+struct hc_host_semaphore {
+    pthread_mutex_t lock;
+    pthread_cond_t given;
+    bool available;
+};
+
+typedef struct hc_host_task {
+    void (*function)(void*);
+    void *parameters;
+    int core; // -1 for anywhere
+} hc_host_task_t;
+
+int hc_host_cores(void) {
+    return (int)sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+size_t xPortGetFreeHeapSize(void) {
+    return 0;
+}
+
+int64_t esp_timer_get_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(esp_timer_get_time() / 1000 / portTICK_PERIOD_MS);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    struct timespec delay = { .tv_sec = ticks * portTICK_PERIOD_MS / 1000, .tv_nsec = (long)(ticks * portTICK_PERIOD_MS % 1000) * 1000000 };
+    nanosleep(&delay, NULL);
+}
+
+static void* hc_host_task_start(void *argument) {
+    hc_host_task_t task = *(hc_host_task_t*)argument;
+    free(argument);
+    if (task.core >= 0) {
+        cpu_set_t cores;
+        CPU_ZERO(&cores);
+        CPU_SET(task.core % hc_host_cores(), &cores);
+        pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores);
+    }
+    task.function(task.parameters);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(void (*function)(void*), const char *name, uint32_t stack, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+    hc_host_task_t *task = malloc(sizeof(hc_host_task_t));
+    task->function = function;
+    task->parameters = parameters;
+    task->core = core;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, hc_host_task_start, task) != 0) {
+        free(task);
+        return pdFALSE;
+    }
+    pthread_detach(thread);
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(void (*function)(void*), const char *name, uint32_t stack, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *handle) {
+    return xTaskCreatePinnedToCore(function, name, stack, parameters, priority, handle, -1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    SemaphoreHandle_t semaphore = malloc(sizeof(struct hc_host_semaphore));
+    pthread_mutex_init(&semaphore->lock, NULL);
+    pthread_cond_init(&semaphore->given, NULL);
+    semaphore->available = false;
+    return semaphore;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    pthread_cond_destroy(&semaphore->given);
+    pthread_mutex_destroy(&semaphore->lock);
+    free(semaphore);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    pthread_mutex_lock(&semaphore->lock);
+    semaphore->available = true;
+    pthread_cond_signal(&semaphore->given);
+    pthread_mutex_unlock(&semaphore->lock);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    if (ticks != portMAX_DELAY) {
+        long long ns = deadline.tv_nsec + (long long)ticks * portTICK_PERIOD_MS * 1000000;
+        deadline.tv_sec += ns / 1000000000;
+        deadline.tv_nsec = ns % 1000000000;
+    }
+    pthread_mutex_lock(&semaphore->lock);
+    while (!semaphore->available) {
+        int waited = ticks == portMAX_DELAY ? pthread_cond_wait(&semaphore->given, &semaphore->lock)
+                                            : pthread_cond_timedwait(&semaphore->given, &semaphore->lock, &deadline);
+        if (waited == ETIMEDOUT) { break; }
+    }
+    BaseType_t taken = semaphore->available ? pdTRUE : pdFALSE;
+    semaphore->available = false;
+    pthread_mutex_unlock(&semaphore->lock);
+    return taken;
+}
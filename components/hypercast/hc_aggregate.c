@@ -0,0 +1,104 @@
+/*
+* Packing small application payloads into shared overlay messages on the way out (see hc_aggregate.h)
+*/
+#include <string.h>
+#include "freertos/task.h"
+
+#include "hc_aggregate.h"
+#include "hc_fragment.h"
+
+static const char* TAG = "HC_AGGREGATE";
+
+void hc_aggregate_init(hc_aggregator_t* aggregator) {
+    memset(aggregator, 0, sizeof(hc_aggregator_t));
+    pthread_mutex_init(&aggregator->lock, NULL);
+}
+
+static bool hc_aggregate_fits(const hc_aggregator_t* aggregator, int length) {
+    return aggregator->payloads < HC_AGGREGATE_MAX_PAYLOADS
+        && aggregator->packet->size + HC_SCHEMA_BYTES(HC_OVERLAY_EXT_HEADER) + length <= HC_AGGREGATE_MESSAGE_LIMIT;
+}
+
+// Sends the waiting message, the caller holds the lock
+static int hc_aggregate_flush_locked(hypercast_t* hypercast) {
+    hc_aggregator_t* aggregator = hypercast->aggregator;
+    hc_packet_t* packet = aggregator->packet;
+    if (packet == NULL) { return 0; }
+    aggregator->packet = NULL;
+
+    // The route record starts with us, same as hc_msg_overlay_init_with_payload does it
+    // There's always room, the message limit leaves space for the record at its biggest
+    char source[HC_OVERLAY_HEADER_sourceLogicalAddress_BITS / 8];
+    hc_store_bits(source, 0, HC_OVERLAY_HEADER_sourceLogicalAddress_BITS, hypercast->senderTable->sourceAddressLogical);
+    hc_overlay_append_extension_in_place(packet, HC_MSG_EXT_ROUTE_RECORD_TYPE, source, sizeof(source));
+    // The sequence is taken as it goes out, so the numbers follow the order messages leave in
+    hc_overlay_append_sequence_in_place(packet, hypercast);
+    ESP_LOGD(TAG, "Sending %d payloads in %d bytes", aggregator->payloads, packet->size);
+    aggregator->messages++;
+    aggregator->payloadsSent += aggregator->payloads;
+    // The buffer frees the packet if it can't take it
+    return hc_push_buffer_packet(hypercast->sendBuffer, packet) > 0 ? 1 : -1;
+}
+
+int hc_aggregate_send(hypercast_t* hypercast, const char* data, int length) {
+    hc_aggregator_t* aggregator = hypercast->aggregator;
+    int result = 1;
+    pthread_mutex_lock(&aggregator->lock);
+    if (length > HC_AGGREGATE_MAX_PAYLOAD_SIZE) {
+        // Big ones go on their own, after whatever's waiting so the order still holds
+        hc_aggregate_flush_locked(hypercast);
+        result = hc_fragment_send(hypercast, data, length) > 0 ? 1 : -1;
+        pthread_mutex_unlock(&aggregator->lock);
+        return result;
+    }
+    if (aggregator->packet != NULL && !hc_aggregate_fits(aggregator, length)) {
+        aggregator->flushedFull++;
+        hc_aggregate_flush_locked(hypercast);
+    }
+
+    if (aggregator->packet == NULL) {
+        // First one in, so it starts a new message
+        aggregator->packet = hc_packet_acquire();
+        if (aggregator->packet == NULL) {
+            ESP_LOGE(TAG, "Packet pool exhausted, can't aggregate payload");
+            pthread_mutex_unlock(&aggregator->lock);
+            return -1;
+        }
+        hc_overlay_start_in_place(aggregator->packet, hypercast->senderTable->sourceAddressLogical);
+        aggregator->payloads = 0;
+        aggregator->opened = xTaskGetTickCount();
+    }
+    if (hc_overlay_append_extension_in_place(aggregator->packet, HC_MSG_EXT_PAYLOAD_TYPE, data, length) < 0) {
+        result = -1;
+    } else {
+        aggregator->payloads++;
+    }
+    pthread_mutex_unlock(&aggregator->lock);
+    return result;
+}
+
+int hc_aggregate_flush(hypercast_t* hypercast) {
+    pthread_mutex_lock(&hypercast->aggregator->lock);
+    int result = hc_aggregate_flush_locked(hypercast);
+    pthread_mutex_unlock(&hypercast->aggregator->lock);
+    return result;
+}
+
+int hc_aggregate_poll(hypercast_t* hypercast, int maxWaitMs) {
+    hc_aggregator_t* aggregator = hypercast->aggregator;
+    int waitMs = maxWaitMs;
+    pthread_mutex_lock(&aggregator->lock);
+    if (aggregator->packet != NULL) {
+        // Ages are unsigned differences, so they're fine across tick wraparound
+        TickType_t waited = xTaskGetTickCount() - aggregator->opened;
+        if (waited >= pdMS_TO_TICKS(HC_AGGREGATE_MAX_DELAY_MS)) {
+            aggregator->flushedDeadline++;
+            hc_aggregate_flush_locked(hypercast);
+        } else {
+            int remainingMs = (pdMS_TO_TICKS(HC_AGGREGATE_MAX_DELAY_MS) - waited) * portTICK_PERIOD_MS;
+            waitMs = remainingMs < maxWaitMs ? remainingMs : maxWaitMs;
+        }
+    }
+    pthread_mutex_unlock(&aggregator->lock);
+    return waitMs;
+}
@@ -1,191 +1,636 @@
 #include <stdio.h>
-#include <math.h>
 #include <string.h>
 #include <pthread.h>
 
+#include "esp_heap_caps.h"
+#include "freertos/task.h"
+
 #include "hc_buffer.h"
 
 static const char* TAG = "HC_BUFFER";
 
+#define HC_PACKET_POOL_EMPTY 0xFFFF
+
+typedef struct hc_packet_pool {
+    hc_packet_t *packets; // Packet headers, one per slot, each pointing into storage
+    char *storage;
+    _Atomic uint16_t *next; // Free list links
+    // Top of the free list in the low 16 bits, with a tag in the high 16 bits
+    // that changes on every update so a stale compare-and-swap can't succeed (ABA)
+    atomic_uint freeHead;
+    int slots;
+    atomic_int inUse;
+    atomic_int peakInUse;
+    atomic_uint acquired;
+    atomic_uint exhausted;
+} hc_packet_pool_t;
+
+static hc_packet_pool_t packetPool;
+
 void hc_allocate_buffer(hc_buffer_t *buffer, int length) {
-    buffer->data = (hc_packet_t **)malloc(length * sizeof(hc_packet_t *));
-    buffer->capacity = length;
-    buffer->current_size = 0;
-    buffer->front = 0;
+    // The default buffer is the safe one, any task can push or pop
+    hc_allocate_buffer_mode(buffer, length, HC_BUFFER_MODE_LOCKED);
+}
+
+void hc_allocate_buffer_mode(hc_buffer_t *buffer, int length, int mode) {
+    hc_allocate_buffer_lanes(buffer, 0, length, mode);
+}
+
+static void hc_allocate_lane(hc_buffer_lane_t *lane, int length) {
+    lane->data = length > 0 ? (hc_packet_t **)malloc(length * sizeof(hc_packet_t *)) : NULL;
+    lane->capacity = length;
+    atomic_init(&lane->head, 0);
+    atomic_init(&lane->tail, 0);
+    atomic_init(&lane->enqueued, 0);
+    atomic_init(&lane->dropped, 0);
+    atomic_init(&lane->peakDepth, 0);
+}
+
+void hc_allocate_buffer_lanes(hc_buffer_t *buffer, int controlLength, int dataLength, int mode) {
+    if ((uintptr_t)buffer % HC_BUFFER_CACHE_LINE_SIZE != 0) {
+        // It still works, the producer and consumer just end up fighting over a line
+        ESP_LOGW(TAG, "Buffer isn't cache line aligned, allocate it with hc_buffer_aligned_alloc");
+    }
+    hc_allocate_lane(&buffer->lanes[HC_BUFFER_LANE_CONTROL], controlLength);
+    hc_allocate_lane(&buffer->lanes[HC_BUFFER_LANE_DATA], dataLength);
+    buffer->mode = mode;
+    buffer->overflowPolicy = HC_BUFFER_OVERFLOW_DROP_NEWEST;
+    buffer->blockTimeoutMs = 0;
     pthread_mutex_init(&buffer->buffer_lock, NULL);
+    buffer->packetReady = xSemaphoreCreateBinary();
+    buffer->spaceReady = xSemaphoreCreateBinary();
+}
+
+void hc_free_buffer(hc_buffer_t *buffer) {
+    free(buffer->lanes[HC_BUFFER_LANE_CONTROL].data);
+    free(buffer->lanes[HC_BUFFER_LANE_DATA].data);
+    buffer->lanes[HC_BUFFER_LANE_CONTROL].data = NULL;
+    buffer->lanes[HC_BUFFER_LANE_DATA].data = NULL;
+    pthread_mutex_destroy(&buffer->buffer_lock);
+    vSemaphoreDelete(buffer->packetReady);
+    vSemaphoreDelete(buffer->spaceReady);
+}
+
+void* hc_buffer_aligned_alloc(size_t size) {
+    return heap_caps_aligned_alloc(HC_BUFFER_CACHE_LINE_SIZE, size, MALLOC_CAP_DEFAULT);
+}
+
+void hc_buffer_aligned_free(void *memory) {
+    heap_caps_aligned_free(memory);
+}
+
+void hc_buffer_set_overflow_policy(hc_buffer_t *buffer, int policy, int blockTimeoutMs) {
+    buffer->overflowPolicy = policy;
+    buffer->blockTimeoutMs = blockTimeoutMs;
+}
+
+static hc_packet_t* hc_buffer_dequeue(hc_buffer_lane_t *lane, bool contended) {
+    // Only the consumer moves head, so our own index can be read relaxed
+    unsigned int head = atomic_load_explicit(&lane->head, memory_order_relaxed);
+    unsigned int tail;
+    hc_packet_t *data;
+    do {
+        // Acquire on tail makes sure the producer's slot write is visible before we read the slot
+        tail = atomic_load_explicit(&lane->tail, memory_order_acquire);
+        // Before anything, check that the lane isn't empty
+        if (head == tail) {
+            return NULL;
+        }
+        data = lane->data[head % lane->capacity];
+        if (!contended) {
+            // Release on head hands the slot back to the producer only after we're done reading it
+            atomic_store_explicit(&lane->head, head + 1, memory_order_release);
+            return data;
+        }
+        // When the producer can evict, it moves head too, so we only own the slot if our swap lands
+        // If it doesn't, the packet we read was dropped from under us and head has the new value
+    } while (!atomic_compare_exchange_weak_explicit(&lane->head, &head, head + 1,
+                                                    memory_order_acq_rel, memory_order_relaxed));
+    return data;
+}
+
+static int hc_buffer_enqueue(hc_buffer_lane_t *lane, hc_packet_t *packet, int overflowPolicy) {
+    // Mirror image of the dequeue, we own tail and only observe head
+    unsigned int tail = atomic_load_explicit(&lane->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&lane->head, memory_order_acquire);
+    int result = HC_BUFFER_PUSH_OK;
+    // First check if there is space (an unused lane is always full)
+    if (tail - head >= lane->capacity) {
+        if (overflowPolicy != HC_BUFFER_OVERFLOW_DROP_OLDEST || lane->capacity == 0) {
+            return HC_BUFFER_PUSH_FULL;
+        }
+        // Take the oldest slot off the consumer, unless it beat us to it (then there's room anyway)
+        hc_packet_t *oldest = lane->data[head % lane->capacity];
+        if (atomic_compare_exchange_strong_explicit(&lane->head, &head, head + 1,
+                                                    memory_order_acq_rel, memory_order_acquire)) {
+            free_packet(oldest);
+            atomic_fetch_add_explicit(&lane->dropped, 1, memory_order_relaxed);
+            head++;
+            result = HC_BUFFER_PUSH_EVICTED;
+        }
+    }
+    lane->data[tail % lane->capacity] = packet;
+    // Publish the slot to the consumer
+    atomic_store_explicit(&lane->tail, tail + 1, memory_order_release);
+    // Then the counters, the depth may only be smaller by now so the peak never overshoots
+    atomic_fetch_add_explicit(&lane->enqueued, 1, memory_order_relaxed);
+    if (tail + 1 - head > atomic_load_explicit(&lane->peakDepth, memory_order_relaxed)) {
+        atomic_store_explicit(&lane->peakDepth, tail + 1 - head, memory_order_relaxed);
+    }
+    return result;
+}
+
+static int hc_buffer_dequeue_batch(hc_buffer_lane_t *lane, hc_packet_t **packets, int max, bool contended) {
+    // Same as a single dequeue, but one index update covers every packet we take
+    unsigned int head = atomic_load_explicit(&lane->head, memory_order_relaxed);
+    unsigned int tail;
+    int count;
+    do {
+        tail = atomic_load_explicit(&lane->tail, memory_order_acquire);
+        count = (int)(tail - head) < max ? (int)(tail - head) : max;
+        if (count == 0) {
+            return 0;
+        }
+        for (int i = 0; i < count; i++) {
+            packets[i] = lane->data[(head + i) % lane->capacity];
+        }
+        if (!contended) {
+            atomic_store_explicit(&lane->head, head + count, memory_order_release);
+            return count;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&lane->head, &head, head + count,
+                                                    memory_order_acq_rel, memory_order_relaxed));
+    return count;
+}
+
+static int hc_buffer_enqueue_batch(hc_buffer_lane_t *lane, hc_packet_t **packets, int count) {
+    // Fill whatever room there is, and publish it all with one tail update
+    unsigned int tail = atomic_load_explicit(&lane->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&lane->head, memory_order_acquire);
+    int room = (int)(lane->capacity - (tail - head));
+    if (count > room) { count = room; }
+    if (count <= 0) { return 0; }
+    for (int i = 0; i < count; i++) {
+        lane->data[(tail + i) % lane->capacity] = packets[i];
+    }
+    atomic_store_explicit(&lane->tail, tail + count, memory_order_release);
+    atomic_fetch_add_explicit(&lane->enqueued, count, memory_order_relaxed);
+    if (tail + count - head > atomic_load_explicit(&lane->peakDepth, memory_order_relaxed)) {
+        atomic_store_explicit(&lane->peakDepth, tail + count - head, memory_order_relaxed);
+    }
+    return count;
+}
+
+static hc_packet_t* hc_buffer_dequeue_any(hc_buffer_t *buffer) {
+    // Strict priority, data only goes once control is empty
+    bool contended = buffer->overflowPolicy == HC_BUFFER_OVERFLOW_DROP_OLDEST;
+    hc_packet_t *data = NULL;
+    for (int i = 0; i < HC_BUFFER_LANES && data == NULL; i++) {
+        data = hc_buffer_dequeue(&buffer->lanes[i], contended);
+    }
+    // Let a blocked pusher know there's room now
+    if (data != NULL && buffer->overflowPolicy == HC_BUFFER_OVERFLOW_BLOCK) {
+        xSemaphoreGive(buffer->spaceReady);
+    }
+    return data;
 }
 
 hc_packet_t* hc_pop_buffer(hc_buffer_t *buffer) {
-    pthread_mutex_lock(&buffer->buffer_lock);
-    ESP_LOGI(TAG, "Start buffer pop");
-    // Before anything, check that the buffer isn't empty
-    if (buffer->current_size == 0) {
-        ESP_LOGI(TAG, "Buffer is empty");
-        pthread_mutex_unlock(&buffer->buffer_lock);
-        return NULL;
+    if (buffer->mode == HC_BUFFER_MODE_SPSC) {
+        return hc_buffer_dequeue_any(buffer);
     }
-    hc_packet_t *data = buffer->data[buffer->front];
-    // Now that we've extracted the first entry, tidy the buffer
-    buffer->data[buffer->front] = NULL;
-    buffer->front = (buffer->front + 1) % buffer->capacity;
-    buffer->current_size--;
+    pthread_mutex_lock(&buffer->buffer_lock);
+    hc_packet_t *data = hc_buffer_dequeue_any(buffer);
     // We're done, unlock the buffer
-    ESP_LOGI(TAG, "Finish buffer pop");
     pthread_mutex_unlock(&buffer->buffer_lock);
     // Then return the data
     return data;
 }
 
-void hc_push_buffer(hc_buffer_t *buffer, char *data, int packet_length) {
-    pthread_mutex_lock(&buffer->buffer_lock);
-    // First check if there is space
-    if (buffer->current_size == buffer->capacity) {
-        ESP_LOGE(TAG, "Buffer is full");
+int hc_pop_buffer_batch(hc_buffer_t *buffer, hc_packet_t **packets, int max) {
+    // Strict priority holds across the batch, control fills it first
+    bool contended = buffer->overflowPolicy == HC_BUFFER_OVERFLOW_DROP_OLDEST;
+    int count = 0;
+    if (buffer->mode != HC_BUFFER_MODE_SPSC) {
+        pthread_mutex_lock(&buffer->buffer_lock);
+    }
+    for (int i = 0; i < HC_BUFFER_LANES && count < max; i++) {
+        count += hc_buffer_dequeue_batch(&buffer->lanes[i], packets + count, max - count, contended);
+    }
+    if (buffer->mode != HC_BUFFER_MODE_SPSC) {
         pthread_mutex_unlock(&buffer->buffer_lock);
-        return;
     }
-    ESP_LOGI(TAG, "Start buffer push");
-    // Then allocate the data
-    hc_packet_t *packet = (hc_packet_t *)malloc(sizeof(hc_packet_t));
+    // Let a blocked pusher know there's room now
+    if (count > 0 && buffer->overflowPolicy == HC_BUFFER_OVERFLOW_BLOCK) {
+        xSemaphoreGive(buffer->spaceReady);
+    }
+    return count;
+}
+
+int hc_pop_buffer_batch_wait(hc_buffer_t *buffer, hc_packet_t **packets, int max, int timeoutMs) {
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(timeoutMs);
+    TickType_t elapsed;
+    int count;
+    while (1) {
+        // Same wait as a single pop, we just take everything that's there once we wake
+        count = hc_pop_buffer_batch(buffer, packets, max);
+        if (count > 0) { return count; }
+        elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout) { return 0; }
+        xSemaphoreTake(buffer->packetReady, timeout - elapsed);
+    }
+}
+
+hc_packet_t* hc_pop_buffer_wait(hc_buffer_t *buffer, int timeoutMs) {
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(timeoutMs);
+    TickType_t elapsed;
+    hc_packet_t *packet;
+    while (1) {
+        packet = hc_pop_buffer(buffer);
+        if (packet != NULL) { return packet; }
+        // Nothing yet, so sleep on the semaphore for whatever is left of the timeout
+        // A push between our pop and the take leaves the semaphore given, so we can't miss it
+        elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout) { return NULL; }
+        xSemaphoreTake(buffer->packetReady, timeout - elapsed);
+    }
+}
+
+int hc_push_buffer(hc_buffer_t *buffer, char *data, int packet_length) {
+    if (packet_length > HC_BUFFER_DATA_MAX) {
+        ESP_LOGE(TAG, "Packet of %d bytes is larger than a buffer slot", packet_length);
+        return HC_BUFFER_PUSH_INVALID;
+    }
+    // Grab a slot outside of any lock, the copy is the slow part
+    hc_packet_t *packet = hc_packet_acquire();
+    if (packet == NULL) {
+        ESP_LOGE(TAG, "Packet pool exhausted, dropping packet");
+        return HC_BUFFER_PUSH_FULL;
+    }
     // Make sure to copy the data into the packet
-    packet->data = (char *)malloc(sizeof(char)*packet_length);
     memcpy(packet->data, data, packet_length);
     packet->size = packet_length;
-    // Add the data to the buffer
-    buffer->data[(buffer->front + buffer->current_size) % buffer->capacity] = packet;
-    buffer->current_size++;
-    // We're done, unlock the buffer
-    ESP_LOGI(TAG, "Finish buffer push");
-    pthread_mutex_unlock(&buffer->buffer_lock);
+    return hc_push_buffer_packet(buffer, packet);
 }
 
-hc_packet_t* packet_snip_to_bytes(hc_packet_t *packet, int lengthBits, int offsetBits) {
-    /*
-    * This function will take a packet and return a pakcet of JUST the digested portion
-    * Note that the length is in BITS to account for those 4 bit datas
-    */
-    // Because packet->data has a hex string, 4 bits is the lowest tolerable length, and the offset must be a multiple of 4
-    if (lengthBits < 4 || offsetBits % 4 != 0) {
-        ESP_LOGE(TAG, "Invalid packet digest parameters");
-        return NULL;
+static int hc_buffer_try_push(hc_buffer_t *buffer, hc_buffer_lane_t *lane, hc_packet_t *packet) {
+    if (buffer->mode == HC_BUFFER_MODE_SPSC) {
+        return hc_buffer_enqueue(lane, packet, buffer->overflowPolicy);
     }
-    // According to the current input data we're using, only every 3rd and 4th byte is a valid hex character.
-    // Each will account for 4 off the length, and only a third or fourth index will count for the offset
-    // Before doing the parse, check that the packet size can accomadate the request
-    if (packet->size < (lengthBits / 8) + (offsetBits / 8)) {
-        ESP_LOGE(TAG, "Packet not large enough to digest");
-        return NULL;
+    pthread_mutex_lock(&buffer->buffer_lock);
+    int result = hc_buffer_enqueue(lane, packet, buffer->overflowPolicy);
+    pthread_mutex_unlock(&buffer->buffer_lock);
+    return result;
+}
+
+int hc_push_buffer_packet(hc_buffer_t *buffer, hc_packet_t *packet) {
+    return hc_push_buffer_lane(buffer, packet, HC_BUFFER_LANE_DATA);
+}
+
+int hc_push_buffer_lane(hc_buffer_t *buffer, hc_packet_t *packet, int lane) {
+    if (packet == NULL) { return HC_BUFFER_PUSH_INVALID; }
+    if (lane < 0 || lane >= HC_BUFFER_LANES) {
+        ESP_LOGE(TAG, "Invalid buffer lane %d", lane);
+        free_packet(packet);
+        return HC_BUFFER_PUSH_INVALID;
     }
-    // Now we can start the digest
-    char *digest = malloc(sizeof(char) * (ceil((double)lengthBits / 8)));
-    // We'll do a bit shift (kind of magic)
-    // Shift the packet->data by the offset bits, then mask with num bits in length as 1, others 0
-    // digest = ((char *)packet->data >> offsetBits) & ((1 << lengthBits) - 1);
-    int remainingBits = lengthBits;
-    int currentBit = offsetBits;
-    char byteTarget = 0x00;
-    while (remainingBits > 0) {
-        // First get the bit from the packet that we want
-        byteTarget = packet->data[currentBit / 8];
-        if (currentBit % 8 == 0) { byteTarget = byteTarget >> 4; }
-        else { byteTarget = byteTarget & 0x0F; }
-        // Now look to set the target half
-        if ((lengthBits - remainingBits) % 8 == 0) { 
-            digest[(lengthBits - remainingBits) / 8] = byteTarget; 
-        } else {
-            digest[(lengthBits - remainingBits) / 8] = (digest[(lengthBits - remainingBits) / 8] << 4) | byteTarget;
+    hc_buffer_lane_t *bufferLane = &buffer->lanes[lane];
+    // Add the packet to the lane
+    int result = hc_buffer_try_push(buffer, bufferLane, packet);
+    if (result == HC_BUFFER_PUSH_FULL && buffer->overflowPolicy == HC_BUFFER_OVERFLOW_BLOCK && bufferLane->capacity > 0) {
+        // Sleep until the consumer frees a slot, for whatever is left of the timeout
+        TickType_t start = xTaskGetTickCount();
+        TickType_t timeout = pdMS_TO_TICKS(buffer->blockTimeoutMs);
+        TickType_t elapsed;
+        while (result == HC_BUFFER_PUSH_FULL) {
+            elapsed = xTaskGetTickCount() - start;
+            if (elapsed >= timeout) {
+                result = HC_BUFFER_PUSH_TIMEOUT;
+                break;
+            }
+            xSemaphoreTake(buffer->spaceReady, timeout - elapsed);
+            result = hc_buffer_try_push(buffer, bufferLane, packet);
         }
-        // Now tick
-        remainingBits -= 4;
-        currentBit += 4;
     }
+    if (result < 0) {
+        // The packet is ours either way, so it goes back to the pool
+        ESP_LOGE(TAG, "Buffer lane %d is full, dropping packet", lane);
+        atomic_fetch_add_explicit(&bufferLane->dropped, 1, memory_order_relaxed);
+        free_packet(packet);
+        return result;
+    }
+    if (result == HC_BUFFER_PUSH_EVICTED) {
+        ESP_LOGW(TAG, "Buffer lane %d is full, dropped the oldest packet", lane);
+    }
+    // Wake the consumer if it's waiting on us
+    xSemaphoreGive(buffer->packetReady);
+    return result;
+}
 
-    // Finish with ye olde packet building
-    hc_packet_t *snipped_packet = (hc_packet_t *)malloc(sizeof(hc_packet_t));
-    snipped_packet->data = digest;
-    snipped_packet->size = ceil((double)lengthBits / 8);
-    return snipped_packet;
+int hc_push_buffer_batch(hc_buffer_t *buffer, hc_packet_t **packets, int count, int lane) {
+    if (lane < 0 || lane >= HC_BUFFER_LANES) {
+        ESP_LOGE(TAG, "Invalid buffer lane %d", lane);
+        for (int i = 0; i < count; i++) { free_packet(packets[i]); }
+        return 0;
+    }
+    // Whatever fits goes in with one publish
+    int queued;
+    if (buffer->mode == HC_BUFFER_MODE_SPSC) {
+        queued = hc_buffer_enqueue_batch(&buffer->lanes[lane], packets, count);
+    } else {
+        pthread_mutex_lock(&buffer->buffer_lock);
+        queued = hc_buffer_enqueue_batch(&buffer->lanes[lane], packets, count);
+        pthread_mutex_unlock(&buffer->buffer_lock);
+    }
+    if (queued > 0) {
+        xSemaphoreGive(buffer->packetReady);
+    }
+    // The rest overflowed, so they go one by one through the buffer's overflow policy
+    for (int i = queued; i < count; i++) {
+        if (hc_push_buffer_lane(buffer, packets[i], lane) > 0) { queued++; }
+    }
+    return queued;
 }
 
-long long int packet_to_int(hc_packet_t* packet) {
-    if (packet == NULL) {
-        // ESP_LOGE(TAG, "Packet is NULL");
-        return -1;
+hc_packet_t* hc_buffer_reserve(hc_buffer_t *buffer) {
+    // We don't know the lane until the packet is filled, so hand out a slot as long as some lane can take it
+    // A full data lane then only drops data at commit time, and control still gets through
+    // The other policies make room (or wait for it) at commit time, so there's nothing to check
+    if (buffer->overflowPolicy != HC_BUFFER_OVERFLOW_DROP_NEWEST) {
+        return hc_packet_acquire();
+    }
+    for (int i = 0; i < HC_BUFFER_LANES; i++) {
+        if (hc_buffer_lane_size(buffer, i) < (int)buffer->lanes[i].capacity) {
+            return hc_packet_acquire();
+        }
     }
-    // Take null terminated char* and convert to long long int
-    long long int result = 0;
-    for (int i = 0; i < packet->size; i++) {
-        result = result << 8;
-        result += packet->data[i];
+    return NULL;
+}
+
+int hc_buffer_commit(hc_buffer_t *buffer, hc_packet_t *packet, int lane) {
+    // The reserved packet is just a pool packet, so committing is a plain ownership push
+    return hc_push_buffer_lane(buffer, packet, lane);
+}
+
+int hc_buffer_size(hc_buffer_t *buffer) {
+    int size = 0;
+    for (int i = 0; i < HC_BUFFER_LANES; i++) {
+        size += hc_buffer_lane_size(buffer, i);
     }
-    free_packet(packet);
-    return result;
+    return size;
 }
 
-int write_bytes(char* dataString, long long writeData, int lengthBits, int offsetBits, int dataArraySize) {
-    // First check that we're writing to a reasonable place in the byte string
-    if (lengthBits % 4 != 0 || offsetBits % 4 != 0) {
-        ESP_LOGE(TAG, "Invalid data write parameters");
+int hc_buffer_lane_size(hc_buffer_t *buffer, int lane) {
+    // This is only a snapshot, either side may move right after we read it
+    unsigned int tail = atomic_load_explicit(&buffer->lanes[lane].tail, memory_order_acquire);
+    unsigned int head = atomic_load_explicit(&buffer->lanes[lane].head, memory_order_acquire);
+    return (int)(tail - head);
+}
+
+void hc_buffer_get_lane_stats(hc_buffer_t *buffer, int lane, hc_buffer_lane_stats_t *stats) {
+    hc_buffer_lane_t *bufferLane = &buffer->lanes[lane];
+    stats->capacity = bufferLane->capacity;
+    stats->depth = hc_buffer_lane_size(buffer, lane);
+    stats->peakDepth = atomic_load_explicit(&bufferLane->peakDepth, memory_order_relaxed);
+    stats->enqueued = atomic_load_explicit(&bufferLane->enqueued, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&bufferLane->dropped, memory_order_relaxed);
+}
+
+int hc_packet_pool_init(int slots) {
+    if (slots <= 0 || slots > HC_PACKET_POOL_MAX_SLOTS) {
+        ESP_LOGE(TAG, "Invalid packet pool size %d", slots);
         return -1;
     }
-    // Now we'll also check that we're in bounds of the byte string
-    if (dataArraySize < (lengthBits / 8) + (offsetBits / 8)) {
-        ESP_LOGE(TAG, "Data write array not large enough to write to");
+    // Three allocations for the whole lifetime of the node, instead of two per packet
+    packetPool.packets = malloc(sizeof(hc_packet_t) * slots);
+    packetPool.storage = malloc(sizeof(char) * HC_BUFFER_DATA_MAX * slots);
+    packetPool.next = malloc(sizeof(uint16_t) * slots);
+    if (packetPool.packets == NULL || packetPool.storage == NULL || packetPool.next == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate packet pool of %d slots", slots);
         return -1;
     }
-    // Then it's time to begin!
-    int bitsToWrite = lengthBits;
-    int currentBit = offsetBits;
-    while (bitsToWrite > 0) {
-        // We'll always index dataString with
-        // dataString[currentBit / 8]
-        // And the data to write will always be shifted by the bits to write
-        // writeData = writeData >> bitsToWrite;
-        // Check if we're targeting the second half
-        if (currentBit % 8 == 0) {
-            // Writing first half
-            dataString[currentBit / 8] = (dataString[currentBit / 8] & 0x0F) | (((writeData >> (bitsToWrite - 4)) & 0xF) << 4);
-        } else {
-            // Writing second half
-            dataString[currentBit / 8] = (dataString[currentBit / 8] & 0xF0) | ((writeData >> (bitsToWrite - 4)) & 0xF);
-        }
-        // Now tick
-        bitsToWrite -= 4;
-        currentBit += 4;
+    packetPool.slots = slots;
+    // Chain every slot into the free list in order
+    for (int i = 0; i < slots; i++) {
+        packetPool.packets[i].data = packetPool.storage + (i * HC_BUFFER_DATA_MAX);
+        packetPool.packets[i].size = 0;
+        packetPool.packets[i].slot = i;
+        atomic_init(&packetPool.next[i], (i + 1 < slots) ? i + 1 : HC_PACKET_POOL_EMPTY);
     }
+    atomic_init(&packetPool.freeHead, 0);
+    atomic_init(&packetPool.inUse, 0);
+    atomic_init(&packetPool.peakInUse, 0);
+    atomic_init(&packetPool.acquired, 0);
+    atomic_init(&packetPool.exhausted, 0);
+    return 1;
+}
+
+hc_packet_t* hc_packet_acquire() {
+    unsigned int head = atomic_load_explicit(&packetPool.freeHead, memory_order_acquire);
+    unsigned int next;
+    uint16_t index;
+    do {
+        index = head & 0xFFFF;
+        if (index == HC_PACKET_POOL_EMPTY || packetPool.slots == 0) {
+            atomic_fetch_add_explicit(&packetPool.exhausted, 1, memory_order_relaxed);
+            return NULL;
+        }
+        // The tag goes up on every swap, so this only lands if nobody else touched the list
+        next = (((head >> 16) + 1) << 16) | atomic_load_explicit(&packetPool.next[index], memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&packetPool.freeHead, &head, next,
+                                                    memory_order_acquire, memory_order_acquire));
 
+    // Keep the counters up to date
+    atomic_fetch_add_explicit(&packetPool.acquired, 1, memory_order_relaxed);
+    int inUse = atomic_fetch_add_explicit(&packetPool.inUse, 1, memory_order_relaxed) + 1;
+    int peak = atomic_load_explicit(&packetPool.peakInUse, memory_order_relaxed);
+    while (inUse > peak && !atomic_compare_exchange_weak_explicit(&packetPool.peakInUse, &peak, inUse,
+                                                                 memory_order_relaxed, memory_order_relaxed)) {}
 
-    return (currentBit/8) + 1; // Returns the 1-index in the data array of the last byte written
+    hc_packet_t *packet = &packetPool.packets[index];
+    packet->size = 0;
+    packet->segmentCount = 0;
+    packet->release = NULL;
+    return packet;
 }
 
-int write_chars_to_bytes(char* dataString, char* writeData, int lengthBits, int offsetBits, int dataArraySize) {
-    // First check that we're writing to a reasonable place in the byte string
-    if (lengthBits % 8 != 0 || offsetBits % 8 != 0) {
-        ESP_LOGE(TAG, "Invalid data write parameters");
+static void hc_packet_release(hc_packet_t *packet) {
+    uint16_t index = packet->slot;
+    unsigned int head = atomic_load_explicit(&packetPool.freeHead, memory_order_relaxed);
+    unsigned int next;
+    do {
+        atomic_store_explicit(&packetPool.next[index], head & 0xFFFF, memory_order_relaxed);
+        next = (((head >> 16) + 1) << 16) | index;
+    } while (!atomic_compare_exchange_weak_explicit(&packetPool.freeHead, &head, next,
+                                                    memory_order_release, memory_order_relaxed));
+    atomic_fetch_sub_explicit(&packetPool.inUse, 1, memory_order_relaxed);
+}
+
+void hc_packet_pool_get_stats(hc_packet_pool_stats_t *stats) {
+    stats->slots = packetPool.slots;
+    stats->inUse = atomic_load_explicit(&packetPool.inUse, memory_order_relaxed);
+    stats->peakInUse = atomic_load_explicit(&packetPool.peakInUse, memory_order_relaxed);
+    stats->acquired = atomic_load_explicit(&packetPool.acquired, memory_order_relaxed);
+    stats->exhausted = atomic_load_explicit(&packetPool.exhausted, memory_order_relaxed);
+}
+
+void hc_reader_init(hc_reader_t *reader, const hc_packet_t *packet) {
+    reader->data = packet->data;
+    reader->size = packet->size;
+    reader->bitOffset = 0;
+    reader->error = 0;
+}
+
+static int hc_reader_check(hc_reader_t *reader, int lengthBits) {
+    // Once a read has failed, every read after it fails too
+    if (reader->error) { return -1; }
+    if (lengthBits < 0 || reader->bitOffset + lengthBits > reader->size * 8) {
+        reader->error = 1;
         return -1;
     }
-    // Now we'll also check that we're in bounds of the byte string
-    if (dataArraySize < (lengthBits / 8) + (offsetBits / 8)) {
+    return 1;
+}
+
+uint64_t hc_read_bits(hc_reader_t *reader, int lengthBits) {
+    if (lengthBits < 1 || lengthBits > 64) {
+        ESP_LOGE(TAG, "Invalid read length %d", lengthBits);
+        reader->error = 1;
+        return 0;
+    }
+    if (hc_reader_check(reader, lengthBits) < 0) { return 0; }
+    uint64_t value = hc_load_bits(reader->data, reader->bitOffset, lengthBits);
+    reader->bitOffset += lengthBits;
+    return value;
+}
+
+int hc_read_bytes(hc_reader_t *reader, char *destination, int length) {
+    const char *view = hc_read_view(reader, length);
+    if (view == NULL) { return -1; }
+    memcpy(destination, view, length);
+    return 1;
+}
+
+const char* hc_read_view(hc_reader_t *reader, int length) {
+    // Views only make sense on byte boundaries
+    if (reader->bitOffset % 8 != 0) {
+        reader->error = 1;
+        return NULL;
+    }
+    if (hc_reader_check(reader, length * 8) < 0) { return NULL; }
+    const char *view = reader->data + (reader->bitOffset / 8);
+    reader->bitOffset += length * 8;
+    return view;
+}
+
+void hc_reader_seek(hc_reader_t *reader, int bitOffset) {
+    if (bitOffset < 0 || bitOffset > reader->size * 8) {
+        reader->error = 1;
+        return;
+    }
+    reader->bitOffset = bitOffset;
+}
+
+void hc_reader_skip(hc_reader_t *reader, int lengthBits) {
+    if (hc_reader_check(reader, lengthBits) < 0) { return; }
+    reader->bitOffset += lengthBits;
+}
+
+int hc_reader_remaining_bits(hc_reader_t *reader) {
+    if (reader->error) { return 0; }
+    return reader->size * 8 - reader->bitOffset;
+}
+
+void hc_writer_init(hc_writer_t *writer, char *data, int capacity) {
+    writer->data = data;
+    writer->capacity = capacity;
+    writer->bitOffset = 0;
+    writer->error = 0;
+}
+
+static int hc_writer_check(hc_writer_t *writer, int bitOffset, int lengthBits) {
+    if (writer->error) { return -1; }
+    if (bitOffset < 0 || bitOffset + lengthBits > writer->capacity * 8) {
         ESP_LOGE(TAG, "Data write array not large enough to write to");
+        writer->error = 1;
         return -1;
     }
-    // Then it's time to begin!
-    int bitsToWrite = lengthBits;
-    int currentBit = offsetBits;
-    while (bitsToWrite > 0) {
-        // Because we're writing charts here, we can simply use bytes,
-        // and each char is 1 byte in, 1 byte out, plain and simple :)
-        dataString[currentBit / 8] = writeData[(lengthBits - bitsToWrite) / 8];
-        // Now tick
-        bitsToWrite -= 8;
-        currentBit += 8;
+    return 1;
+}
+
+void hc_write_bits(hc_writer_t *writer, uint64_t value, int lengthBits) {
+    if (lengthBits < 1 || lengthBits > 64) {
+        ESP_LOGE(TAG, "Invalid data write length %d", lengthBits);
+        writer->error = 1;
+        return;
     }
+    if (hc_writer_check(writer, writer->bitOffset, lengthBits) < 0) { return; }
+    hc_store_bits(writer->data, writer->bitOffset, lengthBits, value);
+    writer->bitOffset += lengthBits;
+}
 
+void hc_write_bytes(hc_writer_t *writer, const char *source, int length) {
+    char *destination = hc_write_view(writer, length);
+    if (destination == NULL) { return; }
+    memcpy(destination, source, length);
+}
 
-    return (currentBit/8) + 1; // Returns the 1-index in the data array of the last byte written
+char* hc_write_view(hc_writer_t *writer, int length) {
+    // Bulk writes only make sense on byte boundaries
+    if (writer->bitOffset % 8 != 0) {
+        ESP_LOGE(TAG, "Invalid data write parameters");
+        writer->error = 1;
+        return NULL;
+    }
+    if (hc_writer_check(writer, writer->bitOffset, length * 8) < 0) { return NULL; }
+    char *view = writer->data + (writer->bitOffset / 8);
+    writer->bitOffset += length * 8;
+    return view;
+}
+
+void hc_write_bits_at(hc_writer_t *writer, uint64_t value, int lengthBits, int bitOffset) {
+    // Patches only go over what's already been encoded
+    if (lengthBits < 1 || lengthBits > 64 || bitOffset + lengthBits > writer->bitOffset) {
+        ESP_LOGE(TAG, "Invalid data write parameters");
+        writer->error = 1;
+        return;
+    }
+    if (hc_writer_check(writer, bitOffset, lengthBits) < 0) { return; }
+    hc_store_bits(writer->data, bitOffset, lengthBits, value);
+}
+
+int hc_writer_length(hc_writer_t *writer) {
+    return (writer->bitOffset + 7) / 8;
 }
 
 void free_packet(hc_packet_t* packet) {
+    // Whoever owns the segments gets them back whichever way the packet went (sent, dropped by a full lane, ...)
+    if (packet->release != NULL) {
+        packet->release(packet->releaseContext);
+        packet->release = NULL;
+    }
+    if (packet->slot != HC_PACKET_NOT_POOLED) {
+        hc_packet_release(packet);
+        return;
+    }
     free(packet->data);
     free(packet);
-}
\ No newline at end of file
+}
+
+int hc_packet_add_segment(hc_packet_t* packet, const char *data, int size) {
+    if (packet->segmentCount >= HC_PACKET_MAX_SEGMENTS) { return -1; }
+    packet->segments[packet->segmentCount].data = data;
+    packet->segments[packet->segmentCount].size = size;
+    packet->segmentCount++;
+    return 1;
+}
+
+int hc_packet_wire_size(const hc_packet_t* packet) {
+    if (packet->segmentCount == 0) { return packet->size; }
+    int size = 0;
+    for (int i = 0; i < packet->segmentCount; i++) {
+        size += packet->segments[i].size;
+    }
+    return size;
+}
@@ -0,0 +1,52 @@
+/*
+* Monotonic time and the network time offset (see hc_clock.h)
+*/
+#include <stdatomic.h>
+#include "esp_timer.h"
+
+#include "hc_clock.h"
+
+static const char* TAG = "HC_CLOCK";
+
+// Only the engine observes, but anyone can read, so both are atomic
+static _Atomic int64_t offsetMs = HC_FIXED_TIME_MIN_VALUE * 1000; // Network time minus monotonic time
+static _Atomic uint64_t lastNetworkMs = 0; // Most recent network time handed out, nothing earlier is after it
+static atomic_bool synced = false;
+
+uint64_t hc_clock_monotonic_ms() {
+    return (uint64_t)(esp_timer_get_time() / 1000);
+}
+
+uint64_t hc_clock_network_at(uint64_t monotonicMs) {
+    return monotonicMs + atomic_load(&offsetMs);
+}
+
+uint64_t hc_clock_network_ms() {
+    uint64_t networkMs = hc_clock_network_at(hc_clock_monotonic_ms());
+    // The offset can be steered back a little, and when it is, time stands still until it catches up
+    uint64_t last = atomic_load(&lastNetworkMs);
+    while (networkMs > last) {
+        if (atomic_compare_exchange_weak(&lastNetworkMs, &last, networkMs)) { return networkMs; }
+    }
+    return last;
+}
+
+bool hc_clock_synced() {
+    return atomic_load(&synced);
+}
+
+int hc_clock_observe(uint64_t networkMs) {
+    if (networkMs < HC_CLOCK_SYNCED_MIN_MS) { return 0; }
+    int64_t sample = (int64_t)(networkMs - hc_clock_monotonic_ms());
+    if (!atomic_load(&synced)) {
+        // The first real time we hear is a better guess than anything we had, so it's taken as is
+        ESP_LOGI(TAG, "Updated network time to match a neighbor");
+        atomic_store(&offsetMs, sample);
+        atomic_store(&synced, true);
+        return 1;
+    }
+    // After that every sample only nudges it, which keeps one slow or fast neighbor from dragging us around
+    int64_t offset = atomic_load(&offsetMs);
+    atomic_store(&offsetMs, offset + (sample - offset) / HC_CLOCK_SMOOTHING);
+    return 1;
+}
@@ -0,0 +1,80 @@
+
+#include <string.h>
+#include "freertos/task.h"
+
+#include "hc_dedup.h"
+#include "hc_overlay.h"
+
+static const char* TAG = "HC_DEDUP";
+
+void hc_dedup_init(hc_dedup_cache_t* cache) {
+    memset(cache, 0, sizeof(hc_dedup_cache_t));
+}
+
+static bool hc_dedup_fresh(const hc_dedup_entry_t* entry, TickType_t now) {
+    // Ages are unsigned differences, so they're fine across tick wraparound
+    return entry->used && (TickType_t)(now - entry->seen) < pdMS_TO_TICKS(HC_DEDUP_TTL_MS);
+}
+
+int hc_dedup_check(hc_dedup_cache_t* cache, const hc_packet_t* packet) {
+    // Everything here comes from the header and the extension headers, nothing gets parsed
+    // The sequence number tells one message from another, and a fragment's index tells apart the pieces of one
+    uint32_t source = HC_SCHEMA_GET(packet->data, HC_OVERLAY_HEADER, sourceLogicalAddress);
+    uint32_t sequence = 0;
+    int fragment = -1;
+    bool sequenced = false;
+    int extensionType;
+    int offset = -1;
+    for (int i = 0; i < HC_OVERLAY_MAX_EXTENSIONS && (offset = hc_overlay_next_extension(packet, offset, &extensionType)) >= 0; i++) {
+        if (extensionType != HC_MSG_EXT_SEQUENCE_TYPE && extensionType != HC_MSG_EXT_FRAGMENT_TYPE) {
+            continue;
+        }
+        const char* extensionHeader = packet->data + offset;
+        const char* extensionData = extensionHeader + hc_overlay_ext_header_bytes(extensionHeader);
+        int needed = extensionType == HC_MSG_EXT_SEQUENCE_TYPE ? HC_SCHEMA_BYTES(HC_OVERLAY_SEQUENCE) : HC_SCHEMA_BYTES(HC_OVERLAY_FRAGMENT);
+        if (hc_overlay_ext_length(extensionHeader) < needed || extensionData + needed > packet->data + packet->size) {
+            return HC_DEDUP_UNKEYED;
+        }
+        if (extensionType == HC_MSG_EXT_SEQUENCE_TYPE) {
+            sequence = HC_SCHEMA_GET(extensionData, HC_OVERLAY_SEQUENCE, sequence);
+            sequenced = true;
+        } else {
+            fragment = HC_SCHEMA_GET(extensionData, HC_OVERLAY_FRAGMENT, index);
+        }
+    }
+    if (!sequenced) {
+        return HC_DEDUP_UNKEYED;
+    }
+
+    // Pick the set, the source is mixed in so one busy sender doesn't pile into the same sets
+    hc_dedup_entry_t* set = cache->sets[((sequence + fragment) ^ (source * 2654435761u)) & (HC_DEDUP_SETS - 1)];
+    TickType_t now = xTaskGetTickCount();
+    hc_dedup_entry_t* victim = &set[0];
+    for (int i = 0; i < HC_DEDUP_WAYS; i++) {
+        hc_dedup_entry_t* entry = &set[i];
+        if (!hc_dedup_fresh(entry, now)) {
+            // Anything stale is fair game
+            if (hc_dedup_fresh(victim, now)) { victim = entry; }
+            continue;
+        }
+        if (entry->source == source && entry->sequence == sequence && entry->fragment == fragment) {
+            cache->duplicates++;
+            return HC_DEDUP_DUPLICATE;
+        }
+        // Otherwise we'll take the oldest
+        if (hc_dedup_fresh(victim, now) && (TickType_t)(now - entry->seen) > (TickType_t)(now - victim->seen)) {
+            victim = entry;
+        }
+    }
+
+    if (hc_dedup_fresh(victim, now)) {
+        ESP_LOGD(TAG, "Evicting a fresh entry for %u", victim->source);
+        cache->evictions++;
+    }
+    victim->source = source;
+    victim->sequence = sequence;
+    victim->fragment = fragment;
+    victim->seen = now;
+    victim->used = true;
+    return HC_DEDUP_NEW;
+}
@@ -0,0 +1,124 @@
+/*
+* Application callbacks on their own task, fed by a queue the engine pushes to (see hc_delivery.h)
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/task.h"
+
+#include "hc_delivery.h"
+
+static const char* TAG = "HC_DELIVERY";
+
+int hc_delivery_start(hypercast_t* hypercast, const hc_delivery_config_t* config) {
+    if (config->depth <= 0 || config->depth > HC_DELIVERY_MAX_DEPTH) {
+        ESP_LOGE(TAG, "Invalid delivery queue depth %d, the most is %d", config->depth, HC_DELIVERY_MAX_DEPTH);
+        return -1;
+    }
+    if (config->mode != HC_BUFFER_MODE_SPSC && config->mode != HC_BUFFER_MODE_LOCKED) {
+        ESP_LOGE(TAG, "Invalid delivery queue mode %d", config->mode);
+        return -1;
+    }
+    hc_delivery_queue_t* queue = hc_buffer_aligned_alloc(sizeof(hc_delivery_queue_t)); // It starts with the buffer
+    if (queue == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate delivery queue");
+        return -1;
+    }
+    // Only the application task pops, the config says whether the engine is the only one pushing
+    hc_allocate_buffer_mode(&queue->buffer, config->depth, config->mode);
+    hc_buffer_set_overflow_policy(&queue->buffer, config->overflowPolicy, config->blockTimeoutMs);
+    queue->batchCallback = config->batchCallback;
+    queue->delivered = 0;
+    atomic_init(&queue->failed, 0);
+    hypercast->delivery = queue;
+
+    xTaskCreate(hc_delivery_handler, "HYPERCAST_delivery", HC_DELIVERY_TASK_STACK, hypercast, HC_DELIVERY_TASK_PRIORITY, NULL);
+    ESP_LOGI(TAG, "Delivery task started, queue depth %d", config->depth);
+    return 1;
+}
+
+int hc_delivery_push_message(hypercast_t* hypercast, const hc_packet_t* packet) {
+    hc_delivery_queue_t* queue = hypercast->delivery;
+    // The received packet is about to be patched and forwarded, so the application gets its own copy
+    hc_packet_t* copy = hc_packet_acquire();
+    if (copy == NULL) {
+        ESP_LOGE(TAG, "Packet pool exhausted, can't queue delivery");
+        queue->failed++;
+        return -1;
+    }
+    memcpy(copy->data, packet->data, packet->size);
+    copy->size = packet->size;
+    // The buffer frees the copy if its overflow policy won't take it
+    return hc_push_buffer_packet(&queue->buffer, copy) > 0 ? 1 : -1;
+}
+
+int hc_delivery_push_buffer(hypercast_t* hypercast, char* data, int length) {
+    hc_delivery_queue_t* queue = hypercast->delivery;
+    hc_packet_t* packet = hc_packet_acquire();
+    if (packet == NULL) {
+        ESP_LOGE(TAG, "Packet pool exhausted, can't queue delivery");
+        free(data);
+        queue->failed++;
+        return -1;
+    }
+    // The slot itself stays empty, the buffer rides along as its segment and is freed with the packet
+    hc_packet_add_segment(packet, data, length);
+    packet->release = free;
+    packet->releaseContext = data;
+    return hc_push_buffer_packet(&queue->buffer, packet) > 0 ? 1 : -1;
+}
+
+static int hc_delivery_collect(const hc_packet_t* packet, hc_delivery_t* deliveries) {
+    // A reassembled buffer is the one segment
+    if (packet->segmentCount > 0) {
+        deliveries[0].data = packet->segments[0].data;
+        deliveries[0].length = packet->segments[0].size;
+        return 1;
+    }
+    // Otherwise it's an overlay message the engine already checked, and each payload in it is a delivery
+    int count = 0;
+    int extensionType;
+    int offset = -1;
+    for (int i = 0; i < HC_OVERLAY_MAX_EXTENSIONS && (offset = hc_overlay_next_extension(packet, offset, &extensionType)) >= 0; i++) {
+        if (extensionType != HC_MSG_EXT_PAYLOAD_TYPE) { continue; }
+        const char* extensionHeader = packet->data + offset;
+        int payloadStart = offset + hc_overlay_ext_header_bytes(extensionHeader);
+        int payloadLength = hc_overlay_ext_length(extensionHeader);
+        if (payloadStart + payloadLength > packet->size) { break; }
+        deliveries[count].data = packet->data + payloadStart;
+        deliveries[count].length = payloadLength;
+        count++;
+    }
+    return count;
+}
+
+void hc_delivery_handler(void* pvParameters) {
+    hypercast_t* hypercast = (hypercast_t*)pvParameters;
+    hc_delivery_queue_t* queue = hypercast->delivery;
+    hc_packet_t* packets[HC_DELIVERY_BATCH_SIZE];
+    hc_delivery_t deliveries[HC_DELIVERY_BATCH_SIZE * HC_OVERLAY_MAX_EXTENSIONS];
+    int count;
+    int deliveryCount;
+    ESP_LOGI(TAG, "Delivery Handler Ready");
+    while (1) {
+        // Take everything that's waiting (up to a batch), the wait wakes as soon as the engine pushes
+        count = hc_pop_buffer_batch_wait(&queue->buffer, packets, HC_DELIVERY_BATCH_SIZE, HC_DELIVERY_IDLE_WAIT);
+        if (count == 0) { continue; }
+
+        deliveryCount = 0;
+        for (int i = 0; i < count; i++) {
+            deliveryCount += hc_delivery_collect(packets[i], deliveries + deliveryCount);
+        }
+        // The payloads are views into the packets, so the packets are held until the callbacks are done
+        if (queue->batchCallback != NULL) {
+            queue->batchCallback(deliveries, deliveryCount);
+        } else {
+            for (int i = 0; i < deliveryCount; i++) {
+                hypercast->callback((char*)deliveries[i].data, deliveries[i].length);
+            }
+        }
+        queue->delivered += deliveryCount;
+        for (int i = 0; i < count; i++) {
+            free_packet(packets[i]);
+        }
+    }
+}
@@ -6,106 +6,270 @@
 */
 #include "hc_engine.h"
 
+#include <stdlib.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
 #include "hc_protocols.h"
 #include "hc_overlay.h"
+#include "hc_filter.h"
+#include "hc_fragment.h"
+#include "hc_aggregate.h"
+#include "hc_delivery.h"
+#include "hc_timer.h"
+#include "hc_clock.h"
 
 static const char* TAG = "HC_ENGINE";
 
+static void hc_engine_expire_fragments(hypercast_t *hypercast, void *timer) {
+    // Partly reassembled buffers that have gone quiet give their memory back
+    hc_fragment_expire(hypercast->fragments);
+    hc_timer_schedule(hypercast, (hc_timer_t*)timer, HC_ENGINE_FRAGMENT_EXPIRY_INTERVAL);
+}
+
 void hc_engine_handler(hypercast_t *hypercast) {
     // Now init and prep for engine
-    hc_packet_t *packet = NULL;
+    hc_packet_t *packets[HC_ENGINE_BATCH_SIZE];
+    hc_packet_t *packet;
+    int count;
+    int waitMs;
+    // The handler never returns, so its timers can live right here
+    hc_timer_t fragmentExpiry;
+    hc_timer_init(&fragmentExpiry, hc_engine_expire_fragments, &fragmentExpiry);
+    hc_timer_schedule(hypercast, &fragmentExpiry, HC_ENGINE_FRAGMENT_EXPIRY_INTERVAL);
     ESP_LOGI(TAG, "Buffer Processor Ready");
     while (1) {
-        ESP_LOGI(TAG, "Buffer Processor Running");
-        ESP_LOGI(TAG, "Free Memory %d", xPortGetFreeHeapSize());
+        ESP_LOGD(TAG, "Buffer Processor Running");
+        ESP_LOGD(TAG, "Free Memory %d", xPortGetFreeHeapSize());
         // SEND DISCOVERY
-        // First we'll send out our protocol discovery packet if necessary
-        // This is where we check the protocol and discovery timings
-        // Then use the func to add a protocol discovery packet to the send buffer
-        hc_protocol_maintenance(hypercast);
+        // Protocol beacons and timeouts (and anything else on a timer) that have come due run now
+        // This runs once per batch, not per packet, and costs a look at the soonest deadline when nothing's due
+        waitMs = hc_timer_run(hypercast, HC_ENGINE_MAX_IDLE_WAIT);
+        // Aggregated payloads that have waited long enough go out, and the rest decide how long we can sleep
+        waitMs = hc_aggregate_poll(hypercast, waitMs);
 
         // READ BUFFER
-        // Clear packet saved
-        if (packet != NULL) {
-            free_packet(packet);
-            packet = NULL;
+        // Wait for something to arrive in the buffer, then take as much as is there (up to a batch)
+        // The wait ends at the next deadline, so timers still go off on schedule while we're idle
+        count = hc_pop_buffer_batch_wait(hypercast->receiveBuffer, packets, HC_ENGINE_BATCH_SIZE, waitMs);
+        ESP_LOGD(TAG, "Processing %d packets", count);
+        for (int i = 0; i < count; i++) {
+            packet = packets[i];
+            hc_engine_process(packet, hypercast);
         }
+        // Overlay messages for the workers go over once per batch rather than once each
+        hc_engine_flush_workers(hypercast);
+    }
+}
 
-        // Check if anything exists in buffer
-        packet = hc_pop_buffer(hypercast->receiveBuffer);
-        // If we have NO packet, stop here
-        if (packet == NULL) { vTaskDelay(500 / portTICK_PERIOD_MS); continue; }
-        // Now we know we have a packet!
-        // Parse time :)
-        ESP_LOGI(TAG, "Packet Received");
-        // First thing to do is a length check.
-        // There are only two allowable packet lengths, so lets make sure we meet one
-        if (packet->size < HC_OVERLAY_PACKET_LENGTH) {
-            ESP_LOGE(TAG, "Packet not readable by Hypercast (Too Short)");
-            continue;
-        }
-        // Now let's first check the HC protocol ID to see if we can handle this message
-        long protocolId = packet_to_int(packet_snip_to_bytes(packet, 4, 0)); // It's only the first byte
-        ESP_LOGI(TAG, "Protocol ID: %ld", protocolId);
-        // We can only handle 13 which is an overlay message, or a protocol message
-        if (protocolId == HC_PROTOCOL_OVERLAY_MESSAGE) {
-            // Send to forwarding engine
-            ESP_LOGI(TAG, "Sending to forwarding engine");
-            hc_forward(packet, hypercast);
-        } else {
-            // Send to protocol parser
-            ESP_LOGI(TAG, "Sending to protocol parser");
-            hc_protocol_parse(packet, protocolId, hypercast);
+void hc_engine_process(hc_packet_t *packet, hypercast_t *hypercast) {
+    // Now we know we have a packet!
+    // Parse time :)
+    ESP_LOGI(TAG, "Packet Received");
+    // First thing to do is run it past the ingress filter
+    // It only reads the header in place, so anything we don't want is gone before we parse or allocate
+    int verdict = hc_filter_packet(hypercast, packet);
+    if (verdict == HC_FILTER_DROP) {
+        free_packet(packet);
+        return;
+    }
+    // Now let's first check the HC protocol ID to see if we can handle this message
+    hc_reader_t reader;
+    hc_reader_init(&reader, packet);
+    long protocolId = hc_read_bits(&reader, 4); // It's only the first nibble
+    ESP_LOGI(TAG, "Protocol ID: %ld", protocolId);
+    // We can only handle 13 which is an overlay message, or a protocol message
+    if (protocolId == HC_PROTOCOL_OVERLAY_MESSAGE && hypercast->workers != NULL) {
+        // Its source's worker takes it from here, the filter has already had its say
+        hc_engine_worker_t* worker = &hypercast->workers->workers[
+            hc_engine_worker_of(HC_SCHEMA_GET(packet->data, HC_OVERLAY_HEADER, sourceLogicalAddress), hypercast->workers->count)];
+        if (worker->pendingCount == HC_ENGINE_BATCH_SIZE) {
+            hc_engine_flush_workers(hypercast);
         }
+        worker->pending[worker->pendingCount++] = packet;
+    } else if (protocolId == HC_PROTOCOL_OVERLAY_MESSAGE) {
+        // Send to forwarding engine (which may send this very packet on)
+        ESP_LOGI(TAG, "Sending to forwarding engine");
+        hc_engine_shard_t shard = { .dedupCache = hypercast->dedupCache, .fragments = hypercast->fragments };
+        hc_forward(packet, hypercast, &shard, verdict != HC_FILTER_DELIVER_ONLY);
+    } else {
+        // Send to protocol parser
+        ESP_LOGI(TAG, "Sending to protocol parser");
+        hc_protocol_parse(packet, protocolId, hypercast);
+        free_packet(packet);
     }
 }
 
-void hc_forward(hc_packet_t *packet, hypercast_t *hypercast) {
+void hc_forward(hc_packet_t *packet, hypercast_t *hypercast, hc_engine_shard_t *shard, bool forward) {
+    // If we've already seen this message (it came in over another path), we've already delivered and
+    // forwarded it, so it goes before we spend anything on it
+    if (hc_dedup_check(shard->dedupCache, packet) == HC_DEDUP_DUPLICATE) {
+        ESP_LOGD(TAG, "Dropping duplicate overlay message");
+        free_packet(packet);
+        return;
+    }
+
     // First we'll read the packet to interpret the message & receive it
     // We're assuming that all overlay messages are multicast, but we check datamode anyway
-    hc_msg_overlay_t *msg = hc_msg_overlay_parse(packet);
+    // Only the header is decoded, the checks below and the payload read straight from the packet
+    hc_msg_overlay_t *msg = hc_msg_overlay_parse_lazy(packet);
 
     if (msg == NULL) {
         ESP_LOGE(TAG, "Failed to parse overlay message");
+        free_packet(packet);
         return;
     }
 
-    // Then check if this message is from a member of our ?neighbor? table
-    // If it is, then continue, otherwise, stop
-    if (hc_overlay_sender_trusted(msg, hypercast) == false) {
-        ESP_LOGD(TAG, "Sender not trusted - bouncing message");
-        hc_msg_overlay_free(msg);
-        return;
-    }
+    // Untrusted senders have already been turned away by the ingress filter
 
     // Before taking any action, check for a route record table
     // If we're on it, drop the message
     if (hc_overlay_route_record_contains(msg, hypercast->senderTable->sourceAddressLogical) == 1) {
         ESP_LOGI(TAG, "Dropping message from %d because we're on the route record table", msg->sourceLogicalAddress);
         hc_msg_overlay_free(msg);
+        free_packet(packet);
         return;
     }
-    
-    // Once we've read the packet, we need to send it forward!
-    // Before forwarding, tick down the hop limit and add to the last hop logical
-    msg->hopLimit = msg->hopLimit - 1;
-    msg->previousHopLogicalAddress = hypercast->senderTable->sourceAddressLogical;
-    // We'll also append ourselves to the route record (creating one if the other node was negligent)
-    hc_overlay_route_record_append(msg, hypercast->senderTable->sourceAddressLogical);
-
-    // Then send it out! (forwarding part)
-    hc_packet_t *forwardPacket = hc_msg_overlay_encode(msg);
-    hc_push_buffer(hypercast->sendBuffer, forwardPacket->data, forwardPacket->size);
-    // The packet data has been passed to the buffer, so we can cleanup the packet
-    free_packet(forwardPacket);
+
     // Then we need to run our api callback on the payload :)
+    // The payload is a view into the packet, so this happens before the packet is patched and sent on
     char* callbackData;
     int callbackDataLength;
-    hc_msg_overlay_get_primary_payload(msg, &callbackData, &callbackDataLength);
-    hypercast->callback(callbackData, callbackDataLength);
+    hc_msg_ext_fragment_t* fragment;
+    if (hc_msg_overlay_retrieve_extension_of_type(msg, HC_MSG_EXT_FRAGMENT_TYPE, (void**)&fragment) > 0) {
+        // A piece of a bigger buffer, which only goes to the callback once it's all here
+        if (hc_msg_overlay_get_primary_payload(msg, &callbackData, &callbackDataLength) > 0) {
+            hc_fragment_receive(hypercast, shard->fragments, msg->sourceLogicalAddress, fragment, callbackData, callbackDataLength);
+        }
+    } else if (hypercast->delivery != NULL) {
+        // The application task gets its own copy and takes it from there, so however slow the callback is
+        // forwarding only pays for the copy
+        if (hc_msg_overlay_get_payload(msg, 0, &callbackData, &callbackDataLength) > 0) {
+            hc_delivery_push_message(hypercast, packet);
+        }
+    } else {
+        // Aggregated messages carry several payloads, each one was sent on its own so it's delivered on its own
+        for (int i = 0; hc_msg_overlay_get_payload(msg, i, &callbackData, &callbackDataLength) > 0; i++) {
+            hypercast->callback(callbackData, callbackDataLength);
+        }
+    }
     // Then free the message data
     hc_msg_overlay_free(msg);
-}
\ No newline at end of file
+    
+    // Once we've read the packet, we need to send it forward!
+    // The received bytes become the forwarded ones: the hop limit ticks down, we become the last hop,
+    // and we go on the end of the route record (all patched in place, the payload never moves)
+    int result = forward ? hc_overlay_forward_in_place(packet, hypercast->senderTable->sourceAddressLogical) : -1;
+    if (result > 0) {
+        // Then send it out! (forwarding part)
+        // The packet is handed to the buffer, which frees it once it's sent
+        hc_push_buffer_packet(hypercast->sendBuffer, packet);
+        hypercast->forwardStats.forwarded++;
+        if (result == HC_OVERLAY_ROUTE_TRUNCATED) { hypercast->forwardStats.truncated++; }
+    } else {
+        if (forward) { hypercast->forwardStats.failed++; }
+        free_packet(packet);
+    }
+}
+
+static void hc_engine_free_workers(hc_engine_workers_t* workers, int count) {
+    // Only the first count got as far as being set up
+    for (int i = 0; i < count; i++) {
+        hc_engine_worker_t* worker = &workers->workers[i];
+        hc_free_buffer(&worker->queue);
+        free(worker->shard.dedupCache);
+        free(worker->shard.fragments);
+    }
+    hc_buffer_aligned_free(workers);
+}
+
+int hc_engine_start_workers(hypercast_t *hypercast, int count) {
+    if (count <= 0 || count > HC_ENGINE_MAX_WORKERS) {
+        ESP_LOGE(TAG, "Invalid worker count %d, the most is %d", count, HC_ENGINE_MAX_WORKERS);
+        return -1;
+    }
+    if (hypercast->delivery == NULL) {
+        // The delivery task is what keeps the callback on one task, without it every worker would call it at once
+        ESP_LOGE(TAG, "Workers need the delivery task, set HC_DELIVERY_ASYNC to start them");
+        return -1;
+    }
+    if (hypercast->delivery->buffer.mode == HC_BUFFER_MODE_SPSC) {
+        // Every worker delivers, and a queue set up for the engine alone won't take that
+        ESP_LOGE(TAG, "Delivery queue only takes one pusher, start it with HC_BUFFER_MODE_LOCKED to add workers");
+        return -1;
+    }
+    // hc_buffer_t pads every worker out to whole cache lines, so each queue is aligned as long as the array is
+    hc_engine_workers_t* workers = hc_buffer_aligned_alloc(sizeof(hc_engine_workers_t));
+    if (workers == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate workers");
+        return -1;
+    }
+    workers->count = count;
+    for (int i = 0; i < count; i++) {
+        hc_engine_worker_t* worker = &workers->workers[i];
+        hc_allocate_buffer_mode(&worker->queue, HC_ENGINE_WORKER_QUEUE_SIZE, HC_BUFFER_MODE_SPSC);
+        hc_buffer_set_overflow_policy(&worker->queue, HC_BUFFER_OVERFLOW_BLOCK, HC_ENGINE_WORKER_BLOCK_MS);
+        worker->shard.dedupCache = malloc(sizeof(hc_dedup_cache_t));
+        worker->shard.fragments = malloc(sizeof(hc_fragment_state_t));
+        if (worker->queue.lanes[HC_BUFFER_LANE_DATA].data == NULL || worker->shard.dedupCache == NULL || worker->shard.fragments == NULL) {
+            ESP_LOGE(TAG, "Failed to allocate worker %d", i);
+            // Nothing's running yet, so everything so far can just go
+            hc_engine_free_workers(workers, i + 1);
+            return -1;
+        }
+        hc_dedup_init(worker->shard.dedupCache);
+        hc_fragment_init(worker->shard.fragments);
+        worker->hypercast = hypercast;
+        worker->core = i % portNUM_PROCESSORS;
+        worker->processed = 0;
+        worker->pendingCount = 0;
+    }
+    // Everything is set up before the first worker runs, and before the engine hands anything over
+    hypercast->workers = workers;
+    for (int i = 0; i < count; i++) {
+        xTaskCreatePinnedToCore(hc_engine_worker_handler, "HYPERCAST_worker", HC_ENGINE_WORKER_STACK, &workers->workers[i],
+                                HC_ENGINE_WORKER_PRIORITY, NULL, workers->workers[i].core);
+    }
+    ESP_LOGI(TAG, "%d workers started over %d cores", count, portNUM_PROCESSORS);
+    return 1;
+}
+
+int hc_engine_worker_of(uint32_t source, int count) {
+    // Logical addresses can be anything, so they're mixed before they're spread over the workers
+    return (int)(((uint64_t)(uint32_t)(source * 2654435761u) * count) >> 32);
+}
+
+void hc_engine_flush_workers(hypercast_t *hypercast) {
+    if (hypercast->workers == NULL) { return; }
+    for (int i = 0; i < hypercast->workers->count; i++) {
+        hc_engine_worker_t* worker = &hypercast->workers->workers[i];
+        if (worker->pendingCount == 0) { continue; }
+        // A worker that's fallen behind makes us wait (see HC_ENGINE_WORKER_BLOCK_MS), and whatever can't wait is
+        // the newest, so what it does get from a source is still in order
+        hc_push_buffer_batch(&worker->queue, worker->pending, worker->pendingCount, HC_BUFFER_LANE_DATA);
+        worker->pendingCount = 0;
+    }
+}
+
+void hc_engine_worker_handler(void *pvParameters) {
+    hc_engine_worker_t* worker = (hc_engine_worker_t*)pvParameters;
+    hypercast_t* hypercast = worker->hypercast;
+    hc_packet_t *packets[HC_ENGINE_WORKER_BATCH_SIZE];
+    int count;
+    // Engine timers are the engine's, so the worker keeps an eye on its own reassembly
+    uint64_t nextExpiry = hc_clock_monotonic_ms() + HC_ENGINE_FRAGMENT_EXPIRY_INTERVAL;
+    ESP_LOGI(TAG, "Worker Ready on core %d", worker->core);
+    while (1) {
+        count = hc_pop_buffer_batch_wait(&worker->queue, packets, HC_ENGINE_WORKER_BATCH_SIZE, HC_ENGINE_FRAGMENT_EXPIRY_INTERVAL);
+        for (int i = 0; i < count; i++) {
+            // The filter's only deliver-only verdict is running out of hops, which the header still says
+            bool forward = HC_SCHEMA_GET(packets[i]->data, HC_OVERLAY_HEADER, hopLimit) != 0;
+            hc_forward(packets[i], hypercast, &worker->shard, forward);
+        }
+        worker->processed += count;
+        if (hc_clock_monotonic_ms() >= nextExpiry) {
+            hc_fragment_expire(worker->shard.fragments);
+            nextExpiry = hc_clock_monotonic_ms() + HC_ENGINE_FRAGMENT_EXPIRY_INTERVAL;
+        }
+    }
+}
@@ -0,0 +1,78 @@
+/*
+* The cheap checks that decide whether a packet is worth parsing at all.
+* Nothing here allocates or copies, it's all reads at fixed offsets (see hc_filter.h)
+*/
+#include "hc_filter.h"
+#include "hc_protocols.h"
+#include "hc_overlay.h"
+
+static const char* TAG = "HC_FILTER";
+
+static const char* ruleNames[HC_FILTER_RULES] = {"length", "version", "overlay id", "trusted", "hop limit"};
+
+static int hc_filter_overlay(hypercast_t* hypercast, const hc_packet_t* packet) {
+    int headerBytes = HC_SCHEMA_BYTES(HC_OVERLAY_HEADER);
+    if (packet->size < headerBytes
+        || headerBytes + HC_SCHEMA_GET(packet->data, HC_OVERLAY_HEADER, extensionsLength) > packet->size) {
+        return HC_FILTER_RULE_LENGTH;
+    }
+    if (HC_SCHEMA_GET(packet->data, HC_OVERLAY_HEADER, version) != HC_OVERLAY_VERSION) {
+        return HC_FILTER_RULE_VERSION;
+    }
+    // Then check if this message is from a member of our ?neighbor? table
+    if (hc_overlay_sender_trusted(HC_SCHEMA_GET(packet->data, HC_OVERLAY_HEADER, sourceLogicalAddress), hypercast) == false) {
+        return HC_FILTER_RULE_TRUSTED;
+    }
+    if (HC_SCHEMA_GET(packet->data, HC_OVERLAY_HEADER, hopLimit) == 0) {
+        return HC_FILTER_RULE_HOP_LIMIT;
+    }
+    return -1;
+}
+
+static int hc_filter_protocol(hypercast_t* hypercast, const hc_packet_t* packet) {
+    // Make sure that "MessageLength" is less than or equal to the packet length, otherwise some packet was lost
+    if (packet->size < HC_SCHEMA_BYTES(HC_PROTOCOL_HEADER)
+        || HC_SCHEMA_GET(packet->data, HC_PROTOCOL_HEADER, messageLength) > packet->size) {
+        return HC_FILTER_RULE_LENGTH;
+    }
+    // It has to be for an overlay we're in (the hash is a signed int), and that overlay has to run its protocol
+    hc_protocol_shell_t* protocol = hc_protocol_find(hypercast, (int32_t)HC_SCHEMA_GET(packet->data, HC_PROTOCOL_HEADER, overlayId));
+    if (protocol == NULL) {
+        return HC_FILTER_RULE_OVERLAY_ID;
+    }
+    if (HC_SCHEMA_GET(packet->data, HC_PROTOCOL_HEADER, protocolId) != protocol->id) {
+        return HC_FILTER_RULE_VERSION;
+    }
+    return -1;
+}
+
+int hc_filter_packet(hypercast_t* hypercast, const hc_packet_t* packet) {
+    hc_filter_stats_t* stats = &hypercast->filterStats;
+    stats->checked++;
+    // The first nibble tells us which header we're looking at
+    int rule;
+    if (packet->size < 1) {
+        rule = HC_FILTER_RULE_LENGTH;
+    } else if (hc_load_bits(packet->data, 0, 4) == HC_PROTOCOL_OVERLAY_MESSAGE) {
+        rule = hc_filter_overlay(hypercast, packet);
+    } else {
+        rule = hc_filter_protocol(hypercast, packet);
+    }
+
+    if (rule < 0) {
+        stats->accepted++;
+        return HC_FILTER_ACCEPT;
+    }
+    stats->hits[rule]++;
+    // Running out of hops is the one rule that doesn't cost the packet
+    if (rule == HC_FILTER_RULE_HOP_LIMIT) {
+        stats->accepted++;
+        return HC_FILTER_DELIVER_ONLY;
+    }
+    ESP_LOGD(TAG, "Packet dropped by %s rule", ruleNames[rule]);
+    return HC_FILTER_DROP;
+}
+
+const char* hc_filter_rule_name(int rule) {
+    return (rule >= 0 && rule < HC_FILTER_RULES) ? ruleNames[rule] : "unknown";
+}
@@ -0,0 +1,192 @@
+/*
+* Splitting big application buffers over several overlay messages, and putting them back together
+* on the way in (see hc_fragment.h)
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/task.h"
+
+#include "hc_fragment.h"
+#include "hc_delivery.h"
+
+static const char* TAG = "HC_FRAGMENT";
+
+void hc_fragment_init(hc_fragment_state_t* state) {
+    memset(state, 0, sizeof(hc_fragment_state_t));
+    atomic_init(&state->nextMessageId, 0);
+}
+
+static int hc_fragment_send_one(hypercast_t* hypercast, const char* data, int length, hc_msg_ext_fragment_t* fragment) {
+    hc_msg_overlay_t* msg = hc_msg_overlay_init_with_payload(hypercast, (char*)data, length);
+    if (msg == NULL) { return -1; }
+    if (fragment != NULL) {
+        // The fragment extension goes after everything else
+        hc_msg_ext_fragment_t* ext = hc_msg_overlay_alloc(msg, sizeof(hc_msg_ext_fragment_t));
+        if (ext == NULL) {
+            hc_msg_overlay_free(msg);
+            return -1;
+        }
+        *ext = *fragment;
+        ext->type = HC_MSG_EXT_FRAGMENT_TYPE;
+        ext->order = hc_msg_overlay_ext_get_next_order(msg);
+        hc_msg_overlay_insert_extension(msg, ext);
+    }
+    if (HC_OVERLAY_NATIVE_EXTENSIONS) {
+        // Every fragment is a message of its own to the dedup cache, so each gets its own number
+        hc_msg_ext_sequence_t* sequence = hc_msg_overlay_alloc(msg, sizeof(hc_msg_ext_sequence_t));
+        if (sequence == NULL) {
+            hc_msg_overlay_free(msg);
+            return -1;
+        }
+        sequence->type = HC_MSG_EXT_SEQUENCE_TYPE;
+        sequence->order = hc_msg_overlay_ext_get_next_order(msg);
+        sequence->sequence = hc_overlay_next_sequence(hypercast);
+        hc_msg_overlay_insert_extension(msg, sequence);
+    }
+    // The slice was copied once into the message, the packet goes out straight from there
+    hc_packet_t* packet = hc_msg_overlay_encode_gather(msg);
+    if (packet == NULL) { return -1; }
+    // The buffer frees the packet if it can't take it
+    return hc_push_buffer_packet(hypercast->sendBuffer, packet) > 0 ? 1 : -1;
+}
+
+int hc_fragment_send(hypercast_t* hypercast, const char* data, int length) {
+    // Anything that fits goes out as it is, no fragment extension needed
+    if (length <= HC_OVERLAY_PAYLOAD_LIMIT) {
+        return hc_fragment_send_one(hypercast, data, length, NULL);
+    }
+    if (length > HC_FRAGMENT_MAX_MESSAGE_SIZE) {
+        ESP_LOGE(TAG, "Buffer of %d bytes is too big to send, the most is %d", length, HC_FRAGMENT_MAX_MESSAGE_SIZE);
+        return -1;
+    }
+    if (!HC_OVERLAY_NATIVE_EXTENSIONS) {
+        // Only nodes running this code know the fragment extension (see hc_overlay.h)
+        ESP_LOGE(TAG, "Buffer of %d bytes needs fragmenting, which is off until HC_OVERLAY_NATIVE_EXTENSIONS is set", length);
+        return -1;
+    }
+
+    // Every fragment but the last is full, so the receiver can work out where each one goes
+    hc_msg_ext_fragment_t fragment;
+    fragment.messageId = atomic_fetch_add_explicit(&hypercast->fragments->nextMessageId, 1, memory_order_relaxed);
+    fragment.fragmentSize = HC_OVERLAY_PAYLOAD_MAX;
+    fragment.count = (length + HC_OVERLAY_PAYLOAD_MAX - 1) / HC_OVERLAY_PAYLOAD_MAX;
+    int offset = 0;
+    for (int i = 0; i < fragment.count; i++) {
+        fragment.index = i;
+        int fragmentLength = length - offset < HC_OVERLAY_PAYLOAD_MAX ? length - offset : HC_OVERLAY_PAYLOAD_MAX;
+        if (hc_fragment_send_one(hypercast, data + offset, fragmentLength, &fragment) < 0) {
+            // Without this one the rest are no use to anybody
+            ESP_LOGE(TAG, "Failed to queue fragment %d of %d", i + 1, fragment.count);
+            return -1;
+        }
+        offset += fragmentLength;
+    }
+    return fragment.count;
+}
+
+static void hc_fragment_release(hc_fragment_reassembly_t* reassembly) {
+    free(reassembly->data);
+    reassembly->data = NULL;
+    reassembly->used = false;
+}
+
+static hc_fragment_reassembly_t* hc_fragment_find(hc_fragment_state_t* state, uint32_t source, const hc_msg_ext_fragment_t* fragment) {
+    TickType_t now = xTaskGetTickCount();
+    hc_fragment_reassembly_t* reassembly;
+    hc_fragment_reassembly_t* oldest = NULL;
+    for (int i = 0; i < HC_FRAGMENT_REASSEMBLY_SLOTS; i++) {
+        reassembly = &state->reassembly[i];
+        if (reassembly->used && reassembly->source == source && reassembly->messageId == fragment->messageId) {
+            return reassembly;
+        }
+        // Keep track of where a new one would go, an empty slot or else the one that's been waiting longest
+        if (oldest == NULL || (oldest->used && !reassembly->used)) {
+            oldest = reassembly;
+        } else if (oldest->used && (TickType_t)(now - reassembly->started) > (TickType_t)(now - oldest->started)) {
+            oldest = reassembly;
+        }
+    }
+
+    // We haven't seen this buffer before, so it takes a slot
+    if (oldest->used) {
+        ESP_LOGD(TAG, "Reassembly slots full, dropping buffer %d from %u", oldest->messageId, oldest->source);
+        hc_fragment_release(oldest);
+        state->dropped++;
+    }
+    // Room for every fragment at full size, which is at most one fragment over the biggest buffer
+    oldest->data = malloc(fragment->count * fragment->fragmentSize);
+    if (oldest->data == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate reassembly buffer");
+        return NULL;
+    }
+    oldest->used = true;
+    oldest->source = source;
+    oldest->messageId = fragment->messageId;
+    oldest->count = fragment->count;
+    oldest->fragmentSize = fragment->fragmentSize;
+    oldest->received = 0;
+    oldest->length = -1;
+    oldest->started = now;
+    return oldest;
+}
+
+int hc_fragment_receive(hypercast_t* hypercast, hc_fragment_state_t* state, uint32_t source, const hc_msg_ext_fragment_t* fragment, const char* payload, int length) {
+    // Check the fragment makes sense before we spend any memory on it. The reassembly buffer is count * fragmentSize,
+    // so both are held to what a sender could really have used, not just to what the payload we got happens to be
+    bool last = fragment->index == fragment->count - 1;
+    if (fragment->count == 0 || fragment->count > HC_FRAGMENT_MAX_FRAGMENTS || fragment->index >= fragment->count
+        || fragment->fragmentSize == 0 || fragment->fragmentSize > HC_OVERLAY_PAYLOAD_MAX
+        || fragment->count * fragment->fragmentSize > HC_FRAGMENT_MAX_MESSAGE_SIZE + fragment->fragmentSize
+        || (fragment->count - 1) * fragment->fragmentSize >= HC_FRAGMENT_MAX_MESSAGE_SIZE
+        || length > fragment->fragmentSize || (!last && length != fragment->fragmentSize)) {
+        ESP_LOGE(TAG, "Bad fragment %d of %d (%d bytes) from %u", fragment->index, fragment->count, length, source);
+        state->dropped++;
+        return HC_FRAGMENT_DROPPED;
+    }
+
+    hc_fragment_reassembly_t* reassembly = hc_fragment_find(state, source, fragment);
+    if (reassembly == NULL) {
+        state->dropped++;
+        return HC_FRAGMENT_DROPPED;
+    }
+    if (reassembly->count != fragment->count || reassembly->fragmentSize != fragment->fragmentSize) {
+        ESP_LOGE(TAG, "Fragment doesn't match the rest of buffer %d from %u", fragment->messageId, source);
+        state->dropped++;
+        return HC_FRAGMENT_DROPPED;
+    }
+
+    // Drop it into place, a repeat just writes the same bytes again
+    memcpy(reassembly->data + fragment->index * fragment->fragmentSize, payload, length);
+    reassembly->received |= (uint64_t)1 << fragment->index;
+    if (last) {
+        reassembly->length = fragment->index * fragment->fragmentSize + length;
+    }
+
+    uint64_t everything = fragment->count == HC_FRAGMENT_MAX_FRAGMENTS ? UINT64_MAX : ((uint64_t)1 << fragment->count) - 1;
+    if (reassembly->received != everything) {
+        return HC_FRAGMENT_INCOMPLETE;
+    }
+    // All here, hand it up then let the slot go
+    if (hypercast->delivery != NULL) {
+        // The application task takes the buffer over, and frees it once it's delivered
+        hc_delivery_push_buffer(hypercast, reassembly->data, reassembly->length);
+        reassembly->data = NULL;
+    } else {
+        hypercast->callback(reassembly->data, reassembly->length);
+    }
+    hc_fragment_release(reassembly);
+    state->completed++;
+    return HC_FRAGMENT_COMPLETE;
+}
+
+void hc_fragment_expire(hc_fragment_state_t* state) {
+    TickType_t now = xTaskGetTickCount();
+    for (int i = 0; i < HC_FRAGMENT_REASSEMBLY_SLOTS; i++) {
+        hc_fragment_reassembly_t* reassembly = &state->reassembly[i];
+        if (reassembly->used && (TickType_t)(now - reassembly->started) >= pdMS_TO_TICKS(HC_FRAGMENT_REASSEMBLY_TIMEOUT_MS)) {
+            ESP_LOGD(TAG, "Buffer %d from %u timed out", reassembly->messageId, reassembly->source);
+            hc_fragment_release(reassembly);
+            state->timedOut++;
+        }
+    }
+}
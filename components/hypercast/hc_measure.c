@@ -4,8 +4,12 @@
 
 #include "hc_measure.h"
 #include "hc_buffer.h"
-#include "hc_lib.h"
-#include "spt.h"
+#include "hc_clock.h"
+#include "hc_fragment.h"
+#include "hc_aggregate.h"
+#include "hc_delivery.h"
+#include "hc_protocols.h"
+#include "hc_engine.h"
 
 static const char* TAG = "HC_MEASURE";
 
@@ -36,6 +40,51 @@ void log_nodestate(hypercast_t* hypercast) {
 
     ESP_LOGI(TAG, "Free Heap: %d / %d", freeHeapSize, MAX_MEMORY_AVAILABLE);
 
+    hc_packet_pool_stats_t poolStats;
+    hc_packet_pool_get_stats(&poolStats);
+    ESP_LOGI(TAG, "Packet Pool: %d / %d in use (peak %d), %u exhausted of %u acquires",
+             poolStats.inUse, poolStats.slots, poolStats.peakInUse, poolStats.exhausted, poolStats.acquired);
+    hc_buffer_lane_stats_t laneStats;
+    const char* laneNames[HC_BUFFER_LANES] = {"control", "data"};
+    for (int lane = 0; lane < HC_BUFFER_LANES; lane++) {
+        hc_buffer_get_lane_stats(hypercast->receiveBuffer, lane, &laneStats);
+        ESP_LOGI(TAG, "Receive %s lane: %d / %d (peak %d), %u enqueued, %u dropped",
+                 laneNames[lane], laneStats.depth, laneStats.capacity, laneStats.peakDepth, laneStats.enqueued, laneStats.dropped);
+        hc_buffer_get_lane_stats(hypercast->sendBuffer, lane, &laneStats);
+        ESP_LOGI(TAG, "Send %s lane: %d / %d (peak %d), %u enqueued, %u dropped",
+                 laneNames[lane], laneStats.depth, laneStats.capacity, laneStats.peakDepth, laneStats.enqueued, laneStats.dropped);
+    }
+
+    ESP_LOGI(TAG, "Ingress filter: %u accepted of %u checked", hypercast->filterStats.accepted, hypercast->filterStats.checked);
+    for (int rule = 0; rule < HC_FILTER_RULES; rule++) {
+        ESP_LOGI(TAG, "Ingress filter %s rule: %u hits", hc_filter_rule_name(rule), hypercast->filterStats.hits[rule]);
+    }
+    ESP_LOGI(TAG, "Forwarded: %u (%u with a truncated route record), %u failed", hypercast->forwardStats.forwarded,
+             hypercast->forwardStats.truncated, hypercast->forwardStats.failed);
+    ESP_LOGI(TAG, "Fragmented buffers: %u reassembled, %u timed out, %u dropped",
+             hypercast->fragments->completed, hypercast->fragments->timedOut, hypercast->fragments->dropped);
+    ESP_LOGI(TAG, "Aggregated payloads: %u in %u messages (%u sent full, %u on deadline)",
+             hypercast->aggregator->payloadsSent, hypercast->aggregator->messages,
+             hypercast->aggregator->flushedFull, hypercast->aggregator->flushedDeadline);
+    if (hypercast->delivery != NULL) {
+        hc_buffer_get_lane_stats(&hypercast->delivery->buffer, HC_BUFFER_LANE_DATA, &laneStats);
+        ESP_LOGI(TAG, "Delivery queue: %d / %d (peak %d), %u payloads delivered, %u dropped, %u failed",
+                 laneStats.depth, laneStats.capacity, laneStats.peakDepth, hypercast->delivery->delivered,
+                 laneStats.dropped, hypercast->delivery->failed);
+    }
+    ESP_LOGI(TAG, "Duplicate overlay messages dropped: %u (%u early evictions)",
+             hypercast->dedupCache->duplicates, hypercast->dedupCache->evictions);
+    if (hypercast->workers != NULL) {
+        // Each worker remembers its own sources, so its duplicates and reassembly are its own too
+        for (int i = 0; i < hypercast->workers->count; i++) {
+            hc_engine_worker_t* worker = &hypercast->workers->workers[i];
+            hc_buffer_get_lane_stats(&worker->queue, HC_BUFFER_LANE_DATA, &laneStats);
+            ESP_LOGI(TAG, "Worker %d on core %d: %u messages, queue %d / %d (peak %d) %u dropped, %u duplicates, %u reassembled",
+                     i, worker->core, worker->processed, laneStats.depth, laneStats.capacity, laneStats.peakDepth, laneStats.dropped,
+                     worker->shard.dedupCache->duplicates, worker->shard.fragments->completed);
+        }
+    }
+
     // Setup config
     esp_http_client_config_t config = {
         .host = "192.168.122.100",
@@ -51,83 +100,25 @@ void log_nodestate(hypercast_t* hypercast) {
 
     // Now do the post request
     char data[HC_BUFFER_DATA_MAX]; // Temporary buffer of max size to shove data into
-    int dataSize = 0;
-    int i;
+    hc_writer_t writer;
+    hc_writer_init(&writer, data, HC_BUFFER_DATA_MAX);
+    hc_protocol_shell_t* protocol = hypercast->protocols[0];
 
     // Build the request data
     // We'll meassure:
     // 0. Node Type (C or Java)
-    write_bytes(data, 1, 4, 0, HC_BUFFER_DATA_MAX);
+    hc_write_bits(&writer, 1, 4);
     // 1. Node protocol id
-    write_bytes(data, ((hc_protocol_shell_t *)hypercast->protocol)->id, 4, 4, HC_BUFFER_DATA_MAX);
+    hc_write_bits(&writer, protocol->id, 4);
     // 2. Timestamp
-    write_bytes(data, get_epoch(), 32, 8, HC_BUFFER_DATA_MAX);
+    hc_write_bits(&writer, hc_clock_network_ms() / 1000, 32);
 
-    dataSize = 5; // 40 bits is 5 bytes
-    
-    // Now assume we're using SPT (need to improve if we use other protocols)
-    protocol_spt* spt = (protocol_spt *)hypercast->protocol;
-    // 3. Node neighbor table
-    // First we write the number of entries
-    write_bytes(data, spt->neighborhoodTable->size, 8, 40, HC_BUFFER_DATA_MAX);
-    dataSize += 1;
-    // Then start writing entries
-    for (i=0;i<spt->neighborhoodTable->size;i++) {
-        // Write the entry
-        write_bytes(data, spt->neighborhoodTable->entries[i]->neighborId, 16, dataSize*8, HC_BUFFER_DATA_MAX);
-        write_bytes(data, spt->neighborhoodTable->entries[i]->physicalAddress, 32, dataSize*8 + 16, HC_BUFFER_DATA_MAX);
-        write_bytes(data, spt->neighborhoodTable->entries[i]->rootId, 16, dataSize*8 + 48, HC_BUFFER_DATA_MAX);
-        write_bytes(data, spt->neighborhoodTable->entries[i]->cost, 32, dataSize*8 + 64, HC_BUFFER_DATA_MAX);
-        write_bytes(data, spt->neighborhoodTable->entries[i]->pathMetric, 32, dataSize*8 + 96, HC_BUFFER_DATA_MAX);
-        write_bytes(data, spt->neighborhoodTable->entries[i]->timestamp/1000, 32, dataSize*8 + 128, HC_BUFFER_DATA_MAX);
-        write_bytes(data, spt->neighborhoodTable->entries[i]->isAncestor, 8, dataSize*8 +160, HC_BUFFER_DATA_MAX);
-        // Update the dataSize
-        dataSize += 2+4+2+4+4+8+1;
-    }
-    // 4. Node adjacency table
-    // First we write the number of entries
-    write_bytes(data, spt->adjacencyTable->size, 8, dataSize*8, HC_BUFFER_DATA_MAX);
-    dataSize += 1;
-    // Then start writing entries
-    for (i=0;i<spt->adjacencyTable->size;i++) {
-        // Write the entry
-        // uint32_t id;
-        write_bytes(data, spt->adjacencyTable->entries[i]->id, 32, dataSize*8, HC_BUFFER_DATA_MAX);
-        // uint8_t quality;
-        write_bytes(data, spt->adjacencyTable->entries[i]->quality, 8, dataSize*8 + 32, HC_BUFFER_DATA_MAX);
-        // uint64_t timestamp;
-        write_bytes(data, spt->adjacencyTable->entries[i]->timestamp/1000, 32, dataSize*8 + 40, HC_BUFFER_DATA_MAX);
-        // Update the dataSize
-        dataSize += 4+1+4;
-    }
-    // 5. Node treeInfoTable
-    // This one doesn't need size because the props only exist once
-    // uint16_t id;
-    write_bytes(data, spt->treeInfoTable->id, 16, dataSize*8, HC_BUFFER_DATA_MAX);
-    dataSize += 2;
-    // uint32_t physicalAddress;
-    write_bytes(data, spt->treeInfoTable->physicalAddress, 32, dataSize*8, HC_BUFFER_DATA_MAX);
-    dataSize += 4;
-    // uint16_t rootId;
-    write_bytes(data, spt->treeInfoTable->rootId, 16, dataSize*8, HC_BUFFER_DATA_MAX);
-    dataSize += 2;
-    // uint32_t ancestorId;
-    write_bytes(data, spt->treeInfoTable->ancestorId, 32, dataSize*8, HC_BUFFER_DATA_MAX);
-    dataSize += 4;
-    // uint32_t cost;
-    write_bytes(data, spt->treeInfoTable->cost, 32, dataSize*8, HC_BUFFER_DATA_MAX);
-    dataSize += 4;
-    // uint32_t pathMetric;
-    write_bytes(data, spt->treeInfoTable->pathMetric, 32, dataSize*8, HC_BUFFER_DATA_MAX);
-    dataSize += 4;
-    // uint32_t sequenceNumber;
-    write_bytes(data, spt->treeInfoTable->sequenceNumber, 32, dataSize*8, HC_BUFFER_DATA_MAX);
-    dataSize += 4;
+    // 3-5. Whatever the protocol keeps, it knows how to write its own tables
+    protocol->ops->stats(protocol, &writer);
     // 6. RAM usage
-    write_bytes(data, freeHeapSize, 32, dataSize*8, HC_BUFFER_DATA_MAX);
-    dataSize += 4;
-    write_bytes(data, MAX_MEMORY_AVAILABLE, 32, dataSize*8, HC_BUFFER_DATA_MAX);
-    dataSize += 4;
+    hc_write_bits(&writer, freeHeapSize, 32);
+    hc_write_bits(&writer, MAX_MEMORY_AVAILABLE, 32);
+    int dataSize = hc_writer_length(&writer);
 
     ESP_LOGI(TAG, "Measure written to bytestream");
 
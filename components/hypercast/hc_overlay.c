@@ -6,7 +6,162 @@
 
 static const char* TAG = "HC_OVERLAY";
 
-hc_msg_overlay_t* hc_msg_overlay_parse(hc_packet_t* packet) {
+// Header routines generated from the schemas in hc_overlay.h
+HC_SCHEMA_DEFINE_LOAD(hc_overlay_header_load, hc_msg_overlay_t, HC_OVERLAY_HEADER, HC_OVERLAY_HEADER_SCHEMA)
+HC_SCHEMA_DEFINE_STORE(hc_overlay_header_store, hc_msg_overlay_t, HC_OVERLAY_HEADER, HC_OVERLAY_HEADER_SCHEMA)
+HC_SCHEMA_DEFINE_STORE(hc_overlay_ext_header_store, void, HC_OVERLAY_EXT_HEADER, HC_OVERLAY_EXT_HEADER_SCHEMA)
+HC_SCHEMA_DEFINE_LOAD(hc_overlay_fragment_load, hc_msg_ext_fragment_t, HC_OVERLAY_FRAGMENT, HC_OVERLAY_FRAGMENT_SCHEMA)
+HC_SCHEMA_DEFINE_STORE(hc_overlay_fragment_store, hc_msg_ext_fragment_t, HC_OVERLAY_FRAGMENT, HC_OVERLAY_FRAGMENT_SCHEMA)
+HC_SCHEMA_DEFINE_LOAD(hc_overlay_sequence_load, hc_msg_ext_sequence_t, HC_OVERLAY_SEQUENCE, HC_OVERLAY_SEQUENCE_SCHEMA)
+HC_SCHEMA_DEFINE_STORE(hc_overlay_sequence_store, hc_msg_ext_sequence_t, HC_OVERLAY_SEQUENCE, HC_OVERLAY_SEQUENCE_SCHEMA)
+
+void* hc_msg_overlay_alloc(hc_msg_overlay_t* msg, int bytes) {
+    // Plain bump allocation, nothing is freed until the whole message goes
+    int aligned = (bytes + 7) & ~7;
+    if (aligned > msg->arenaEnd - msg->arenaNext) {
+        ESP_LOGE(TAG, "Overlay message arena full, can't fit %d bytes", bytes);
+        return NULL;
+    }
+    void* allocation = msg->arenaNext;
+    msg->arenaNext += aligned;
+    return allocation;
+}
+
+static hc_msg_overlay_t* hc_msg_overlay_create(int arenaBytes) {
+    // The message and its arena are one allocation, so one free releases everything
+    hc_msg_overlay_t* msg = malloc(sizeof(hc_msg_overlay_t) + arenaBytes);
+    if (msg == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate overlay message");
+        return NULL;
+    }
+    msg->extensionCount = 0;
+    // Messages we build have nothing to decode
+    msg->packet = NULL;
+    msg->arenaNext = (char*)(msg + 1);
+    msg->arenaEnd = msg->arenaNext + arenaBytes;
+    return msg;
+}
+
+static hc_msg_ext_route_record_t* hc_msg_overlay_new_route_record(hc_msg_overlay_t* msg, int order, int capacity) {
+    hc_msg_ext_route_record_t* routeRecord = hc_msg_overlay_alloc(msg, sizeof(hc_msg_ext_route_record_t));
+    if (routeRecord == NULL) { return NULL; }
+    routeRecord->type = HC_MSG_EXT_ROUTE_RECORD_TYPE;
+    routeRecord->order = order;
+    routeRecord->routeRecordSize = 0;
+    routeRecord->routeRecordCapacity = capacity;
+    routeRecord->routeRecordLogicalAddressList = hc_msg_overlay_alloc(msg, sizeof(uint32_t) * capacity);
+    if (routeRecord->routeRecordLogicalAddressList == NULL) { return NULL; }
+    return routeRecord;
+}
+
+static uint32_t hc_overlay_bloom_mix(uint32_t h) {
+    // Murmur3's finalizer, logical addresses are small numbers so they need spreading out
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static void hc_overlay_bloom_add(uint8_t* bits, uint32_t logicalAddress) {
+    // The bits come from two hashes combined (double hashing), every node has to agree on this
+    uint32_t h1 = hc_overlay_bloom_mix(logicalAddress);
+    uint32_t h2 = hc_overlay_bloom_mix(h1) | 1;
+    for (int i = 0; i < HC_OVERLAY_ROUTE_BLOOM_HASHES; i++) {
+        uint32_t bit = (h1 + i * h2) % (HC_OVERLAY_ROUTE_BLOOM_BYTES * 8);
+        bits[bit / 8] |= 1 << (bit % 8);
+    }
+}
+
+static int hc_overlay_bloom_contains(const uint8_t* bits, uint32_t logicalAddress) {
+    uint32_t h1 = hc_overlay_bloom_mix(logicalAddress);
+    uint32_t h2 = hc_overlay_bloom_mix(h1) | 1;
+    for (int i = 0; i < HC_OVERLAY_ROUTE_BLOOM_HASHES; i++) {
+        uint32_t bit = (h1 + i * h2) % (HC_OVERLAY_ROUTE_BLOOM_BYTES * 8);
+        if ((bits[bit / 8] & (1 << (bit % 8))) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static hc_msg_ext_t* hc_msg_overlay_decode_extension(hc_msg_overlay_t* msg, const hc_msg_ext_slot_t* slot) {
+    const char* data = msg->packet->data + slot->offset;
+    // Let's build the extension
+    switch (slot->type) {
+        case HC_MSG_EXT_PAYLOAD_TYPE: {
+            // This type just includes the standard, plus a string payload
+            hc_msg_ext_payload_t* payload = hc_msg_overlay_alloc(msg, sizeof(hc_msg_ext_payload_t));
+            if (payload == NULL) { return NULL; }
+            payload->type = slot->type;
+            payload->order = slot->order;
+            // Now we sort out the payload
+            payload->length = slot->length;
+            payload->payload = hc_msg_overlay_alloc(msg, slot->length);
+            if (payload->payload == NULL) { return NULL; }
+            // We've done prep, time to copy the payload over
+            memcpy(payload->payload, data, slot->length);
+            return (hc_msg_ext_t*)payload;
+        }
+        case HC_MSG_EXT_ROUTE_RECORD_TYPE: {
+            // This type includes the standard plus a route record and logical address
+            // Note that the size of the route record is /4 because each entry is 4 bytes
+            // We leave a little room so appending ourselves doesn't have to move it
+            int routeRecordSize = slot->length / 4;
+            hc_msg_ext_route_record_t* routeRecord = hc_msg_overlay_new_route_record(msg, slot->order, routeRecordSize + HC_OVERLAY_ROUTE_RECORD_SPARE);
+            if (routeRecord == NULL) { return NULL; }
+            routeRecord->routeRecordSize = routeRecordSize;
+            // Now read each entry (32 long)
+            for (int i=0; i<routeRecordSize; i++) {
+                routeRecord->routeRecordLogicalAddressList[i] = hc_load_bits(data, i * 32, 32);
+            }
+            return (hc_msg_ext_t*)routeRecord;
+        }
+        case HC_MSG_EXT_ROUTE_BLOOM_TYPE: {
+            // Fixed size, it's just the filter bits
+            if (slot->length != HC_OVERLAY_ROUTE_BLOOM_BYTES) {
+                ESP_LOGE(TAG, "Route Bloom filter is %d bytes, expected %d", slot->length, HC_OVERLAY_ROUTE_BLOOM_BYTES);
+                return NULL;
+            }
+            hc_msg_ext_route_bloom_t* routeBloom = hc_msg_overlay_alloc(msg, sizeof(hc_msg_ext_route_bloom_t));
+            if (routeBloom == NULL) { return NULL; }
+            routeBloom->type = slot->type;
+            routeBloom->order = slot->order;
+            memcpy(routeBloom->bits, data, HC_OVERLAY_ROUTE_BLOOM_BYTES);
+            return (hc_msg_ext_t*)routeBloom;
+        }
+        case HC_MSG_EXT_FRAGMENT_TYPE: {
+            if (slot->length < HC_SCHEMA_BYTES(HC_OVERLAY_FRAGMENT)) {
+                ESP_LOGE(TAG, "Fragment extension too short");
+                return NULL;
+            }
+            hc_msg_ext_fragment_t* fragment = hc_msg_overlay_alloc(msg, sizeof(hc_msg_ext_fragment_t));
+            if (fragment == NULL) { return NULL; }
+            fragment->type = slot->type;
+            fragment->order = slot->order;
+            hc_overlay_fragment_load(data, fragment);
+            return (hc_msg_ext_t*)fragment;
+        }
+        case HC_MSG_EXT_SEQUENCE_TYPE: {
+            if (slot->length < HC_SCHEMA_BYTES(HC_OVERLAY_SEQUENCE)) {
+                ESP_LOGE(TAG, "Sequence extension too short");
+                return NULL;
+            }
+            hc_msg_ext_sequence_t* sequence = hc_msg_overlay_alloc(msg, sizeof(hc_msg_ext_sequence_t));
+            if (sequence == NULL) { return NULL; }
+            sequence->type = slot->type;
+            sequence->order = slot->order;
+            hc_overlay_sequence_load(data, sequence);
+            return (hc_msg_ext_t*)sequence;
+        }
+        default:
+            ESP_LOGE(TAG, "Unknown extension type: %d", slot->type);
+            return NULL;
+    }
+}
+
+hc_msg_overlay_t* hc_msg_overlay_parse_lazy(const hc_packet_t* packet) {
     // Before beginning to parse, check that the packet meets minimum length requirement
     if (packet->size < HC_MSG_OVERLAY_MIN_LENGTH/8) {
         ESP_LOGE(TAG, "Packet too small to be an overlay message");
@@ -14,406 +169,448 @@ hc_msg_overlay_t* hc_msg_overlay_parse(hc_packet_t* packet) {
     }
 
     // Start by initializing the overlay message
-    hc_msg_overlay_t* msg = hc_msg_overlay_init();
+    // Nothing decoded from the packet can be bigger than the packet, so that plus the structs and room for
+    // the route record to grow once (then compact) is all the arena needs
+    hc_msg_overlay_t* msg = hc_msg_overlay_create(packet->size + HC_OVERLAY_MAX_EXTENSIONS * HC_OVERLAY_ARENA_EXTENSION_OVERHEAD
+                                                  + HC_OVERLAY_ROUTE_RECORD_LIMIT * sizeof(uint32_t) + sizeof(hc_msg_ext_route_bloom_t));
+    if (msg == NULL) { return NULL; }
+    msg->packet = packet;
 
     // Let's do the parse now
-    msg->version = packet_to_int(packet_snip_to_bytes(packet, 4, 8));
-    msg->dataMode = packet_to_int(packet_snip_to_bytes(packet, 4, 12));
-    msg->hopLimit = packet_to_int(packet_snip_to_bytes(packet, 16, 56));
-    msg->sourceLogicalAddress = packet_to_int(packet_snip_to_bytes(packet, 32, 88));
-    msg->previousHopLogicalAddress = packet_to_int(packet_snip_to_bytes(packet, 32, 120));
-
-    // Then finish with parses of extensions
-    int extensionStartIndex = 152;
-    int extensionType = packet_to_int(packet_snip_to_bytes(packet, 8, 72));
-    int extensionOrder = 1;
-    int extensionLength = 0;
-    int extendResult = 1;
-    void* ext;
-
-    while (extensionType != 0 && extendResult > 0) {
-        // Let's build the extension
-        switch (extensionType) {
-            case HC_MSG_EXT_PAYLOAD_TYPE:
-                // This type just includes the standard, plus a string payload
-                ext = malloc(sizeof(hc_msg_ext_payload_t));
-                ((hc_msg_ext_payload_t*)ext)->type = extensionType;
-                ((hc_msg_ext_payload_t*)ext)->order = extensionOrder;
-                // Now we sort out the payload
-                ((hc_msg_ext_payload_t*)ext)->length = packet_to_int(packet_snip_to_bytes(packet, 8, extensionStartIndex + 16));
-                ((hc_msg_ext_payload_t*)ext)->payload = malloc(sizeof(char) * ((hc_msg_ext_payload_t*)ext)->length);
-                // We've done prep, time to extract and copy the payload over
-                hc_packet_t* payloadPacket = packet_snip_to_bytes(packet, 8*((hc_msg_ext_payload_t*)ext)->length, extensionStartIndex + 24);
-                if (payloadPacket == NULL) {
-                    ESP_LOGE(TAG, "Failed to extract payload from extension");
-                    return NULL;
-                }
-                memcpy(((hc_msg_ext_payload_t*)ext)->payload, payloadPacket->data, payloadPacket->size);
-                // Then cleanup
-                free_packet(payloadPacket);
-                // Now we need to track extensionLength so the next one starts in the right place
-                extensionLength = ((hc_msg_ext_payload_t*)ext)->length*8 + 8; // +8 for the length of the payload
-                break;
-            case HC_MSG_EXT_ROUTE_RECORD_TYPE:
-                // This type includes the standard plus a route record and logical address
-                ext = malloc(sizeof(hc_msg_ext_route_record_t));
-                ((hc_msg_ext_route_record_t*)ext)->type = extensionType;
-                ((hc_msg_ext_route_record_t*)ext)->order = extensionOrder;
-                // Now get the size of the route record and each entry
-                // Note that the size of the route record is /4 because each entry is 4 bytes
-                ((hc_msg_ext_route_record_t*)ext)->routeRecordSize = packet_to_int(packet_snip_to_bytes(packet, 8, extensionStartIndex + 16)) / 4;
-                // We'll also allocate a routeRecordAddressList of MAX size
-                ((hc_msg_ext_route_record_t*)ext)->routeRecordLogicalAddressList = malloc(sizeof(uint32_t) * HC_OVERLAY_MAX_ROUTE_RECORD_LENGTH);
-                // Now iterate from extensionStartIndex + 24 to get each entry (32 long)
-                for (int i=0; i<((hc_msg_ext_route_record_t*)ext)->routeRecordSize; i++) {
-                    ((hc_msg_ext_route_record_t*)ext)->routeRecordLogicalAddressList[i] = packet_to_int(packet_snip_to_bytes(packet, 32, extensionStartIndex + 24 + (i*32)));
-                }
-                break;
-            default:
-                ESP_LOGE(TAG, "Unknown extension type: %d", extensionType);
-                extendResult = -1;
-                break;
+    hc_reader_t reader;
+    hc_reader_init(&reader, packet);
+    const char* header = hc_read_view(&reader, HC_SCHEMA_BYTES(HC_OVERLAY_HEADER));
+    hc_overlay_header_load(header, msg);
+    int extensionType = HC_SCHEMA_GET(header, HC_OVERLAY_HEADER, firstExtensionType);
+
+    // Then walk the extensions (the reader is now right after the header), only their headers are read
+    const char* extensionHeader;
+    hc_msg_ext_slot_t* slot;
+    while (extensionType != 0 && !reader.error) {
+        if (msg->extensionCount >= HC_OVERLAY_MAX_EXTENSIONS) {
+            ESP_LOGE(TAG, "Too many extensions in Overlay Message, ignoring the rest");
+            break;
         }
+        // Every extension starts with the next one's type, then the size of its length field and the length
+        extensionHeader = hc_read_view(&reader, HC_OVERLAY_EXT_HEADER_length / 8);
+        if (extensionHeader == NULL) { break; }
+        int lengthSize = HC_SCHEMA_GET(extensionHeader, HC_OVERLAY_EXT_HEADER, lengthSize);
+        if (lengthSize < 1 || lengthSize > HC_OVERLAY_EXT_LENGTH_SIZE_MAX) {
+            ESP_LOGE(TAG, "Unsupported extension length size: %d", lengthSize);
+            reader.error = 1;
+            break;
+        }
+        slot = &msg->extensions[msg->extensionCount];
+        slot->type = extensionType;
+        slot->order = msg->extensionCount + 1;
+        slot->length = hc_read_bits(&reader, lengthSize * 8); // In bytes
+        slot->offset = reader.bitOffset / 8;
+        slot->ext = NULL;
+        msg->extensionCount++;
+        // Skipping the data is also what checks it's all there
+        hc_reader_skip(&reader, slot->length * 8);
+        extensionType = HC_SCHEMA_GET(extensionHeader, HC_OVERLAY_EXT_HEADER, nextType);
+    }
 
-        // Check if extension interpretation failed
-        if (extendResult < 0) { break; }
-        
-
-        // Then we'll extend the msg
-        extendResult = hc_msg_overlay_insert_extension(msg, ext);
-
-        // And finish by getting the next extension type!
-        extensionType = packet_to_int(packet_snip_to_bytes(packet, 8, extensionStartIndex));
-        // Then increment iterators :)
-        extensionOrder++;
-        extensionStartIndex += 16 + extensionLength;
+    // If anything ran off the end of the packet, the message can't be trusted
+    if (reader.error) {
+        ESP_LOGE(TAG, "Overlay message truncated");
+        hc_msg_overlay_free(msg);
+        return NULL;
     }
 
     return msg;
 }
 
-hc_packet_t* hc_msg_overlay_encode(hc_msg_overlay_t* msg) {
-    // Start by initializing a place to build the packet
-    char data[HC_BUFFER_DATA_MAX]; // Temporary buffer of max size to shove data into
-    int dataSize = 0;
-    // Then let's start by encoding the version
-    write_bytes(data, HC_PROTOCOL_OVERLAY_MESSAGE, 4, 0, HC_BUFFER_DATA_MAX);
-    write_bytes(data, 0, 4, 4, HC_BUFFER_DATA_MAX);
-    write_bytes(data, msg->version, 4, 8, HC_BUFFER_DATA_MAX);
-    write_bytes(data, msg->dataMode, 4, 12, HC_BUFFER_DATA_MAX);
-    // Now we insert 0 from 16 to 40 (3 bytes). No idea why tho
-    write_bytes(data, 0, 24, 16, HC_BUFFER_DATA_MAX);
-    // Here we leave a space from 40 to 56 for a count of the extensions' bytes put together
-    write_bytes(data, msg->hopLimit, 16, 56, HC_BUFFER_DATA_MAX);
-    // Then we leave a space from 72 to 80 for the first extension's type
-    write_bytes(data, 4, 8, 80, HC_BUFFER_DATA_MAX); // This is the length of logical addresses in bytes (hardcoded to 4)
-    write_bytes(data, msg->sourceLogicalAddress, 32, 88, HC_BUFFER_DATA_MAX);
-    ESP_LOGI(TAG, "Source previous hop address: %d", msg->previousHopLogicalAddress);
-    write_bytes(data, msg->previousHopLogicalAddress, 32, 120, HC_BUFFER_DATA_MAX);
-    
-    int extensionStartIndex = 152;
-
-    // Now we start writing the extensions out
-    // First we're doing extension discovery
-    int extensionsFound = 0;
-    int i;
-    bool extensionFoundOnIter;
-    void** extensionsOrdered = malloc(sizeof(void*)*HC_OVERLAY_MAX_EXTENSIONS);
-    // Before we load extensions in, set null on all
-    for (i = 0; i < HC_OVERLAY_MAX_EXTENSIONS; i++) {
-        extensionsOrdered[i] = NULL;
-    }
-
-    while (1) { // Just iterate until the break condition
-        // Find extension in msg->extensions with order = extensionsFound + 1
-        extensionFoundOnIter = false;
-        for (i=0;i<HC_OVERLAY_MAX_EXTENSIONS;i++) {
-            if (msg->extensions[i] != NULL && ((hc_msg_ext_t*)msg->extensions[i])->order == extensionsFound + 1) {
-                extensionsOrdered[extensionsFound] = msg->extensions[i];
-                extensionsFound++;
-                extensionFoundOnIter = true;
-                break;
-            }
+static int hc_msg_overlay_decode_slot(hc_msg_overlay_t* msg, hc_msg_ext_slot_t* slot) {
+    if (slot->ext != NULL) { return 1; }
+    if (msg->packet == NULL) { return -1; }
+    slot->ext = hc_msg_overlay_decode_extension(msg, slot);
+    // Check if extension interpretation failed
+    return slot->ext == NULL ? -1 : 1;
+}
+
+static void hc_msg_overlay_decode_all(hc_msg_overlay_t* msg) {
+    // Decode whatever is left in order, after this the message no longer needs the packet
+    if (msg->packet == NULL) { return; }
+    for (int i = 0; i < msg->extensionCount; i++) {
+        if (hc_msg_overlay_decode_slot(msg, &msg->extensions[i]) < 0) {
+            // Whatever we couldn't decode is dropped from the message from here on
+            msg->extensionCount = i;
+            break;
         }
-        if (!extensionFoundOnIter) { break; }
     }
+    msg->packet = NULL;
+}
 
-    // Track data size before extensions
-    dataSize = extensionStartIndex;
+hc_msg_overlay_t* hc_msg_overlay_parse(hc_packet_t* packet) {
+    // The full parse is the lazy one with everything decoded up front, so the packet can go away after
+    hc_msg_overlay_t* msg = hc_msg_overlay_parse_lazy(packet);
+    if (msg == NULL) { return NULL; }
+    hc_msg_overlay_decode_all(msg);
+    return msg;
+}
 
-    int extensionsLength = 0;
-    int thisExtensionLength;
+static hc_packet_t* hc_msg_overlay_encode_packet(hc_msg_overlay_t* msg, bool gather) {
+    // Encoding works off the decoded extensions, so a lazy message needs the rest of its extensions first
+    hc_msg_overlay_decode_all(msg);
+    // Start by grabbing a pool slot to build the packet in, so it can go straight to a buffer
+    hc_packet_t *packet = hc_packet_acquire();
+    if (packet == NULL) {
+        ESP_LOGE(TAG, "Packet pool exhausted, can't encode overlay message");
+        return NULL;
+    }
+    hc_writer_t writer;
+    hc_writer_init(&writer, packet->data, HC_BUFFER_DATA_MAX);
+    // The header is fixed size, so it goes in with one store per field.
+    // The extensions length and first extension type are slots we fill once the extensions are written
+    char* header = hc_write_view(&writer, HC_SCHEMA_BYTES(HC_OVERLAY_HEADER));
+    hc_overlay_header_store(header, msg);
+    ESP_LOGD(TAG, "Source previous hop address: %d", msg->previousHopLogicalAddress);
+
+    int extensionStartIndex = writer.bitOffset;
+    // When gathering, the slot only gets what we encode and payloads are segments pointing back at the message
+    int segmentStart = 0; // Where the slot bytes not yet in a segment start
+    int gatheredBytes = 0;
+
+    // The extension table is already in message order, so we just encode straight through it
     int nextExtensionType;
-
-    // Now we have the extensions in order! Let's encode them
+    int extensionLength;
+    int lengthSize;
+    char* extensionHeader;
     hc_msg_ext_t* ext;
-    hc_msg_ext_t* next;
-    for (i=0;i<extensionsFound;i++) {
+    for (int i=0;i<msg->extensionCount;i++) {
         // Before encoding, setup data for the encode
-        ext = (hc_msg_ext_t*)extensionsOrdered[i];
-        next = (hc_msg_ext_t*)extensionsOrdered[i+1];
-        if (next == NULL) {
-            nextExtensionType = 0;
+        ext = msg->extensions[i].ext;
+        if (i + 1 < msg->extensionCount) {
+            nextExtensionType = msg->extensions[i+1].type;
         } else {
-            nextExtensionType = next->type;
+            nextExtensionType = 0;
         }
-        thisExtensionLength = 0;
-        // First we'll encode the extension standards
-        // We encode the NEXT extension's type (or 0 if there is no next extension)
-        write_bytes(data, nextExtensionType, 8, extensionStartIndex, HC_BUFFER_DATA_MAX);
-        // Then it's the extension length size (which is 1)
-        write_bytes(data, 1, 8, extensionStartIndex + 8, HC_BUFFER_DATA_MAX);
-        // Then the extension length itself (set determined by case)
-        thisExtensionLength = 3;
-        // Then these are specific to the extension type
+        // The length decides how wide the length field is, so that comes first
         switch (ext->type) {
             case HC_MSG_EXT_PAYLOAD_TYPE:
-                write_bytes(data, ((hc_msg_ext_payload_t*)ext)->length, 8, extensionStartIndex + 16, HC_BUFFER_DATA_MAX); // extension length
-                write_chars_to_bytes(data, ((hc_msg_ext_payload_t*)ext)->payload, ((hc_msg_ext_payload_t*)ext)->length*8, 
-                                                        extensionStartIndex + 24, HC_BUFFER_DATA_MAX);
-                thisExtensionLength += ((hc_msg_ext_payload_t*)ext)->length;
+                extensionLength = ((hc_msg_ext_payload_t*)ext)->length;
                 break;
             case HC_MSG_EXT_ROUTE_RECORD_TYPE:
                 // Size is really easy, it's 4*the size of the route record (4 bytes per address)
-                write_bytes(data, ((hc_msg_ext_route_record_t*)ext)->routeRecordSize*4, 8, extensionStartIndex + 16, HC_BUFFER_DATA_MAX);
+                extensionLength = ((hc_msg_ext_route_record_t*)ext)->routeRecordSize*4;
+                break;
+            case HC_MSG_EXT_ROUTE_BLOOM_TYPE:
+                extensionLength = HC_OVERLAY_ROUTE_BLOOM_BYTES;
+                break;
+            case HC_MSG_EXT_FRAGMENT_TYPE:
+                extensionLength = HC_SCHEMA_BYTES(HC_OVERLAY_FRAGMENT);
+                break;
+            case HC_MSG_EXT_SEQUENCE_TYPE:
+                extensionLength = HC_SCHEMA_BYTES(HC_OVERLAY_SEQUENCE);
+                break;
+            default:
+                ESP_LOGE(TAG, "Unknown extension type: %d", ext->type);
+                // An empty extension still keeps the chain readable
+                extensionLength = 0;
+                break;
+        }
+        lengthSize = extensionLength > 0xFF ? 2 : 1;
+        // First we'll encode the extension standards, the NEXT extension's type (or 0 if there is no next extension)
+        extensionHeader = hc_write_view(&writer, HC_OVERLAY_EXT_HEADER_length / 8 + lengthSize);
+        if (extensionHeader == NULL) { break; }
+        HC_SCHEMA_SET(extensionHeader, HC_OVERLAY_EXT_HEADER, nextType, nextExtensionType);
+        HC_SCHEMA_SET(extensionHeader, HC_OVERLAY_EXT_HEADER, lengthSize, lengthSize);
+        hc_overlay_ext_set_length(extensionHeader, extensionLength);
+        // Then these are specific to the extension type
+        switch (ext->type) {
+            case HC_MSG_EXT_PAYLOAD_TYPE:
+                // A gathered payload needs a segment for the slot bytes before it, one for itself and one for what's after
+                if (gather && extensionLength > 0 && !writer.error && packet->segmentCount + 3 <= HC_PACKET_MAX_SEGMENTS) {
+                    hc_packet_add_segment(packet, packet->data + segmentStart, hc_writer_length(&writer) - segmentStart);
+                    hc_packet_add_segment(packet, ((hc_msg_ext_payload_t*)ext)->payload, extensionLength);
+                    segmentStart = hc_writer_length(&writer);
+                    gatheredBytes += extensionLength;
+                } else {
+                    hc_write_bytes(&writer, ((hc_msg_ext_payload_t*)ext)->payload, extensionLength);
+                }
+                break;
+            case HC_MSG_EXT_ROUTE_RECORD_TYPE:
                 // Now we'll encode the route record logical addresses iteratively
                 for (int j=0;j<((hc_msg_ext_route_record_t*)ext)->routeRecordSize;j++) {
-                    write_bytes(data, ((hc_msg_ext_route_record_t*)ext)->routeRecordLogicalAddressList[j], 32, extensionStartIndex + 24 + j*32, HC_BUFFER_DATA_MAX);
+                    hc_write_bits(&writer, ((hc_msg_ext_route_record_t*)ext)->routeRecordLogicalAddressList[j], 32);
                 }
-                thisExtensionLength += ((hc_msg_ext_route_record_t*)ext)->routeRecordSize*4;
                 break;
+            case HC_MSG_EXT_ROUTE_BLOOM_TYPE:
+                hc_write_bytes(&writer, (char*)((hc_msg_ext_route_bloom_t*)ext)->bits, extensionLength);
+                break;
+            case HC_MSG_EXT_FRAGMENT_TYPE: {
+                char* fragment = hc_write_view(&writer, extensionLength);
+                if (fragment != NULL) { hc_overlay_fragment_store(fragment, (hc_msg_ext_fragment_t*)ext); }
+                break;
+            }
+            case HC_MSG_EXT_SEQUENCE_TYPE: {
+                char* sequence = hc_write_view(&writer, extensionLength);
+                if (sequence != NULL) { hc_overlay_sequence_store(sequence, (hc_msg_ext_sequence_t*)ext); }
+                break;
+            }
             default:
-                ESP_LOGE(TAG, "Unknown extension type: %d", ext->type);
                 break;
         }
-        // Then we'll update the extensionsLength
-        extensionsLength += thisExtensionLength;
-        // and update extensionStartIndex
-        extensionStartIndex += thisExtensionLength*8;
     }
 
-    // ESP_LOGI(TAG, "Extensions found: %d", extensionsFound);
-
-    // Now dataSize is extensionStartIndex but in bytes not bits
-    dataSize = extensionStartIndex / 8;
-
-    // Then we finish by throwing the first extension type to the beginning
-    if (extensionsFound > 0) {
-        write_bytes(data, ((hc_msg_ext_t*)extensionsOrdered[0])->type, 8, 72, HC_BUFFER_DATA_MAX);
-    } else {
-        write_bytes(data, 0, 8, 72, HC_BUFFER_DATA_MAX);
+    if (writer.error || hc_writer_length(&writer) + gatheredBytes > HC_BUFFER_DATA_MAX) {
+        ESP_LOGE(TAG, "Overlay message too large to encode");
+        free_packet(packet);
+        return NULL;
     }
-    // Now we're done with the ordered extensions array, free it
-    free(extensionsOrdered);
-
-    // And we add the length of the extensions put together
-    write_bytes(data, extensionsLength, 16, 40, HC_BUFFER_DATA_MAX);
+    // Then we finish by throwing the first extension type and the extensions' length into the header
+    if (msg->extensionCount > 0) {
+        HC_SCHEMA_SET(header, HC_OVERLAY_HEADER, firstExtensionType, msg->extensions[0].type);
+    }
+    HC_SCHEMA_SET(header, HC_OVERLAY_HEADER, extensionsLength, (writer.bitOffset - extensionStartIndex) / 8 + gatheredBytes);
     // Now at the end let's pretty it up!
-    hc_packet_t *packet = malloc(sizeof(hc_packet_t));
-    packet->size = dataSize;
-    packet->data = malloc(sizeof(char)*dataSize);
-    memcpy(packet->data, data, dataSize);
+    packet->size = hc_writer_length(&writer);
+    if (packet->segmentCount > 0 && packet->size > segmentStart) {
+        hc_packet_add_segment(packet, packet->data + segmentStart, packet->size - segmentStart);
+    }
     return packet;
 }
 
-hc_msg_overlay_t* hc_msg_overlay_init() {
-    hc_msg_overlay_t* msg = malloc(sizeof(hc_msg_overlay_t));
+hc_packet_t* hc_msg_overlay_encode(hc_msg_overlay_t* msg) {
+    return hc_msg_overlay_encode_packet(msg, false);
+}
 
-    // Now init the extensions array
-    msg->extensions = malloc(sizeof(void*)*HC_OVERLAY_MAX_EXTENSIONS);
-    for (int i=0;i<HC_OVERLAY_MAX_EXTENSIONS;i++) {
-        msg->extensions[i] = NULL;
+static void hc_msg_overlay_release(void* msg) {
+    hc_msg_overlay_free((hc_msg_overlay_t*)msg);
+}
+
+hc_packet_t* hc_msg_overlay_encode_gather(hc_msg_overlay_t* msg) {
+    hc_packet_t* packet = hc_msg_overlay_encode_packet(msg, true);
+    if (packet == NULL || packet->segmentCount == 0) {
+        // Nothing points at the message, so it can go now
+        hc_msg_overlay_free(msg);
+        return packet;
     }
-    // Then return the initialized message
-    return msg;
+    // The payloads are still in the message's arena, so it lives as long as the packet does
+    packet->release = hc_msg_overlay_release;
+    packet->releaseContext = msg;
+    return packet;
+}
+
+hc_msg_overlay_t* hc_msg_overlay_init() {
+    return hc_msg_overlay_create(HC_OVERLAY_ARENA_DEFAULT_SIZE);
 }
 
 void hc_msg_overlay_free(hc_msg_overlay_t* msg) {
-    hc_msg_overlay_free_extensions(msg->extensions);
-    // Then free the message
+    // Extensions and their data all live in the arena, so this is everything
     free(msg);
 }
 
-void hc_msg_overlay_free_extensions(void** extensions) {
-    // First free allocated extensions
-    for (int i=0;i<HC_OVERLAY_MAX_EXTENSIONS;i++) {
-        if (extensions[i] != NULL) {
-            // First check (based on type) if we need to free sub-components
-            switch (((hc_msg_ext_t*)extensions[i])->type) {
-                case HC_MSG_EXT_PAYLOAD_TYPE:
-                    free(((hc_msg_ext_payload_t*)extensions[i])->payload);
-                    break;
-                case HC_MSG_EXT_ROUTE_RECORD_TYPE:
-                    free(((hc_msg_ext_route_record_t*)extensions[i])->routeRecordLogicalAddressList);
-                    break;
-                default:
-                    // Some extensions will have nothing to free
-                    break;
-            }
-            free(extensions[i]);
-        }
-    }
-    // Then free the extensions array
-    free(extensions);
+static void hc_msg_overlay_set_origin(hc_msg_overlay_t* msg, uint32_t logicalAddress) {
+    // Header values for a message that starts with us
+    msg->version = HC_OVERLAY_VERSION;
+    msg->dataMode = 1;
+    msg->hopLimit = 254;
+    msg->sourceLogicalAddress = logicalAddress;
+    msg->previousHopLogicalAddress = logicalAddress;
 }
 
 hc_msg_overlay_t* hc_msg_overlay_init_with_payload(hypercast_t* hypercast, char* payload, int payloadLength) {
-    hc_msg_overlay_t* msg = hc_msg_overlay_init();
+    hc_msg_overlay_t* msg = hc_msg_overlay_create(payloadLength + HC_OVERLAY_ARENA_DEFAULT_SIZE);
+    if (msg == NULL) { return NULL; }
     // Now populate body of message
-    msg->version = 3;
-    msg->dataMode = 1;
-    msg->hopLimit = 254;
-    msg->sourceLogicalAddress = hypercast->senderTable->sourceAddressLogical;
-    msg->previousHopLogicalAddress = hypercast->senderTable->sourceAddressLogical;
+    hc_msg_overlay_set_origin(msg, hypercast->senderTable->sourceAddressLogical);
     // Then add payload extension
-    hc_msg_ext_payload_t* ext = malloc(sizeof(hc_msg_ext_payload_t));
+    hc_msg_ext_payload_t* ext = hc_msg_overlay_alloc(msg, sizeof(hc_msg_ext_payload_t));
     ext->type = HC_MSG_EXT_PAYLOAD_TYPE;
     ext->order = 1;
     ext->length = payloadLength;
-    ext->payload = malloc(sizeof(char)*payloadLength);
+    ext->payload = hc_msg_overlay_alloc(msg, payloadLength);
     memcpy(ext->payload, payload, payloadLength);
     hc_msg_overlay_insert_extension(msg, ext);
     // Now add the route record extension
-    hc_msg_ext_route_record_t* ext2 = malloc(sizeof(hc_msg_ext_route_record_t));
-    ext2->type = HC_MSG_EXT_ROUTE_RECORD_TYPE;
-    ext2->order = 2;
+    hc_msg_ext_route_record_t* ext2 = hc_msg_overlay_new_route_record(msg, 2, 1 + HC_OVERLAY_ROUTE_RECORD_SPARE);
     ext2->routeRecordSize = 1;
-    ext2->routeRecordLogicalAddressList = malloc(sizeof(uint32_t)*ext2->routeRecordSize);
     ext2->routeRecordLogicalAddressList[0] = hypercast->senderTable->sourceAddressLogical;
     hc_msg_overlay_insert_extension(msg, ext2);
     return msg;
 }
 
 int hc_msg_overlay_insert_extension(hc_msg_overlay_t* msg, void* extension) {
-    // Because the limit for extensions is so low, we can just do a dumb hash here
-    int type = ((hc_msg_ext_t*)extension)->type;
-    int insertIndex = type;
-    
-    // Try insert at "type" position then continue trying if we fail
-    while (msg->extensions[insertIndex] != NULL) {
-        insertIndex++;
-        if (insertIndex >= HC_OVERLAY_MAX_EXTENSIONS) {
-            insertIndex = 0;
-        }
-        if (insertIndex == type) {
-            // We've tried all the positions, and we're still failing
-            ESP_LOGE(TAG, "Failed to insert extension, no extension slots available in Overlay Message");
-            return -1;
-        }
+    hc_msg_ext_t* ext = (hc_msg_ext_t*)extension;
+    if (msg->extensionCount >= HC_OVERLAY_MAX_EXTENSIONS) {
+        ESP_LOGE(TAG, "Failed to insert extension, no extension slots available in Overlay Message");
+        return -1;
     }
-    
-    // Now we know that "insertIndex" is a free slot, so we can insert
-    msg->extensions[insertIndex] = extension;
+    // Keep the table in message order, so shift anything that comes after the new one down
+    int insertIndex = msg->extensionCount;
+    while (insertIndex > 0 && msg->extensions[insertIndex - 1].order > ext->order) {
+        msg->extensions[insertIndex] = msg->extensions[insertIndex - 1];
+        insertIndex--;
+    }
+    hc_msg_ext_slot_t* slot = &msg->extensions[insertIndex];
+    slot->type = ext->type;
+    slot->order = ext->order;
+    slot->offset = 0;
+    slot->length = 0;
+    slot->ext = ext;
+    msg->extensionCount++;
 
     // Then we're done
     return 1;
 }
 
-int hc_msg_overlay_get_primary_payload(hc_msg_overlay_t* msg, char** payload_destination, int* payload_length) {
-    // Find payload extensions in the extension array
-    int payloadExtensionIndex = HC_MSG_EXT_PAYLOAD_TYPE;
-    
-    void* extension;
-
-    while (msg->extensions[payloadExtensionIndex] != NULL) {
-        // We're basically looking for the first extension of the correct type
-        // (because of how ordering works)
-        if (((hc_msg_ext_t*)msg->extensions[payloadExtensionIndex])->type == HC_MSG_EXT_PAYLOAD_TYPE) {
-            // We found the first payload extension, so let's return it
-            extension = msg->extensions[payloadExtensionIndex];
-            *payload_destination = ((hc_msg_ext_payload_t*)extension)->payload;
-            *payload_length = ((hc_msg_ext_payload_t*)extension)->length;
-            return 1;
-        }
-        payloadExtensionIndex++;
-        if (payloadExtensionIndex >= HC_OVERLAY_MAX_EXTENSIONS) {
-            payloadExtensionIndex = 0;
-        }
-        if (payloadExtensionIndex == HC_MSG_EXT_PAYLOAD_TYPE) {
-            // We've tried all the positions, and we're still failing
-            ESP_LOGE(TAG, "Failed to find payload extension in Overlay Message when trying to retrieve payload");
-            return -1;
+static hc_msg_ext_slot_t* hc_msg_overlay_find_nth_slot(hc_msg_overlay_t* msg, int type, int n) {
+    // Slots are in message order, so the first match is the primary one of that type
+    for (int i = 0; i < msg->extensionCount; i++) {
+        if (msg->extensions[i].type == type && n-- == 0) {
+            return &msg->extensions[i];
         }
     }
+    return NULL;
+}
 
-    return -1;
+static hc_msg_ext_slot_t* hc_msg_overlay_find_slot(hc_msg_overlay_t* msg, int type) {
+    return hc_msg_overlay_find_nth_slot(msg, type, 0);
 }
 
-int hc_msg_overlay_retrieve_extension_of_type(hc_msg_overlay_t* msg, int type, void** extension) {
-     // Find payload extensions in the extension array
-    int extensionIndex = type;
-
-    while (msg->extensions[extensionIndex] != NULL) {
-        // We're basically looking for the first extension of the correct type
-        // (because of how ordering works)
-        if (((hc_msg_ext_t*)msg->extensions[extensionIndex])->type == type) {
-            // We found the first payload extension, so let's return it
-            *extension = msg->extensions[extensionIndex];
-            return 1;
-        }
-        extensionIndex++;
-        if (extensionIndex >= HC_OVERLAY_MAX_EXTENSIONS) {
-            extensionIndex = 0;
-        }
-        if (extensionIndex == type) {
-            // We've tried all the positions, and we're still failing
-            ESP_LOGE(TAG, "Failed to find retrieve extension of type %d in Overlay Message", type);
-            return -1;
-        }
+int hc_msg_overlay_get_payload(hc_msg_overlay_t* msg, int index, char** payload_destination, int* payload_length) {
+    // Aggregated messages carry several payloads, running off the end is how callers know they've seen them all
+    hc_msg_ext_slot_t* slot = hc_msg_overlay_find_nth_slot(msg, HC_MSG_EXT_PAYLOAD_TYPE, index);
+    if (slot == NULL) {
+        return -1;
     }
+    if (slot->payload != NULL) {
+        *payload_destination = slot->payload->payload;
+        *payload_length = slot->payload->length;
+        return 1;
+    }
+    // A lazy message still has the payload sitting in the packet, so we just point at it
+    *payload_destination = (char*)msg->packet->data + slot->offset;
+    *payload_length = slot->length;
+    return 1;
+}
 
-    return -1;
+int hc_msg_overlay_get_primary_payload(hc_msg_overlay_t* msg, char** payload_destination, int* payload_length) {
+    // Find the payload extension in the extension table
+    if (hc_msg_overlay_get_payload(msg, 0, payload_destination, payload_length) < 0) {
+        ESP_LOGE(TAG, "Failed to find payload extension in Overlay Message when trying to retrieve payload");
+        return -1;
+    }
+    return 1;
 }
 
-int hc_msg_overlay_ext_get_next_order(hc_msg_overlay_t* msg) {
-    // Find the next order in the extension array
-    int extensionIndex = 0;
-    int maxOrder = 0;
-    hc_msg_ext_t* extension;
-    for (extensionIndex=0;extensionIndex<HC_OVERLAY_MAX_EXTENSIONS;extensionIndex++) {
-        if (msg->extensions[extensionIndex] == NULL) { continue; }
-        // Now we want to find the order number of this extension
-        extension = (hc_msg_ext_t*)msg->extensions[extensionIndex];
-        if (extension->order > maxOrder) {
-            maxOrder = extension->order;
-        }
+int hc_msg_overlay_retrieve_extension_of_type(hc_msg_overlay_t* msg, int type, void** extension) {
+    // Lazy messages decode the extension the first time it's asked for
+    hc_msg_ext_slot_t* slot = hc_msg_overlay_find_slot(msg, type);
+    if (slot == NULL || hc_msg_overlay_decode_slot(msg, slot) < 0) {
+        return -1;
     }
+    *extension = slot->ext;
+    return 1;
+}
 
-    return maxOrder + 1;
+int hc_msg_overlay_ext_get_next_order(hc_msg_overlay_t* msg) {
+    // The table is in order, so the last one has the highest order
+    if (msg->extensionCount == 0) { return 1; }
+    return msg->extensions[msg->extensionCount - 1].order + 1;
 }
 
 int hc_overlay_route_record_contains(hc_msg_overlay_t* msg, int logicalAddress) {
-    // First check if there is a route record
-    hc_msg_ext_route_record_t* routeRecord = NULL;
-    int recordFindResult = hc_msg_overlay_retrieve_extension_of_type(msg, HC_MSG_EXT_ROUTE_RECORD_TYPE, (void*)&routeRecord);
+    // First check if there is a Bloom filter, that one's a constant time check
+    hc_msg_ext_slot_t* slot = hc_msg_overlay_find_slot(msg, HC_MSG_EXT_ROUTE_BLOOM_TYPE);
+    if (slot != NULL) {
+        // A lazy message can be checked straight from the packet, no need to decode it
+        if (slot->routeBloom == NULL) {
+            if (slot->length != HC_OVERLAY_ROUTE_BLOOM_BYTES) { return 0; }
+            return hc_overlay_bloom_contains((const uint8_t*)msg->packet->data + slot->offset, logicalAddress);
+        }
+        return hc_overlay_bloom_contains(slot->routeBloom->bits, logicalAddress);
+    }
+
+    // Then check if there is a route record
+    slot = hc_msg_overlay_find_slot(msg, HC_MSG_EXT_ROUTE_RECORD_TYPE);
+    if (slot == NULL) { return 0; }
 
-    if (recordFindResult == 1) {
-        // We found a route record, so let's check if it contains the logical address
-        for (int i=0;i<routeRecord->routeRecordSize;i++) {
-            if (routeRecord->routeRecordLogicalAddressList[i] == logicalAddress) {
+    if (slot->routeRecord == NULL) {
+        // Same goes for the route record
+        const char* data = msg->packet->data + slot->offset;
+        for (int i = 0; i < slot->length / 4; i++) {
+            if (hc_load_bits(data, i * 32, 32) == (uint32_t)logicalAddress) {
                 return 1;
             }
         }
+        return 0;
+    }
+
+    // We found a route record, so let's check if it contains the logical address
+    hc_msg_ext_route_record_t* routeRecord = slot->routeRecord;
+    for (int i=0;i<routeRecord->routeRecordSize;i++) {
+        if (routeRecord->routeRecordLogicalAddressList[i] == logicalAddress) {
+            return 1;
+        }
     }
 
     return 0;
 }
 
-void hc_overlay_route_record_append(hc_msg_overlay_t* msg, int logicalAddress) {
-    // First check if there is a route record
+static int hc_overlay_route_record_compact(hc_msg_overlay_t* msg, hc_msg_ext_route_record_t* routeRecord, int logicalAddress) {
+    // Hash everything on the record (and the new address) into a Bloom filter, which takes the record's place
+    hc_msg_ext_route_bloom_t* routeBloom = hc_msg_overlay_alloc(msg, sizeof(hc_msg_ext_route_bloom_t));
+    if (routeBloom == NULL) { return -1; }
+    routeBloom->type = HC_MSG_EXT_ROUTE_BLOOM_TYPE;
+    routeBloom->order = routeRecord->order;
+    memset(routeBloom->bits, 0, HC_OVERLAY_ROUTE_BLOOM_BYTES);
+    for (int i = 0; i < routeRecord->routeRecordSize; i++) {
+        hc_overlay_bloom_add(routeBloom->bits, routeRecord->routeRecordLogicalAddressList[i]);
+    }
+    hc_overlay_bloom_add(routeBloom->bits, logicalAddress);
+    hc_msg_ext_slot_t* slot = hc_msg_overlay_find_slot(msg, HC_MSG_EXT_ROUTE_RECORD_TYPE);
+    slot->type = HC_MSG_EXT_ROUTE_BLOOM_TYPE;
+    slot->routeBloom = routeBloom;
+    return 1;
+}
+
+int hc_overlay_route_record_append(hc_msg_overlay_t* msg, int logicalAddress) {
+    // If the route has already been compacted we just hash ourselves in
+    hc_msg_ext_route_bloom_t* routeBloom = NULL;
+    if (hc_msg_overlay_retrieve_extension_of_type(msg, HC_MSG_EXT_ROUTE_BLOOM_TYPE, (void*)&routeBloom) > 0) {
+        hc_overlay_bloom_add(routeBloom->bits, logicalAddress);
+        return 1;
+    }
+
+    // Otherwise check if there is a route record
     hc_msg_ext_route_record_t* routeRecord = NULL;
     int recordFindResult = hc_msg_overlay_retrieve_extension_of_type(msg, HC_MSG_EXT_ROUTE_RECORD_TYPE, (void*)&routeRecord);
 
     // If not, add one
     if (recordFindResult == -1) {
-        routeRecord = malloc(sizeof(hc_msg_ext_route_record_t));
-        routeRecord->type = HC_MSG_EXT_ROUTE_RECORD_TYPE;
-        routeRecord->order = hc_msg_overlay_ext_get_next_order(msg);
-        routeRecord->routeRecordSize = 1;
-        routeRecord->routeRecordLogicalAddressList = malloc(sizeof(uint32_t) * HC_OVERLAY_MAX_ROUTE_RECORD_LENGTH);
+        routeRecord = hc_msg_overlay_new_route_record(msg, hc_msg_overlay_ext_get_next_order(msg), 2 + HC_OVERLAY_ROUTE_RECORD_SPARE);
+        if (routeRecord == NULL) { return -1; }
         // Add the message sender to the table automatically
         routeRecord->routeRecordLogicalAddressList[0] = msg->sourceLogicalAddress;
-        hc_msg_overlay_insert_extension(msg, (void*)routeRecord);
+        routeRecord->routeRecordSize = 1;
+        if (hc_msg_overlay_insert_extension(msg, (void*)routeRecord) < 0) { return -1; }
+    }
+
+    // Once the record would outgrow the Bloom filter, it becomes one
+    if (routeRecord->routeRecordSize >= HC_OVERLAY_ROUTE_RECORD_LIMIT) {
+        if (HC_OVERLAY_NATIVE_EXTENSIONS) {
+            return hc_overlay_route_record_compact(msg, routeRecord, logicalAddress);
+        }
+        // Without the filter the record's one byte length is all there is, so the oldest hop after the source
+        // makes room for us and the record stays the same size
+        ESP_LOGW(TAG, "Route record is full, dropping its oldest hop");
+        uint32_t* list = routeRecord->routeRecordLogicalAddressList;
+        memmove(list + 1, list + 2, sizeof(uint32_t) * (routeRecord->routeRecordSize - 2));
+        list[routeRecord->routeRecordSize - 1] = logicalAddress;
+        return HC_OVERLAY_ROUTE_TRUNCATED;
+    }
+    // Out of room, so the list moves to a full size spot in the arena, it only ever has to move once
+    if (routeRecord->routeRecordSize >= routeRecord->routeRecordCapacity) {
+        int capacity = HC_OVERLAY_ROUTE_RECORD_LIMIT;
+        uint32_t* list = hc_msg_overlay_alloc(msg, sizeof(uint32_t) * capacity);
+        if (list == NULL) { return -1; }
+        memcpy(list, routeRecord->routeRecordLogicalAddressList, sizeof(uint32_t) * routeRecord->routeRecordSize);
+        routeRecord->routeRecordLogicalAddressList = list;
+        routeRecord->routeRecordCapacity = capacity;
     }
 
     // Now we'll add our logical address to the route record
@@ -421,4 +618,243 @@ void hc_overlay_route_record_append(hc_msg_overlay_t* msg, int logicalAddress) {
     routeRecord->routeRecordSize++;
 
     // Done!
-}
\ No newline at end of file
+    return 1;
+}
+
+int hc_overlay_next_extension(const hc_packet_t* packet, int offset, int* type) {
+    // Walk the extension headers only, the data in between is never touched
+    int headerBytes = HC_SCHEMA_BYTES(HC_OVERLAY_HEADER);
+    if (packet->size < headerBytes) { return -1; }
+    int end = headerBytes + HC_SCHEMA_GET(packet->data, HC_OVERLAY_HEADER, extensionsLength);
+    if (end > packet->size) { end = packet->size; }
+    int extensionType;
+    if (offset < 0) {
+        offset = headerBytes;
+        extensionType = HC_SCHEMA_GET(packet->data, HC_OVERLAY_HEADER, firstExtensionType);
+    } else {
+        // The header at offset was checked when we handed it out, so we can step over it
+        const char* extensionHeader = packet->data + offset;
+        extensionType = HC_SCHEMA_GET(extensionHeader, HC_OVERLAY_EXT_HEADER, nextType);
+        offset += hc_overlay_ext_header_bytes(extensionHeader) + hc_overlay_ext_length(extensionHeader);
+    }
+    if (extensionType == HC_OVERLAY_EXT_TYPE_NULL) { return -1; }
+    // The header's own size depends on its length size, so that has to be checked first
+    if (offset + HC_OVERLAY_EXT_HEADER_length / 8 > end) { return -1; }
+    const char* extensionHeader = packet->data + offset;
+    int lengthSize = HC_SCHEMA_GET(extensionHeader, HC_OVERLAY_EXT_HEADER, lengthSize);
+    if (lengthSize < 1 || lengthSize > HC_OVERLAY_EXT_LENGTH_SIZE_MAX || offset + hc_overlay_ext_header_bytes(extensionHeader) > end) {
+        return -1;
+    }
+    *type = extensionType;
+    return offset;
+}
+
+int hc_overlay_find_extension(const hc_packet_t* packet, int type, int* lastOffset) {
+    int extensionType;
+    int offset = -1;
+    if (lastOffset != NULL) { *lastOffset = -1; }
+    for (int i = 0; i < HC_OVERLAY_MAX_EXTENSIONS && (offset = hc_overlay_next_extension(packet, offset, &extensionType)) >= 0; i++) {
+        if (extensionType == type) { return offset; }
+        if (lastOffset != NULL) { *lastOffset = offset; }
+    }
+    return -1;
+}
+
+int hc_overlay_start_in_place(hc_packet_t* packet, uint32_t logicalAddress) {
+    // Same header hc_msg_overlay_init_with_payload gives a message, with nothing after it yet
+    hc_msg_overlay_t msg;
+    hc_msg_overlay_set_origin(&msg, logicalAddress);
+    hc_overlay_header_store(packet->data, &msg);
+    packet->size = HC_SCHEMA_BYTES(HC_OVERLAY_HEADER);
+    return 1;
+}
+
+int hc_overlay_chain_extension_in_place(hc_packet_t* packet, int type, int length, int lengthSize) {
+    // The new extension goes on the end, so it's the last extension that has to point at it
+    int lastOffset;
+    hc_overlay_find_extension(packet, HC_OVERLAY_EXT_TYPE_NULL, &lastOffset);
+    int headerBytes = HC_SCHEMA_BYTES(HC_OVERLAY_HEADER);
+    int extensionsLength = HC_SCHEMA_GET(packet->data, HC_OVERLAY_HEADER, extensionsLength);
+    int extensionHeaderBytes = HC_OVERLAY_EXT_HEADER_length / 8 + lengthSize;
+    int offset = headerBytes + extensionsLength;
+    if (length > HC_OVERLAY_EXT_LENGTH_MAX || (length > 0xFF && lengthSize < 2)
+        || offset + extensionHeaderBytes + length > HC_BUFFER_DATA_MAX) {
+        ESP_LOGE(TAG, "No room to append a %d byte extension", length);
+        return -1;
+    }
+    char* extensionHeader = packet->data + offset;
+    HC_SCHEMA_SET(extensionHeader, HC_OVERLAY_EXT_HEADER, nextType, HC_OVERLAY_EXT_TYPE_NULL);
+    HC_SCHEMA_SET(extensionHeader, HC_OVERLAY_EXT_HEADER, lengthSize, lengthSize);
+    hc_overlay_ext_set_length(extensionHeader, length);
+    if (lastOffset < 0) {
+        HC_SCHEMA_SET(packet->data, HC_OVERLAY_HEADER, firstExtensionType, type);
+    } else {
+        HC_SCHEMA_SET(packet->data + lastOffset, HC_OVERLAY_EXT_HEADER, nextType, type);
+    }
+    HC_SCHEMA_SET(packet->data, HC_OVERLAY_HEADER, extensionsLength, extensionsLength + extensionHeaderBytes + length);
+    packet->size = offset + extensionHeaderBytes;
+    return offset + extensionHeaderBytes;
+}
+
+int hc_overlay_append_extension_in_place(hc_packet_t* packet, int type, const char* data, int length) {
+    int dataOffset = hc_overlay_chain_extension_in_place(packet, type, length, length > 0xFF ? 2 : 1);
+    if (dataOffset < 0) { return -1; }
+    memcpy(packet->data + dataOffset, data, length);
+    packet->size = dataOffset + length;
+    return 1;
+}
+
+uint32_t hc_overlay_next_sequence(hypercast_t* hypercast) {
+    return atomic_fetch_add_explicit(&hypercast->senderTable->nextSequence, 1, memory_order_relaxed);
+}
+
+int hc_overlay_append_sequence_in_place(hc_packet_t* packet, hypercast_t* hypercast) {
+    // Peers that don't know the extension would choke on it, see HC_OVERLAY_NATIVE_EXTENSIONS
+    if (!HC_OVERLAY_NATIVE_EXTENSIONS) { return 1; }
+    char sequence[HC_SCHEMA_BYTES(HC_OVERLAY_SEQUENCE)];
+    HC_SCHEMA_SET(sequence, HC_OVERLAY_SEQUENCE, sequence, hc_overlay_next_sequence(hypercast));
+    return hc_overlay_append_extension_in_place(packet, HC_MSG_EXT_SEQUENCE_TYPE, sequence, sizeof(sequence));
+}
+
+static int hc_overlay_insert_bytes(hc_packet_t* packet, int offset, int length) {
+    // Open a gap in the packet, everything after it shifts down
+    if (packet->size + length > HC_BUFFER_DATA_MAX) { return -1; }
+    memmove(packet->data + offset + length, packet->data + offset, packet->size - offset);
+    packet->size += length;
+    return 1;
+}
+
+static void hc_overlay_remove_bytes(hc_packet_t* packet, int offset, int length) {
+    // Close a gap, everything after it shifts up
+    memmove(packet->data + offset, packet->data + offset + length, packet->size - offset - length);
+    packet->size -= length;
+}
+
+static int hc_overlay_route_record_compact_in_place(hc_packet_t* packet, int recordOffset, int lastOffset,
+                                                    uint32_t logicalAddress, int* change) {
+    // Same as hc_overlay_route_record_compact, but for the record sitting at recordOffset in the packet
+    int addressBytes = HC_OVERLAY_HEADER_sourceLogicalAddress_BITS / 8;
+    char* recordHeader = packet->data + recordOffset;
+    int extensionHeaderBytes = hc_overlay_ext_header_bytes(recordHeader);
+    char* recordData = recordHeader + extensionHeaderBytes;
+    int recordLength = hc_overlay_ext_length(recordHeader);
+    uint8_t bits[HC_OVERLAY_ROUTE_BLOOM_BYTES] = {0};
+    for (int i = 0; i < recordLength / addressBytes; i++) {
+        hc_overlay_bloom_add(bits, hc_load_bits(recordData, i * addressBytes * 8, addressBytes * 8));
+    }
+    hc_overlay_bloom_add(bits, logicalAddress);
+
+    // The filter goes where the addresses were, so the record's data grows or shrinks to fit it
+    *change = HC_OVERLAY_ROUTE_BLOOM_BYTES - recordLength;
+    if (*change > 0 && hc_overlay_insert_bytes(packet, recordOffset + extensionHeaderBytes, *change) < 0) {
+        return -1;
+    }
+    if (*change < 0) {
+        hc_overlay_remove_bytes(packet, recordOffset + extensionHeaderBytes, -*change);
+    }
+    memcpy(recordData, bits, HC_OVERLAY_ROUTE_BLOOM_BYTES);
+    hc_overlay_ext_set_length(recordHeader, HC_OVERLAY_ROUTE_BLOOM_BYTES);
+    // Then whatever pointed at the route record now points at the filter
+    if (lastOffset < 0) {
+        HC_SCHEMA_SET(packet->data, HC_OVERLAY_HEADER, firstExtensionType, HC_MSG_EXT_ROUTE_BLOOM_TYPE);
+    } else {
+        HC_SCHEMA_SET(packet->data + lastOffset, HC_OVERLAY_EXT_HEADER, nextType, HC_MSG_EXT_ROUTE_BLOOM_TYPE);
+    }
+    return 1;
+}
+
+int hc_overlay_forward_in_place(hc_packet_t* packet, uint32_t logicalAddress) {
+    char* header = packet->data;
+    int headerBytes = HC_SCHEMA_BYTES(HC_OVERLAY_HEADER);
+    int extensionHeaderBytes = HC_SCHEMA_BYTES(HC_OVERLAY_EXT_HEADER); // For a record we add, which is always the short form
+    int addressBytes = HC_OVERLAY_HEADER_sourceLogicalAddress_BITS / 8;
+    if (packet->size < headerBytes) {
+        ESP_LOGE(TAG, "Packet too small to be an overlay message");
+        return -1;
+    }
+    // A message that has run out of hops is still ours to read, it just stops here
+    int hopLimit = HC_SCHEMA_GET(header, HC_OVERLAY_HEADER, hopLimit);
+    if (hopLimit == 0) {
+        ESP_LOGD(TAG, "Hop limit reached, not forwarding");
+        return -1;
+    }
+    int extensionsLength = HC_SCHEMA_GET(header, HC_OVERLAY_HEADER, extensionsLength);
+    int result = 1;
+
+    // Append ourselves to the route record, or start one with the source and us (if the other node was negligent)
+    int lastOffset;
+    int recordOffset = hc_overlay_find_extension(packet, HC_MSG_EXT_ROUTE_RECORD_TYPE, &lastOffset);
+    int bloomOffset = recordOffset >= 0 ? -1 : hc_overlay_find_extension(packet, HC_MSG_EXT_ROUTE_BLOOM_TYPE, &lastOffset);
+    if (bloomOffset >= 0) {
+        // Already compacted, so we're just a few more bits and the packet doesn't change size
+        char* bloomHeader = packet->data + bloomOffset;
+        int bloomHeaderBytes = hc_overlay_ext_header_bytes(bloomHeader);
+        if (hc_overlay_ext_length(bloomHeader) != HC_OVERLAY_ROUTE_BLOOM_BYTES
+            || bloomOffset + bloomHeaderBytes + HC_OVERLAY_ROUTE_BLOOM_BYTES > packet->size) {
+            ESP_LOGE(TAG, "Malformed route Bloom filter, not forwarding");
+            return -1;
+        }
+        hc_overlay_bloom_add((uint8_t*)bloomHeader + bloomHeaderBytes, logicalAddress);
+    } else if (recordOffset >= 0) {
+        char* recordHeader = packet->data + recordOffset;
+        int recordHeaderBytes = hc_overlay_ext_header_bytes(recordHeader);
+        int recordLength = hc_overlay_ext_length(recordHeader);
+        if (recordOffset + recordHeaderBytes + recordLength > packet->size) {
+            ESP_LOGE(TAG, "Malformed route record, not forwarding");
+            return -1;
+        }
+        // Once the record would outgrow the Bloom filter, it becomes one (in the same spot), or without it the record is full
+        if (recordLength / addressBytes >= HC_OVERLAY_ROUTE_RECORD_LIMIT) {
+            if (!HC_OVERLAY_NATIVE_EXTENSIONS) {
+                // No filter to switch to, so the oldest hop after the source makes room for us (same as
+                // hc_overlay_route_record_append) and the packet doesn't change size
+                ESP_LOGW(TAG, "Route record is full, dropping its oldest hop");
+                char* recordData = recordHeader + recordHeaderBytes;
+                memmove(recordData + addressBytes, recordData + addressBytes * 2, recordLength - addressBytes * 2);
+                hc_store_bits(recordData, (recordLength - addressBytes) * 8, addressBytes * 8, logicalAddress);
+                result = HC_OVERLAY_ROUTE_TRUNCATED;
+            } else {
+                int change;
+                if (hc_overlay_route_record_compact_in_place(packet, recordOffset, lastOffset, logicalAddress, &change) < 0) {
+                    ESP_LOGE(TAG, "No room to compact the route record, not forwarding");
+                    return -1;
+                }
+                extensionsLength += change;
+            }
+        } else {
+            int recordEnd = recordOffset + recordHeaderBytes + recordLength;
+            if (hc_overlay_insert_bytes(packet, recordEnd, addressBytes) < 0) {
+                ESP_LOGE(TAG, "No room to extend the route record, not forwarding");
+                return -1;
+            }
+            hc_store_bits(packet->data, recordEnd * 8, addressBytes * 8, logicalAddress);
+            hc_overlay_ext_set_length(recordHeader, recordLength + addressBytes);
+            extensionsLength += addressBytes;
+        }
+    } else {
+        int recordLength = addressBytes * 2;
+        recordOffset = headerBytes + extensionsLength;
+        if (recordOffset > packet->size || hc_overlay_insert_bytes(packet, recordOffset, extensionHeaderBytes + recordLength) < 0) {
+            ESP_LOGE(TAG, "No room to add a route record, not forwarding");
+            return -1;
+        }
+        char* recordHeader = packet->data + recordOffset;
+        hc_overlay_ext_header_store(recordHeader, NULL);
+        HC_SCHEMA_SET(recordHeader, HC_OVERLAY_EXT_HEADER, length, recordLength);
+        hc_store_bits(recordHeader + extensionHeaderBytes, 0, addressBytes * 8, HC_SCHEMA_GET(header, HC_OVERLAY_HEADER, sourceLogicalAddress));
+        hc_store_bits(recordHeader + extensionHeaderBytes, addressBytes * 8, addressBytes * 8, logicalAddress);
+        // Then chain it on after the last extension
+        if (lastOffset < 0) {
+            HC_SCHEMA_SET(header, HC_OVERLAY_HEADER, firstExtensionType, HC_MSG_EXT_ROUTE_RECORD_TYPE);
+        } else {
+            HC_SCHEMA_SET(packet->data + lastOffset, HC_OVERLAY_EXT_HEADER, nextType, HC_MSG_EXT_ROUTE_RECORD_TYPE);
+        }
+        extensionsLength += extensionHeaderBytes + recordLength;
+    }
+
+    // Finally the fixed size fields
+    HC_SCHEMA_SET(header, HC_OVERLAY_HEADER, extensionsLength, extensionsLength);
+    HC_SCHEMA_SET(header, HC_OVERLAY_HEADER, hopLimit, hopLimit - 1);
+    HC_SCHEMA_SET(header, HC_OVERLAY_HEADER, previousHopLogicalAddress, logicalAddress);
+    return result;
+}
@@ -11,70 +11,88 @@
 
 static const char* TAG = "HC_PROTOCOLS";
 
-void hc_protocol_parse(hc_packet_t *packet, long protocolId, hypercast_t *hypercast) {
-    // Now check that hypercast protocol matches the message protocol
-    if (protocolId != ((hc_protocol_shell_t*)(hypercast->protocol))->id) {
-        ESP_LOGE(TAG, "Protocol not active, expected %d, got %ld", (int)((hc_protocol_shell_t*)(hypercast->protocol))->id, protocolId);
-        return;
-    }
-    // Then get the OverlayID hash, and the type, which are common to all protocols
-    long messageLength = packet_to_int(packet_snip_to_bytes(packet, 16, 8));
-    long protocolMessageType = packet_to_int(packet_snip_to_bytes(packet, 8, 24));
-    long overlayId = packet_to_int(packet_snip_to_bytes(packet, 32, 32));
+// Every protocol we can run, indexed by protocolId so finding one is a lookup instead of a switch
+// A protocol registers by adding its ops here, the linker wires the rest up (nothing runs at start up)
+static const hc_protocol_ops_t* const registry[HC_PROTOCOL_IDS] = {
+    [HC_PROTOCOL_SPT] = &spt_protocol_ops,
+};
 
-    // Make sure the Overlay hashes match
-    if (overlayId != ((hc_protocol_shell_t*)(hypercast->protocol))->overlayId) {
-        ESP_LOGE(TAG, "Overlay hash does not match this node's hash, discarding packet");
-        return;
+const hc_protocol_ops_t* hc_protocol_lookup(int protocolId) {
+    if (protocolId < 0 || protocolId >= HC_PROTOCOL_IDS) { return NULL; }
+    return registry[protocolId];
+}
+
+int hc_protocol_install(hypercast_t *hypercast, int protocolId, int overlayId) {
+    const hc_protocol_ops_t* ops = hc_protocol_lookup(protocolId);
+    if (ops == NULL) {
+        ESP_LOGE(TAG, "No protocol registered with id %d", protocolId);
+        return -1;
     }
-    
-    // Make sure that "MessageLength" is less than or equal to the packet length
-    // Otherwise some packet was lost
-    if (messageLength > packet->size) {
-        ESP_LOGE(TAG, "Message length > packet length, packet dropped");
-        return;
+    if (hypercast->protocolCount >= HC_PROTOCOL_MAX_INSTANCES) {
+        ESP_LOGE(TAG, "Already in %d overlays, the most is %d", hypercast->protocolCount, HC_PROTOCOL_MAX_INSTANCES);
+        return -1;
+    }
+    if (hc_protocol_find(hypercast, overlayId) != NULL) {
+        ESP_LOGE(TAG, "Already in overlay %d", overlayId);
+        return -1;
     }
-    
-    switch (protocolId) {
-        case HC_PROTOCOL_SPT:
-            ESP_LOGI(TAG, "Protocol Packet Received for SPT");
-            spt_parse(packet, protocolMessageType, overlayId, messageLength, hypercast);
-            break;
-        default:
-            ESP_LOGE(TAG, "MESSAGE FROM UNSUPPORTED PROTOCOL RECEIVED");
-            break;
+    hc_protocol_shell_t* protocol = (hc_protocol_shell_t*)ops->create(hypercast->senderTable->sourceAddressLogical);
+    if (protocol == NULL) {
+        ESP_LOGE(TAG, "Failed to create %s instance", ops->name);
+        return -1;
     }
+    protocol->id = ops->id;
+    protocol->overlayId = overlayId;
+    protocol->ops = ops;
+    hypercast->protocols[hypercast->protocolCount++] = protocol;
+    ESP_LOGI(TAG, "Running %s in overlay %d", ops->name, overlayId);
+    // Its periodic work runs off the engine's timers from here on
+    ops->start(protocol, hypercast);
+    return 1;
 }
 
-void hc_protocol_maintenance(hypercast_t *hypercast) {
-    // Each protocol has maintenance that it may need to do automatically at some interval
-    // This is its opportunity to do that!
-    switch (((hc_protocol_shell_t*)(hypercast->protocol))->id) {
-        case HC_PROTOCOL_SPT:
-            spt_maintenance(hypercast);
-            break;
-        default:
-            ESP_LOGE(TAG, "HYPERCAST RUNNING ON UNSUPPORTED PROTOCOL");
-            break;
+hc_protocol_shell_t* hc_protocol_find(hypercast_t *hypercast, int overlayId) {
+    // There are only ever a handful, so a walk beats anything cleverer
+    for (int i = 0; i < hypercast->protocolCount; i++) {
+        if (hypercast->protocols[i]->overlayId == overlayId) {
+            return hypercast->protocols[i];
+        }
     }
-    return;
+    return NULL;
 }
 
-void* resolve_protocol_to_install(int config, uint32_t sourceLogicalAddress) { // config type should be more interesting
-    // This function will return some void * cast of an allocated protocol object
-    // it would also be a switch, but here we're just returning a pre-built spt obj
-    void* protocol = (void*)spt_protocol_from_config(sourceLogicalAddress);
-    ((hc_protocol_shell_t*)protocol)->id = HC_PROTOCOL_SPT;
-    ((hc_protocol_shell_t*)protocol)->overlayId = set_overlay_hash();
-    return protocol;
+void hc_protocol_parse(hc_packet_t *packet, long protocolId, hypercast_t *hypercast) {
+    // Get the OverlayID hash, and the type, which are common to all protocols
+    // The ingress filter has already checked the lengths and the hash (see hc_filter.c)
+    long messageLength = HC_SCHEMA_GET(packet->data, HC_PROTOCOL_HEADER, messageLength);
+    long protocolMessageType = HC_SCHEMA_GET(packet->data, HC_PROTOCOL_HEADER, messageType);
+    int overlayId = (int32_t)HC_SCHEMA_GET(packet->data, HC_PROTOCOL_HEADER, overlayId); // The hash is a signed int
+
+    // Now check that the overlay it's for is one we're in, running the message's protocol
+    hc_protocol_shell_t* protocol = hc_protocol_find(hypercast, overlayId);
+    if (protocol == NULL || protocolId != protocol->id) {
+        ESP_LOGE(TAG, "Protocol %ld not active in overlay %d", protocolId, overlayId);
+        return;
+    }
+    ESP_LOGI(TAG, "Protocol Packet Received for %s", protocol->ops->name);
+    protocol->ops->parse(protocol, packet, protocolMessageType, messageLength, hypercast);
 }
 
-bool hc_overlay_sender_trusted(hc_msg_overlay_t* msg, hypercast_t* hypercast) {
+int hc_protocol_lane(const hc_packet_t *packet) {
+    // Overlay messages are data, anything else is a protocol message that keeps the overlay going
+    if (packet->size > 0 && hc_load_bits(packet->data, 0, 4) == HC_PROTOCOL_OVERLAY_MESSAGE) {
+        return HC_BUFFER_LANE_DATA;
+    }
+    return HC_BUFFER_LANE_CONTROL;
+}
+
+bool hc_overlay_sender_trusted(uint32_t sourceLogicalAddress, hypercast_t* hypercast) {
     // This is determined by protocol
-    switch (((hc_protocol_shell_t*)hypercast->protocol)->id) {
-        case HC_PROTOCOL_SPT:
-            return spt_overlay_sender_trusted(msg, hypercast);
-        default:
-            return false;
+    // Overlay messages don't say which overlay they're in, so one is taken if any of our overlays trusts its source
+    for (int i = 0; i < hypercast->protocolCount; i++) {
+        if (hypercast->protocols[i]->ops->trusted(hypercast->protocols[i], sourceLogicalAddress, hypercast)) {
+            return true;
+        }
     }
-}
\ No newline at end of file
+    return false;
+}
@@ -0,0 +1,91 @@
+/*
+* Application side of sending, overlay messages built straight into send buffer slots (see hc_send.h)
+*/
+#include <string.h>
+
+#include "hc_send.h"
+#include "hc_fragment.h"
+#include "hc_aggregate.h"
+
+static const char* TAG = "HC_SEND";
+
+static void hc_send_start(hypercast_t* hypercast, hc_packet_t* packet) {
+    // Header first, then the route record starting with us, same as hc_msg_overlay_init_with_payload
+    // The payload extension goes last, so whatever writes it doesn't have to move anything
+    char source[HC_OVERLAY_HEADER_sourceLogicalAddress_BITS / 8];
+    hc_store_bits(source, 0, HC_OVERLAY_HEADER_sourceLogicalAddress_BITS, hypercast->senderTable->sourceAddressLogical);
+    hc_overlay_start_in_place(packet, hypercast->senderTable->sourceAddressLogical);
+    hc_overlay_append_extension_in_place(packet, HC_MSG_EXT_ROUTE_RECORD_TYPE, source, sizeof(source));
+    hc_overlay_append_sequence_in_place(packet, hypercast);
+}
+
+char* hc_send_reserve(hypercast_t* hypercast, hc_packet_t** packet) {
+    *packet = hc_buffer_reserve(hypercast->sendBuffer);
+    if (*packet == NULL) {
+        ESP_LOGE(TAG, "No send slot free");
+        return NULL;
+    }
+    return (*packet)->data + HC_SEND_PAYLOAD_OFFSET;
+}
+
+int hc_send_commit(hypercast_t* hypercast, hc_packet_t* packet, int length) {
+    if (length < 0 || length > HC_SEND_PAYLOAD_MAX) {
+        ESP_LOGE(TAG, "Payload of %d bytes doesn't fit a send slot, the most is %d", length, HC_SEND_PAYLOAD_MAX);
+        free_packet(packet);
+        return length < 0 ? -1 : HC_SEND_TOO_BIG;
+    }
+    // The payload is already sitting where the extension's data goes, so only the headers are written
+    hc_send_start(hypercast, packet);
+    int lengthSize = length > HC_OVERLAY_SHORT_LENGTH_MAX ? 2 : 1;
+    if (lengthSize == 2) {
+        // The long length takes a byte more, the overhead leaves room for it
+        memmove(packet->data + HC_SEND_PAYLOAD_OFFSET + 1, packet->data + HC_SEND_PAYLOAD_OFFSET, length);
+    }
+    hc_overlay_chain_extension_in_place(packet, HC_MSG_EXT_PAYLOAD_TYPE, length, lengthSize);
+    packet->size += length;
+    // The buffer frees the packet if it can't take it
+    return hc_buffer_commit(hypercast->sendBuffer, packet, HC_BUFFER_LANE_DATA) > 0 ? 1 : -1;
+}
+
+int hc_send(hypercast_t* hypercast, const char* data, int length, int flags) {
+    // Checked before anything else, aggregated or not, so whatever the size it's refused the same way
+    if (length > HC_SEND_SIZE_MAX) {
+        ESP_LOGE(TAG, "Payload of %d bytes is too big to send, the most is %d", length, HC_SEND_SIZE_MAX);
+        return HC_SEND_TOO_BIG;
+    }
+    if (flags & HC_SEND_AGGREGATE) {
+        return hc_aggregate_send(hypercast, data, length);
+    }
+    if (length > HC_SEND_PAYLOAD_MAX) {
+        return hc_fragment_send(hypercast, data, length) > 0 ? 1 : -1;
+    }
+    // One copy, straight into the slot it goes out from
+    hc_packet_t* packet;
+    char* payload = hc_send_reserve(hypercast, &packet);
+    if (payload == NULL) { return -1; }
+    memcpy(payload, data, length);
+    return hc_send_commit(hypercast, packet, length);
+}
+
+int hc_send_buffer(hypercast_t* hypercast, const char* data, int length, void (*release)(void*), void* context) {
+    if (length < 0 || length > HC_SEND_PAYLOAD_MAX) {
+        ESP_LOGE(TAG, "Payload of %d bytes is too big to send from its own buffer, the most is %d", length, HC_SEND_PAYLOAD_MAX);
+        if (release != NULL) { release(context); }
+        return length < 0 ? -1 : HC_SEND_TOO_BIG;
+    }
+    hc_packet_t* packet = hc_buffer_reserve(hypercast->sendBuffer);
+    if (packet == NULL) {
+        ESP_LOGE(TAG, "No send slot free");
+        if (release != NULL) { release(context); }
+        return -1;
+    }
+    // The slot only holds the headers, the payload goes out from where it is as a second segment
+    hc_send_start(hypercast, packet);
+    hc_overlay_chain_extension_in_place(packet, HC_MSG_EXT_PAYLOAD_TYPE, length, length > HC_OVERLAY_SHORT_LENGTH_MAX ? 2 : 1);
+    hc_packet_add_segment(packet, packet->data, packet->size);
+    hc_packet_add_segment(packet, data, length);
+    packet->release = release;
+    packet->releaseContext = context;
+    // From here free_packet does the release, whether it's sent or dropped
+    return hc_buffer_commit(hypercast->sendBuffer, packet, HC_BUFFER_LANE_DATA) > 0 ? 1 : -1;
+}
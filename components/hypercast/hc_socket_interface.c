@@ -15,19 +15,27 @@
 #include "hypercast.h"
 #include "hc_buffer.h"
 #include "hc_engine.h"
-#include "hc_lib.h"
+#include "hc_protocols.h"
+#include "hc_clock.h"
 
 #define MULTICAST_IPV4_ADDR "224.228.19.78"
 #define MC_PORT 9472
 
 #define SOCKET_SEND_DELAY 0.01
 #define SOCKET_RECV_DELAY 0.01
+// Longest the send handler sleeps on an empty send buffer before checking again (ms)
+#define SOCKET_SEND_IDLE_WAIT 1000
+// Most packets the send handler takes off the send buffer at once
+#define SOCKET_SEND_BATCH_SIZE 8
 
 // Number of messages received / second (Should be less than than 1000/SOCKET_RECV_DELAY)
 #define FLUSH_MIN_MESSAGE_RATE 4
 #define FLUSH_MESSAGE_INTERVAL 50
 #define FLUSH_MAX_PACKETS 25
 
+// How long the receive handler backs off when the receive buffer has no free slot (ms)
+#define SOCKET_RECV_FULL_DELAY 10
+
 static const char* TAG = "HC_SOCKET_INTERFACE";
 
 void hc_socket_interface_send_handler(void *pvParameters) {
@@ -40,17 +48,17 @@ void hc_socket_interface_send_handler(void *pvParameters) {
     // int mc_port = 9472;
 
     // Then some re-usables
+    hc_packet_t *packets[SOCKET_SEND_BATCH_SIZE];
     hc_packet_t *packet;
+    int count;
 
     while (1) {
-        // First read the buffer for data to send
-        packet = NULL; // clean up
-        // Now read
-        packet = hc_pop_buffer(hypercast->sendBuffer);
-        // If no data, pause then try again
-        if (packet == NULL) { vTaskDelay(500 / portTICK_PERIOD_MS); continue; }
+        // First read the buffer for data to send, taking everything that's there (up to a batch)
+        count = hc_pop_buffer_batch_wait(hypercast->sendBuffer, packets, SOCKET_SEND_BATCH_SIZE, SOCKET_SEND_IDLE_WAIT);
+        // If no data, try again (the wait wakes as soon as anything is pushed)
+        if (count == 0) { continue; }
 
-        ESP_LOGI(TAG, "Sending packet, send buffer length: %d", hypercast->sendBuffer->current_size);
+        ESP_LOGI(TAG, "Sending %d packets, send buffer length: %d", count, hc_buffer_size(hypercast->sendBuffer));
 
         // Now it's time to send!
         // struct sockaddr_in to;
@@ -65,7 +73,7 @@ void hc_socket_interface_send_handler(void *pvParameters) {
         // We know this inet_aton will pass because we did it above already
         inet_aton(MULTICAST_IPV4_ADDR, &sdestv4.sin_addr.s_addr);
 
-        // First setup the target addr
+        // First setup the target addr, once for the whole batch
         struct addrinfo hints = {
             .ai_flags = AI_PASSIVE,
             .ai_socktype = SOCK_DGRAM,
@@ -81,18 +89,39 @@ void hc_socket_interface_send_handler(void *pvParameters) {
 
         ((struct sockaddr_in *)faddr->ai_addr)->sin_port = htons(MC_PORT);
         inet_ntoa_r(((struct sockaddr_in *)faddr->ai_addr)->sin_addr, addrbuf, sizeof(addrbuf)-1);
-        ESP_LOGI(TAG, "Sending %d bytes to IPV4 multicast address %s:%d...", packet->size, addrbuf, MC_PORT);
-
 
-        int res = sendto(sock, packet->data, packet->size, 0, faddr->ai_addr, faddr->ai_addrlen);
-        // Now that we've sent the packet, we can free it
-        // free_packet(packet); // Clearing this makes it impossible for the sendto to finish send async
-
-        if (res < 0) {
-            ESP_LOGE(TAG, "Error sending data: %d", res);
-            continue;
+        for (int i = 0; i < count; i++) {
+            packet = packets[i];
+            ESP_LOGI(TAG, "Sending %d bytes to IPV4 multicast address %s:%d...", hc_packet_wire_size(packet), addrbuf, MC_PORT);
+            // A segmented packet goes out as its segments (gathered by the stack into one datagram), anything else is just the slot
+            struct iovec segments[HC_PACKET_MAX_SEGMENTS];
+            int segmentCount = 1;
+            segments[0].iov_base = packet->data;
+            segments[0].iov_len = packet->size;
+            if (packet->segmentCount > 0) {
+                segmentCount = packet->segmentCount;
+                for (int j = 0; j < segmentCount; j++) {
+                    segments[j].iov_base = (void *)packet->segments[j].data;
+                    segments[j].iov_len = packet->segments[j].size;
+                }
+            }
+            struct msghdr message = {
+                .msg_name = faddr->ai_addr,
+                .msg_namelen = faddr->ai_addrlen,
+                .msg_iov = segments,
+                .msg_iovlen = segmentCount,
+            };
+            int res = sendmsg(sock, &message, 0);
+            // sendmsg copies the datagram into the stack before returning, so the slot (and segments) can go back
+            free_packet(packet);
+
+            if (res < 0) {
+                ESP_LOGE(TAG, "Error sending data: %d", res);
+                continue;
+            }
+            ESP_LOGD(TAG, "Sent %d bytes to %s", res, "SOME ADDRESS");
         }
-        ESP_LOGD(TAG, "Sent %d bytes to %s", res, "SOME ADDRESS");
+        freeaddrinfo(faddr);
 
         // This thread sleeps now to avoid flooding the port or overwriting its vibes
         vTaskDelay(SOCKET_SEND_DELAY / portTICK_PERIOD_MS);
@@ -121,19 +150,21 @@ void hc_socket_interface_recv_handler(void *pvParameters) {
 
     // Now some flush management
     int messageCounter = 0;
-    int receiveStartTime = get_epoch();
+    uint64_t receiveStartTime = hc_clock_monotonic_ms();
+
+    // The slot we're receiving into, it's only handed to the buffer once we know we want the packet
+    hc_packet_t *packet = NULL;
 
     // Now start the receive event loop
     while (1) {
         ESP_LOGI(TAG, "Waiting for data...");
 
-        static char recvbuf[1024];
         char raddr_name[32] = { 0 };
 
         // Before we look to receive a message, let's manage flush
         if (messageCounter >= FLUSH_MESSAGE_INTERVAL) {
-            int currentTime = get_epoch();
-            int timeDiff = currentTime - receiveStartTime; // In seconds
+            uint64_t currentTime = hc_clock_monotonic_ms();
+            float timeDiff = (currentTime - receiveStartTime) / 1000.0f; // In seconds
             if ((float)messageCounter/timeDiff > FLUSH_MIN_MESSAGE_RATE) {
                 ESP_LOGI(TAG, "Flushing, msg/s is %f", (float)messageCounter/timeDiff);
 
@@ -146,9 +177,11 @@ void hc_socket_interface_recv_handler(void *pvParameters) {
                 FD_ZERO(&rfds);
                 FD_SET(sock, &rfds);
                 int flushCounter = 0;
+                // UDP drops whatever doesn't fit in the receive, so a single byte is enough to discard a datagram
+                char flushbuf[1];
                 // do the flush
                 while (select(sock+1, &rfds, NULL, NULL, &tv) > 0) {
-                    recvfrom(sock, recvbuf, sizeof(recvbuf), 0, NULL, NULL);
+                    recvfrom(sock, flushbuf, sizeof(flushbuf), 0, NULL, NULL);
                     flushCounter++;
                     if (flushCounter > FLUSH_MAX_PACKETS) {
                         ESP_LOGI(TAG, "Flush complete, %d packets flushed", flushCounter);
@@ -162,16 +195,32 @@ void hc_socket_interface_recv_handler(void *pvParameters) {
             receiveStartTime = currentTime;
         }
 
+        // Take a free slot from the receive buffer to receive straight into
+        // (we keep the one we have if the last packet was ignored)
+        if (packet == NULL) {
+            packet = hc_buffer_reserve(hypercast->receiveBuffer);
+            if (packet == NULL) {
+                // Leave the datagrams queued in the socket until the engine catches up
+                vTaskDelay(SOCKET_RECV_FULL_DELAY / portTICK_PERIOD_MS);
+                continue;
+            }
+        }
+
         struct sockaddr_storage raddr; // Large enough for both IPv4 or IPv6
         socklen_t socklen = sizeof(raddr);
         ESP_LOGI(TAG, "Receiving packet");
-        int len = recvfrom(sock, recvbuf, sizeof(recvbuf)-1, 0,
+        int len = recvfrom(sock, packet->data, HC_BUFFER_DATA_MAX, 0,
                             (struct sockaddr *)&raddr, &socklen);
         ESP_LOGI(TAG, "Packet Received");
         if (len < 0) {
             ESP_LOGE(TAG, "multicast recvfrom failed: errno %d", errno);
+            free_packet(packet);
             return; // This handler shouldn't return
         }
+        if (len == 0) {
+            ESP_LOGI(TAG, "Received empty packet, ignoring");
+            continue;
+        }
         if (raddr.ss_family == AF_INET) {
             inet_ntoa_r(((struct sockaddr_in *)&raddr)->sin_addr,
                         raddr_name, sizeof(raddr_name)-1);
@@ -183,9 +232,12 @@ void hc_socket_interface_recv_handler(void *pvParameters) {
             continue;
         }
         ESP_LOGI(TAG, "received %d bytes from %s:", len, raddr_name);
-        // Then push the recvbuf into the hypercast buffer
-        hc_push_buffer(hypercast->receiveBuffer, recvbuf, len);
-        ESP_LOGI(TAG, "Unprocessed Buffer Length: %d", hypercast->receiveBuffer->current_size);
+        // Then hand the slot to the engine, the data is already where it needs to be
+        // Protocol messages go in the control lane so they never wait behind data
+        packet->size = len;
+        hc_buffer_commit(hypercast->receiveBuffer, packet, hc_protocol_lane(packet));
+        packet = NULL;
+        ESP_LOGI(TAG, "Unprocessed Buffer Length: %d", hc_buffer_size(hypercast->receiveBuffer));
 
         // This thread sleeps now to avoid flooding the port or overwriting its vibes
         vTaskDelay(SOCKET_RECV_DELAY / portTICK_PERIOD_MS);
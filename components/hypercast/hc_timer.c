@@ -0,0 +1,116 @@
+/*
+* Deadlines for the engine, kept in a min-heap (see hc_timer.h)
+*/
+#include "hc_timer.h"
+#include "hc_clock.h"
+
+static const char* TAG = "HC_TIMER";
+
+// Deadlines wrap with the clock, so which is sooner is decided by the signed difference
+static inline bool hc_timer_before(const hc_timer_t* a, const hc_timer_t* b) {
+    return (int32_t)(a->deadline - b->deadline) < 0;
+}
+
+static inline void hc_timer_place(hc_timer_queue_t* queue, hc_timer_t* timer, int index) {
+    queue->heap[index] = timer;
+    timer->index = index;
+}
+
+static void hc_timer_sift_up(hc_timer_queue_t* queue, int index) {
+    hc_timer_t* timer = queue->heap[index];
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!hc_timer_before(timer, queue->heap[parent])) { break; }
+        hc_timer_place(queue, queue->heap[parent], index);
+        index = parent;
+    }
+    hc_timer_place(queue, timer, index);
+}
+
+static void hc_timer_sift_down(hc_timer_queue_t* queue, int index) {
+    hc_timer_t* timer = queue->heap[index];
+    while (1) {
+        int child = index * 2 + 1;
+        if (child >= queue->size) { break; }
+        if (child + 1 < queue->size && hc_timer_before(queue->heap[child + 1], queue->heap[child])) { child++; }
+        if (!hc_timer_before(queue->heap[child], timer)) { break; }
+        hc_timer_place(queue, queue->heap[child], index);
+        index = child;
+    }
+    hc_timer_place(queue, timer, index);
+}
+
+static void hc_timer_remove(hc_timer_queue_t* queue, hc_timer_t* timer) {
+    int index = timer->index;
+    timer->index = HC_TIMER_IDLE;
+    queue->size--;
+    if (index == queue->size) { return; }
+    // The last one fills the hole, then goes whichever way it needs to
+    hc_timer_t* moved = queue->heap[queue->size];
+    hc_timer_place(queue, moved, index);
+    hc_timer_sift_down(queue, index);
+    hc_timer_sift_up(queue, moved->index);
+}
+
+uint32_t hc_timer_now() {
+    return (uint32_t)hc_clock_monotonic_ms();
+}
+
+void hc_timer_queue_init(hc_timer_queue_t* queue) {
+    queue->size = 0;
+    queue->fired = 0;
+}
+
+void hc_timer_init(hc_timer_t* timer, void (*callback)(hypercast_t*, void*), void* context) {
+    timer->deadline = 0;
+    timer->index = HC_TIMER_IDLE;
+    timer->callback = callback;
+    timer->context = context;
+}
+
+int hc_timer_schedule(hypercast_t* hypercast, hc_timer_t* timer, int delayMs) {
+    hc_timer_queue_t* queue = hypercast->timers;
+    if (delayMs < 0) { delayMs = 0; }
+    timer->deadline = hc_timer_now() + delayMs;
+    if (timer->index == HC_TIMER_IDLE) {
+        if (queue->size >= HC_TIMER_MAX) {
+            ESP_LOGE(TAG, "Timer heap full, the most pending is %d", HC_TIMER_MAX);
+            return -1;
+        }
+        hc_timer_place(queue, timer, queue->size++);
+        hc_timer_sift_up(queue, timer->index);
+    } else {
+        // Already pending, it only has to find its new place
+        hc_timer_sift_down(queue, timer->index);
+        hc_timer_sift_up(queue, timer->index);
+    }
+    return 1;
+}
+
+void hc_timer_cancel(hypercast_t* hypercast, hc_timer_t* timer) {
+    if (timer->index == HC_TIMER_IDLE) { return; }
+    hc_timer_remove(hypercast->timers, timer);
+}
+
+bool hc_timer_pending(const hc_timer_t* timer) {
+    return timer->index != HC_TIMER_IDLE;
+}
+
+int hc_timer_run(hypercast_t* hypercast, int maxWaitMs) {
+    hc_timer_queue_t* queue = hypercast->timers;
+    uint32_t now = hc_timer_now();
+    // Only what was pending when we started can fire, so a callback that schedules itself for right now
+    // waits for the next run instead of spinning here
+    int budget = queue->size;
+    hc_timer_t* timer;
+    while (budget-- > 0 && queue->size > 0 && (int32_t)(queue->heap[0]->deadline - now) <= 0) {
+        timer = queue->heap[0];
+        hc_timer_remove(queue, timer);
+        queue->fired++;
+        timer->callback(hypercast, timer->context);
+    }
+    if (queue->size == 0) { return maxWaitMs; }
+    int32_t waitMs = (int32_t)(queue->heap[0]->deadline - hc_timer_now());
+    if (waitMs < 0) { return 0; }
+    return waitMs < maxWaitMs ? (int)waitMs : maxWaitMs;
+}
@@ -8,6 +8,10 @@
 #include "hc_socket_interface.h"
 #include "hc_protocols.h"
 #include "hc_measure.h"
+#include "hc_fragment.h"
+#include "hc_aggregate.h"
+#include "hc_delivery.h"
+#include "hc_timer.h"
 
 #include "spt.h"
 
@@ -23,13 +27,31 @@ void hc_init(void *pvParameters) {
     hypercast = malloc(sizeof(hypercast_t));
 
     // Install heap-allocated pointers
-    hypercast->receiveBuffer = malloc(sizeof(hc_buffer_t));
-    hypercast->sendBuffer = malloc(sizeof(hc_buffer_t));
+    // The buffers are aligned so their producer and consumer indices each get a cache line
+    hypercast->receiveBuffer = hc_buffer_aligned_alloc(sizeof(hc_buffer_t));
+    hypercast->sendBuffer = hc_buffer_aligned_alloc(sizeof(hc_buffer_t));
+    hypercast->dedupCache = malloc(sizeof(hc_dedup_cache_t));
+    hypercast->fragments = malloc(sizeof(hc_fragment_state_t));
+    hypercast->aggregator = malloc(sizeof(hc_aggregator_t));
+    hypercast->timers = malloc(sizeof(hc_timer_queue_t));
 
     // Allocate memory & set initial values
     hypercast->socket = sock;
-    hc_allocate_buffer(hypercast->receiveBuffer, HC_BUFFER_SIZE);
-    hc_allocate_buffer(hypercast->sendBuffer, HC_BUFFER_SIZE);
+    hc_packet_pool_init(HC_PACKET_POOL_SIZE);
+    // Receive is only pushed by the receive handler and popped by the engine, so it doesn't need a lock
+    // Send is pushed by the engine and by any application task calling hc_send, so it does
+    // Both are split into a control lane that always goes first, and a data lane
+    hc_allocate_buffer_lanes(hypercast->receiveBuffer, HC_BUFFER_CONTROL_LANE_SIZE, HC_BUFFER_DATA_LANE_SIZE, HC_BUFFER_MODE_SPSC);
+    hc_allocate_buffer_lanes(hypercast->sendBuffer, HC_BUFFER_CONTROL_LANE_SIZE, HC_BUFFER_DATA_LANE_SIZE, HC_BUFFER_MODE_LOCKED);
+    hc_dedup_init(hypercast->dedupCache);
+    memset(&hypercast->filterStats, 0, sizeof(hc_filter_stats_t));
+    memset(&hypercast->forwardStats, 0, sizeof(hc_forward_stats_t));
+    hc_fragment_init(hypercast->fragments);
+    hc_aggregate_init(hypercast->aggregator);
+    hypercast->delivery = NULL;
+    hypercast->workers = NULL;
+    // Protocols schedule their first events as they're installed, so the timers go first
+    hc_timer_queue_init(hypercast->timers);
     hc_install_config(hypercast);
 
     // Run send receive handlers
@@ -37,6 +59,24 @@ void hc_init(void *pvParameters) {
     xTaskCreate(hc_socket_interface_send_handler, "HYPERCAST_send_handler", 8192, hypercast, 5, NULL);
     ESP_LOGI(TAG, "Handlers Started");
 
+    // Application callbacks get a task of their own, so a slow one can't hold up forwarding
+    if (HC_DELIVERY_ASYNC == 1) {
+        hc_delivery_config_t deliveryConfig = {
+            .depth = HC_DELIVERY_MAX_DEPTH,
+            // Only the engine pushes unless it has workers, which all deliver what their sources sent
+            .mode = HC_ENGINE_WORKERS > 0 ? HC_BUFFER_MODE_LOCKED : HC_BUFFER_MODE_SPSC,
+            .overflowPolicy = HC_BUFFER_OVERFLOW_DROP_OLDEST, // A stale reading is worth less than a fresh one
+            .blockTimeoutMs = 0,
+            .batchCallback = NULL,
+        };
+        hc_delivery_start(hypercast, &deliveryConfig);
+    }
+
+    // Overlay messages get spread over a worker per core, the engine keeps the protocols to itself
+    if (HC_ENGINE_WORKERS > 0 && hc_engine_start_workers(hypercast, HC_ENGINE_WORKERS) < 0) {
+        ESP_LOGW(TAG, "Workers didn't start, the engine handles overlay messages on its own");
+    }
+
     // Now check if we're taking measurements at regular intervals as well
     if (SEND_MEASURES == 1) {
         xTaskCreate(hc_measure_handler, "HYPERCAST_measure", 8192, hypercast, 5, NULL);
@@ -62,6 +102,8 @@ void hc_install_config(hypercast_t *hypercast) {
     hypercast->senderTable = malloc(sizeof(hc_sender_table_t));
     hypercast->senderTable->size = 1;
     hypercast->senderTable->sourceAddressLogical = sourceLogicalGenerated;
+    // Starting somewhere random means that after a restart our old numbers won't still be in anyone's dedup cache
+    atomic_init(&hypercast->senderTable->nextSequence, esp_random());
     // Setup the table
     hypercast->senderTable->entries = malloc(sizeof(hc_sender_entry_t*)*hypercast->senderTable->size);
     // Setup the first entry
@@ -77,8 +119,10 @@ void hc_install_config(hypercast_t *hypercast) {
     hypercast->senderTable->entries[0]->port = 9472;
 
     // Usually we'd read config here, but for now just set the default values
-    hypercast->protocol = resolve_protocol_to_install(HC_PROTOCOL_SPT, hypercast->senderTable->sourceAddressLogical); // usually config would feed in here instead
-    ESP_LOGI(TAG, "Protocol: %d", (int)((hc_protocol_shell_t*)(hypercast->protocol))->id);
+    // More overlays would just be more installs, each with its own overlay hash
+    hypercast->protocolCount = 0;
+    hc_protocol_install(hypercast, HC_PROTOCOL_SPT, set_overlay_hash()); // usually config would feed in here instead
+    ESP_LOGI(TAG, "Protocol: %d", hypercast->protocols[0]->id);
 
     // Finish by installing a callback
     hypercast->callback = hc_callback_handler;
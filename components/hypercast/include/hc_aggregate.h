@@ -0,0 +1,44 @@
+#ifndef __HC_AGGREGATE_H__
+#define __HC_AGGREGATE_H__
+
+#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+
+#include <pthread.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "hc_overlay.h"
+
+/*
+* Lots of small application payloads are expensive one datagram each, so small ones are packed together:
+* each becomes its own payload extension in one overlay message, built straight into a pool packet.
+* The message goes out once the next payload won't fit, or once the first one in it has waited long enough.
+* Receivers hand each payload extension to the callback on its own, so nobody upstream needs to know.
+* Application tasks fill the message while the engine task sends it on the deadline, so it sits behind a lock.
+*/
+
+#define HC_AGGREGATE_MAX_DELAY_MS 20 // Longest a payload waits for company before it goes out anyway
+#define HC_AGGREGATE_MAX_PAYLOAD_SIZE 0xFF // Anything bigger goes out on its own (and always fits a one byte length)
+#define HC_AGGREGATE_MAX_PAYLOADS (HC_OVERLAY_MAX_EXTENSIONS - 1 - (HC_OVERLAY_SEQUENCE_EXT_BYTES > 0)) // Leaves the route record and sequence their extensions
+// Biggest an aggregated message gets before the sequence and the route record, which has to be able to grow to its biggest at any hop
+#define HC_AGGREGATE_MESSAGE_LIMIT (HC_BUFFER_DATA_MAX - HC_OVERLAY_SEQUENCE_EXT_BYTES - HC_SCHEMA_BYTES(HC_OVERLAY_EXT_HEADER) - HC_OVERLAY_ROUTE_RECORD_MAX_BYTES)
+
+typedef struct hc_aggregator {
+    pthread_mutex_t lock; // Held for everything below
+    hc_packet_t *packet; // The message being filled, NULL when nothing is waiting
+    int payloads; // In the message being filled
+    TickType_t opened; // When its first payload went in
+    uint32_t messages; // Aggregated messages sent
+    uint32_t payloadsSent;
+    uint32_t flushedFull; // Sent because the next payload didn't fit
+    uint32_t flushedDeadline; // Sent because HC_AGGREGATE_MAX_DELAY_MS ran out
+} hc_aggregator_t;
+
+void hc_aggregate_init(hc_aggregator_t*);
+// Queues a payload to go out with whatever else turns up in the next HC_AGGREGATE_MAX_DELAY_MS, from any task. Returns 1, or -1
+int hc_aggregate_send(hypercast_t*, const char*, int);
+// Sends whatever is waiting now, returns 1 if a message went out, 0 if there was nothing, -1 on failure
+int hc_aggregate_flush(hypercast_t*);
+// Sends the waiting message if its time is up, and returns how long (ms, at most the one given) until it will be
+int hc_aggregate_poll(hypercast_t*, int);
+
+#endif
@@ -4,38 +4,233 @@
 #define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 
 // First do our definitions
-#define HC_BUFFER_DATA_MAX 1024
+#define HC_BUFFER_DATA_MAX 1472 // A full UDP payload on a 1500 byte MTU
+#define HC_BUFFER_CACHE_LINE_SIZE 64
+#define HC_PACKET_POOL_MAX_SLOTS 0xFFFE // Slot indices are 16 bit, 0xFFFF marks the end of the free list
+#define HC_PACKET_NOT_POOLED -1
+#define HC_PACKET_MAX_SEGMENTS 8
+
+// Buffer modes
+#define HC_BUFFER_MODE_SPSC 0 // Lock-free, exactly one pushing task and one popping task
+#define HC_BUFFER_MODE_LOCKED 1 // Mutex guarded, any number of pushing or popping tasks
+
+// Buffer lanes, popped in strict priority order (lower lane first)
+#define HC_BUFFER_LANE_CONTROL 0 // Protocol messages, these keep the overlay alive
+#define HC_BUFFER_LANE_DATA 1 // Overlay messages
+#define HC_BUFFER_LANES 2
+
+// What a push does when its lane is full
+#define HC_BUFFER_OVERFLOW_DROP_NEWEST 0 // The pushed packet is dropped (default)
+#define HC_BUFFER_OVERFLOW_DROP_OLDEST 1 // The oldest queued packet is dropped to make room
+#define HC_BUFFER_OVERFLOW_BLOCK 2 // The pusher waits up to the buffer's block timeout for room
+
+// Push results, anything > 0 means the packet is in the buffer
+#define HC_BUFFER_PUSH_OK 1
+#define HC_BUFFER_PUSH_EVICTED 2 // Queued, but the oldest packet was dropped for it
+#define HC_BUFFER_PUSH_FULL -1 // Dropped, the lane was full
+#define HC_BUFFER_PUSH_TIMEOUT -2 // Dropped, no room opened up before the block timeout
+#define HC_BUFFER_PUSH_INVALID -3 // Dropped, bad lane or packet
 
 // Define the structs
+typedef struct hc_packet_segment {
+    const char *data;
+    int size;
+} hc_packet_segment_t;
+
 typedef struct hc_packet {
     char *data;
     int size;
+    int slot; // Index in the packet pool, or HC_PACKET_NOT_POOLED for heap packets
+    // Scatter-gather: a packet with segments goes on the wire as the segments in order, instead of data[0..size)
+    // They can point into data (the parts we encoded) or at memory somebody else owns, like a payload we never
+    // copied, which release (if set) hands back once the packet is freed
+    hc_packet_segment_t segments[HC_PACKET_MAX_SEGMENTS];
+    int segmentCount;
+    void (*release)(void *);
+    void *releaseContext;
 } hc_packet_t;
 
-typedef struct hc_buffer {
-    hc_packet_t **data;
-    int current_size;
+typedef struct hc_packet_pool_stats {
+    int slots;
+    int inUse;
+    int peakInUse;
+    unsigned int acquired;
+    unsigned int exhausted; // Acquires that found no free slot
+} hc_packet_pool_stats_t;
+
+typedef struct hc_buffer_lane {
+    // The consumer only writes head and the producer only writes tail, so each gets its own cache line
+    // Both count up forever, the slot is the count % capacity and the size is tail - head
+    _Alignas(HC_BUFFER_CACHE_LINE_SIZE) atomic_uint head;
+    _Alignas(HC_BUFFER_CACHE_LINE_SIZE) atomic_uint tail;
+    // Counters are only written by the producer too, so they share its line
+    atomic_uint enqueued;
+    atomic_uint dropped; // Whichever packet the overflow policy gave up on
+    atomic_uint peakDepth;
+    // Everything below is read-only once the buffer is allocated
+    _Alignas(HC_BUFFER_CACHE_LINE_SIZE) hc_packet_t **data;
+    unsigned int capacity; // Depth limit of the lane, 0 means the lane is unused
+} hc_buffer_lane_t;
+
+typedef struct hc_buffer_lane_stats {
     int capacity;
-    int front;
-    pthread_mutex_t buffer_lock;
+    int depth;
+    int peakDepth;
+    unsigned int enqueued;
+    unsigned int dropped; // Packets lost to the overflow policy
+} hc_buffer_lane_stats_t;
+
+typedef struct hc_buffer {
+    hc_buffer_lane_t lanes[HC_BUFFER_LANES];
+    int mode;
+    int overflowPolicy;
+    int blockTimeoutMs; // Only used by HC_BUFFER_OVERFLOW_BLOCK
+    pthread_mutex_t buffer_lock; // Only taken in HC_BUFFER_MODE_LOCKED
+    SemaphoreHandle_t packetReady; // Given on every push so a waiting consumer wakes immediately
+    SemaphoreHandle_t spaceReady; // Given on every pop when blocking pushers may be waiting
 } hc_buffer_t;
 
 // Now shape out the functions
-void hc_allocate_buffer(hc_buffer_t *buffer, int length);
-hc_packet_t* hc_pop_buffer(hc_buffer_t *buffer);
-void hc_push_buffer(hc_buffer_t *buffer, char *data, int packet_length);
-void free_packet(hc_packet_t* packet);
+void hc_allocate_buffer(hc_buffer_t *buffer, int length); // Mutex guarded (multi-producer safe), data lane only
+void hc_allocate_buffer_mode(hc_buffer_t *buffer, int length, int mode); // Data lane only
+void hc_allocate_buffer_lanes(hc_buffer_t *buffer, int controlLength, int dataLength, int mode);
+void hc_free_buffer(hc_buffer_t *buffer); // Undoes hc_allocate_buffer*, any packets still in it are lost. Not the hc_buffer_t itself
+void hc_buffer_set_overflow_policy(hc_buffer_t *buffer, int policy, int blockTimeoutMs); // Set before the buffer is shared
+// The lanes' head and tail only get cache lines of their own if the buffer starts on one, and malloc doesn't promise that.
+// Anything that is or holds an hc_buffer_t comes from here, and goes back with hc_buffer_aligned_free
+void* hc_buffer_aligned_alloc(size_t size); // NULL on failure
+void hc_buffer_aligned_free(void *memory);
+hc_packet_t* hc_pop_buffer(hc_buffer_t *buffer); // Control lane first, then data
+hc_packet_t* hc_pop_buffer_wait(hc_buffer_t *buffer, int timeoutMs); // Blocks until a packet arrives or the timeout (ms) passes
+// Batches move up to max packets per lock or index update, in the same order single pops would
+int hc_pop_buffer_batch(hc_buffer_t *buffer, hc_packet_t **packets, int max); // returns number of packets popped
+int hc_pop_buffer_batch_wait(hc_buffer_t *buffer, hc_packet_t **packets, int max, int timeoutMs);
+// Pushes return an HC_BUFFER_PUSH_ result, and always take ownership of the packet
+int hc_push_buffer(hc_buffer_t *buffer, char *data, int packet_length); // Copies into the data lane
+int hc_push_buffer_packet(hc_buffer_t *buffer, hc_packet_t *packet); // Data lane
+int hc_push_buffer_lane(hc_buffer_t *buffer, hc_packet_t *packet, int lane);
+int hc_push_buffer_batch(hc_buffer_t *buffer, hc_packet_t **packets, int count, int lane); // returns number of packets queued
+// Zero-copy producer side: reserve a slot, fill packet->data and packet->size, then commit it to a lane
+hc_packet_t* hc_buffer_reserve(hc_buffer_t *buffer); // NULL if every lane is full (and would drop it) or the pool is exhausted
+int hc_buffer_commit(hc_buffer_t *buffer, hc_packet_t *packet, int lane); // Same result as a push
+int hc_buffer_size(hc_buffer_t *buffer); // All lanes together
+int hc_buffer_lane_size(hc_buffer_t *buffer, int lane);
+void hc_buffer_get_lane_stats(hc_buffer_t *buffer, int lane, hc_buffer_lane_stats_t *stats);
+
+// Packet pool
+// Every packet that moves through a buffer comes from one preallocated pool of HC_BUFFER_DATA_MAX slots
+int hc_packet_pool_init(int slots); // returns result (success = 1, failure = -1)
+hc_packet_t* hc_packet_acquire(); // NULL when the pool is exhausted
+void hc_packet_pool_get_stats(hc_packet_pool_stats_t*);
+void free_packet(hc_packet_t* packet); // Returns pooled packets to the pool, frees heap packets, releases any segments
+int hc_packet_add_segment(hc_packet_t* packet, const char *data, int size); // returns result (success = 1, failure = -1)
+int hc_packet_wire_size(const hc_packet_t* packet); // Bytes the packet puts on the wire, segments and all
 
 // Manage bytes IN
-hc_packet_t* packet_snip_to_bytes(hc_packet_t*, int, int);
-long long int packet_to_int(hc_packet_t*);
+// A reader walks a packet without allocating or modifying it. Reading past the end sets
+// error and returns 0 from then on, so a parser can read a whole layout and check once at the end
+typedef struct hc_reader {
+    const char *data;
+    int size; // In bytes
+    int bitOffset; // Position of the next read
+    int error; // Sticky, set once any read or seek went out of bounds
+} hc_reader_t;
+
+void hc_reader_init(hc_reader_t*, const hc_packet_t*);
+uint64_t hc_read_bits(hc_reader_t*, int); // reads 1-64 bits big-endian and advances
+int hc_read_bytes(hc_reader_t*, char*, int); // copies byte-aligned data out, returns result (success = 1, failure = -1)
+const char* hc_read_view(hc_reader_t*, int); // returns a pointer to the next n byte-aligned bytes in the packet, NULL on failure
+void hc_reader_seek(hc_reader_t*, int); // absolute bit offset
+void hc_reader_skip(hc_reader_t*, int); // relative, in bits
+int hc_reader_remaining_bits(hc_reader_t*);
+
+// Unchecked big-endian load of 1-64 bits at any bit offset, the caller guarantees bounds
+static inline uint64_t hc_load_bits(const char *data, int bitOffset, int lengthBits) {
+    const uint8_t *bytes = (const uint8_t *)data + (bitOffset >> 3);
+    // Byte-aligned whole bytes are the common case (everything but the first header nibbles)
+    if ((bitOffset & 7) == 0 && (lengthBits & 7) == 0) {
+        switch (lengthBits) {
+            case 8:
+                return bytes[0];
+            case 16:
+                return ((uint64_t)bytes[0] << 8) | bytes[1];
+            case 32:
+                return ((uint64_t)bytes[0] << 24) | ((uint64_t)bytes[1] << 16) | ((uint64_t)bytes[2] << 8) | bytes[3];
+            default: {
+                uint64_t value = 0;
+                for (int i = 0; i < (lengthBits >> 3); i++) {
+                    value = (value << 8) | bytes[i];
+                }
+                return value;
+            }
+        }
+    }
+    // Otherwise take what we need from each byte the field touches
+    uint64_t value = 0;
+    int remainingBits = lengthBits;
+    int currentBit = bitOffset & 7;
+    while (remainingBits > 0) {
+        int bitsInByte = 8 - currentBit;
+        int take = bitsInByte < remainingBits ? bitsInByte : remainingBits;
+        uint8_t chunk = (*bytes >> (bitsInByte - take)) & ((1 << take) - 1);
+        value = (value << take) | chunk;
+        remainingBits -= take;
+        currentBit = 0;
+        bytes++;
+    }
+    return value;
+}
 
 // Manage bytes OUT
-int write_bytes(char*, long long d, int, int, int);
-int write_chars_to_bytes(char*, char*, int, int, int);
+// A writer fills a byte array front to back and keeps track of how much it has encoded.
+// Like the reader, overrunning the capacity sets a sticky error instead of writing
+typedef struct hc_writer {
+    char *data;
+    int capacity; // In bytes
+    int bitOffset; // Position of the next write
+    int error; // Sticky, set once any write went out of bounds
+} hc_writer_t;
+
+void hc_writer_init(hc_writer_t*, char*, int);
+void hc_write_bits(hc_writer_t*, uint64_t, int); // writes 1-64 bits big-endian and advances
+void hc_write_bytes(hc_writer_t*, const char*, int); // byte-aligned bulk copy
+char* hc_write_view(hc_writer_t*, int); // reserves the next n byte-aligned bytes and returns them to fill in, NULL on failure
+void hc_write_bits_at(hc_writer_t*, uint64_t, int, int); // value, length, bit offset: patches an earlier field without moving
+int hc_writer_length(hc_writer_t*); // bytes encoded so far
+
+// Unchecked big-endian store of 1-64 bits at any bit offset, the caller guarantees bounds
+static inline void hc_store_bits(char *data, int bitOffset, int lengthBits, uint64_t value) {
+    uint8_t *bytes = (uint8_t *)data + (bitOffset >> 3);
+    // Byte-aligned whole bytes are plain stores
+    if ((bitOffset & 7) == 0 && (lengthBits & 7) == 0) {
+        for (int i = (lengthBits >> 3) - 1; i >= 0; i--) {
+            bytes[i] = value & 0xFF;
+            value >>= 8;
+        }
+        return;
+    }
+    // Otherwise merge into each byte the field touches, keeping the bits around it
+    int remainingBits = lengthBits;
+    int currentBit = bitOffset & 7;
+    while (remainingBits > 0) {
+        int bitsInByte = 8 - currentBit;
+        int put = bitsInByte < remainingBits ? bitsInByte : remainingBits;
+        int shift = bitsInByte - put;
+        uint8_t mask = ((1 << put) - 1) << shift;
+        uint8_t chunk = ((value >> (remainingBits - put)) << shift) & mask;
+        *bytes = (*bytes & ~mask) | chunk;
+        remainingBits -= put;
+        currentBit = 0;
+        bytes++;
+    }
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef __HC_CLOCK_H__
+#define __HC_CLOCK_H__
+
+#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_log.h"
+
+/*
+* Two clocks. The monotonic one counts ms since boot and never jumps, so every timeout, age and
+* link quality window is measured on it. Network time is what goes in beacons: the monotonic clock plus an
+* offset, which we learn from the timestamps in the beacons we hear and smooth so it only ever drifts.
+* Nothing touches the system clock, so a late sync can't make anything time out (or come back) all at once.
+*/
+
+#define HC_FIXED_TIME_MIN_VALUE (uint64_t)1640000000 // Network time (s) we count from until we've heard the real thing
+// Timestamps before this (ms) are from nodes that haven't synced either, so they're no use to us
+#define HC_CLOCK_SYNCED_MIN_MS ((HC_FIXED_TIME_MIN_VALUE + 80000) * 1000)
+#define HC_CLOCK_SMOOTHING 8 // Each sample moves the offset 1/this of the way, so one late beacon barely shows
+
+uint64_t hc_clock_monotonic_ms(); // ms since boot
+uint64_t hc_clock_network_ms(); // ms since the epoch (once synced), never goes backwards
+uint64_t hc_clock_network_at(uint64_t); // Network time of a monotonic ms reading
+bool hc_clock_synced(); // Whether we've heard the real network time yet
+// A network timestamp (ms) someone just sent us, which the offset is steered towards
+// Returns 1 if it was used, 0 if it was from a node that doesn't know the time either
+int hc_clock_observe(uint64_t);
+
+#endif
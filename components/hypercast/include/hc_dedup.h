@@ -0,0 +1,47 @@
+#ifndef __HC_DEDUP_H__
+#define __HC_DEDUP_H__
+
+#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "hc_buffer.h"
+
+/*
+* Recently seen overlay messages, so a multicast that reaches us over several paths is only delivered
+* and forwarded the first time. Messages are keyed on their source, the sequence number the source stamped on them
+* and, for a fragment, which one it is. Those are read straight from the extension headers, so duplicates are
+* dropped before anything is allocated and the payload is never touched.
+* Only messages with a sequence extension can be keyed, and sources only send one with HC_OVERLAY_NATIVE_EXTENSIONS
+* on. That's off by default, so in the default build every message comes back HC_DEDUP_UNKEYED and nothing is
+* deduplicated: copies arriving over more than one path are all delivered and forwarded.
+* The cache is set associative with a fixed size: a new message replaces an expired entry in its set,
+* or the oldest one if they're all still fresh.
+*/
+
+#define HC_DEDUP_SETS 32 // Has to be a power of two
+#define HC_DEDUP_WAYS 4
+#define HC_DEDUP_TTL_MS 5000 // How long a message counts as seen
+
+#define HC_DEDUP_NEW 0
+#define HC_DEDUP_DUPLICATE 1
+#define HC_DEDUP_UNKEYED -1 // No sequence number to key on, so we can't tell
+
+typedef struct hc_dedup_entry {
+    uint32_t source;
+    uint32_t sequence;
+    int fragment; // Its index for a fragment, -1 otherwise
+    TickType_t seen;
+    bool used;
+} hc_dedup_entry_t;
+
+typedef struct hc_dedup_cache {
+    hc_dedup_entry_t sets[HC_DEDUP_SETS][HC_DEDUP_WAYS];
+    uint32_t duplicates;
+    uint32_t evictions; // Fresh entries pushed out early, if this climbs the cache is too small
+} hc_dedup_cache_t;
+
+void hc_dedup_init(hc_dedup_cache_t*);
+int hc_dedup_check(hc_dedup_cache_t*, const hc_packet_t*); // Records the message if it's new
+
+#endif
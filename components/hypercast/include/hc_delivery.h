@@ -0,0 +1,50 @@
+#ifndef __HC_DELIVERY_H__
+#define __HC_DELIVERY_H__
+
+#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+
+#include "esp_log.h"
+#include "hc_overlay.h"
+
+/*
+* Handing payloads to the application off the engine task. The engine copies each overlay message it delivers
+* into a pool slot and queues it, and a lower priority application task pops them and runs the callbacks.
+* However long the application takes, forwarding only ever pays for the copy.
+* Reassembled fragmented buffers are queued as a slot with the buffer as its only segment, the application task frees it.
+*/
+
+#define HC_DELIVERY_ASYNC 1 // 0 runs the callback on the engine task, like it always did
+// HC_DELIVERY_MAX_DEPTH and HC_DELIVERY_BATCH_SIZE live in hypercast.h, the packet pool is sized with them
+#define HC_DELIVERY_IDLE_WAIT 1000 // Longest the application task sleeps before checking again (ms), a push wakes it
+#define HC_DELIVERY_TASK_PRIORITY 4 // Under the engine and socket handlers, so forwarding always wins the core
+#define HC_DELIVERY_TASK_STACK 8192
+
+// One payload, as the batch callback sees it
+typedef struct hc_delivery {
+    const char *data;
+    int length;
+} hc_delivery_t;
+
+typedef struct hc_delivery_config {
+    int depth; // Messages queued at most, up to HC_DELIVERY_MAX_DEPTH
+    int mode; // HC_BUFFER_MODE_SPSC when only the engine delivers, HC_BUFFER_MODE_LOCKED if it's going to have workers
+    int overflowPolicy; // What happens when the application falls behind, an HC_BUFFER_OVERFLOW_ policy
+    int blockTimeoutMs; // Only for HC_BUFFER_OVERFLOW_BLOCK, which holds up the engine for up to this long
+    void (*batchCallback)(const hc_delivery_t*, int); // Every payload in a batch at once, NULL for hypercast->callback per payload
+} hc_delivery_config_t;
+
+typedef struct hc_delivery_queue {
+    hc_buffer_t buffer; // Pushed by the engine (or its workers), popped by the application task
+    void (*batchCallback)(const hc_delivery_t*, int);
+    uint32_t delivered; // Payloads handed to the application
+    atomic_uint failed; // Couldn't be queued at all (no pool slot), counted by whichever task was delivering
+} hc_delivery_queue_t;
+
+// Sets up the queue and starts the application task, callbacks only run on that task from then on
+int hc_delivery_start(hypercast_t*, const hc_delivery_config_t*); // returns result (success = 1, failure = -1)
+// Engine side, these copy (or take) what they're given, the queue's overflow policy decides if it stays
+int hc_delivery_push_message(hypercast_t*, const hc_packet_t*); // A received overlay message, every payload in it is delivered
+int hc_delivery_push_buffer(hypercast_t*, char*, int); // A malloc'd buffer, freed once it's delivered (or dropped)
+void hc_delivery_handler(void*); // The application task
+
+#endif
@@ -7,10 +7,62 @@
 #include "hypercast.h"
 #include "hc_buffer.h"
 
-#define HC_OVERLAY_PACKET_LENGTH 14
-#define HC_PROTOCOL_PACKET_LENGTH 35
+// Longest the engine sleeps waiting on packets (ms). Only a backstop, anything due sooner is on a timer
+#define HC_ENGINE_MAX_IDLE_WAIT 1000
+// How often partly reassembled buffers are checked for having run out of time (ms)
+#define HC_ENGINE_FRAGMENT_EXPIRY_INTERVAL 500
+// Most packets the engine takes off the receive buffer at once
+#define HC_ENGINE_BATCH_SIZE 8
+
+/*
+* Workers. With them running the engine task stays the one owner of protocol state: it runs the ingress filter
+* (so trust checks never race a beacon), parses protocol messages and runs the timers. Overlay messages that get
+* past the filter are handed to a worker picked by their sourceLogicalAddress, and the worker does the rest:
+* dedup, the route record, delivery and patching them to go back out. One source always lands on the same worker
+* and each worker's queue is first in first out, so messages from a source are still handled in the order they came.
+* Dedup entries and reassembly are keyed on the source too, so each worker keeps its own and nothing is shared.
+* Workers hand everything to the delivery task, so the callback still only runs on one task. They won't start
+* without it (HC_DELIVERY_ASYNC 0).
+* The worker count (HC_ENGINE_WORKERS) and queue sizes live in hypercast.h, the packet pool is sized with them
+*/
+#define HC_ENGINE_MAX_WORKERS 8
+#define HC_ENGINE_WORKER_PRIORITY 5 // Same as the engine and socket handlers
+#define HC_ENGINE_WORKER_STACK 8192
+// A full worker queue holds up the engine for up to this long (ms), so a busy worker pushes back on the receive
+// buffer instead of losing messages that already made it in. Past that the newest is dropped
+#define HC_ENGINE_WORKER_BLOCK_MS 20
+
+// Where hc_forward keeps what it remembers between messages, the engine's own or a worker's
+typedef struct hc_engine_shard {
+    hc_dedup_cache_t *dedupCache;
+    struct hc_fragment_state *fragments;
+} hc_engine_shard_t;
+
+typedef struct hc_engine_worker {
+    hc_buffer_t queue; // Only the engine pushes and only this worker pops, so it doesn't need a lock
+    hc_engine_shard_t shard;
+    hypercast_t *hypercast;
+    int core; // The core the worker is pinned to
+    uint32_t processed; // Overlay messages handled
+    // Dispatched messages wait here until the engine's batch is done, then go in with one push (engine only)
+    hc_packet_t *pending[HC_ENGINE_BATCH_SIZE];
+    int pendingCount;
+} hc_engine_worker_t;
+
+typedef struct hc_engine_workers {
+    hc_engine_worker_t workers[HC_ENGINE_MAX_WORKERS];
+    int count;
+} hc_engine_workers_t;
 
 void hc_engine_handler(hypercast_t *hypercast);
-void hc_forward(hc_packet_t*, hypercast_t*);
+void hc_engine_process(hc_packet_t*, hypercast_t*); // Handles one received packet, and takes ownership of it
+// Takes ownership of the packet, only sends it on if told to. The shard has to belong to the calling task
+void hc_forward(hc_packet_t*, hypercast_t*, hc_engine_shard_t*, bool);
+
+// Starts the workers, overlay messages go to them from then on. Call it after hc_delivery_start and before the engine runs
+int hc_engine_start_workers(hypercast_t*, int); // returns result (success = 1, failure = -1)
+int hc_engine_worker_of(uint32_t, int); // The worker a source logical address is handled by, out of the count given
+void hc_engine_flush_workers(hypercast_t*); // Hands every dispatched message to its worker
+void hc_engine_worker_handler(void*); // A worker task, given its hc_engine_worker_t
 
 #endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef __HC_FILTER_H__
+#define __HC_FILTER_H__
+
+#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+
+#include "esp_log.h"
+#include "hc_buffer.h"
+
+/*
+* Ingress filter, run on every received packet before the engine parses anything.
+* Every rule reads fixed header offsets straight out of the packet, so a packet we'd throw away
+* never costs us more than a few loads. Rules run in order and the first one that rejects a packet
+* decides the verdict, each counting its own hits so we can see where traffic goes.
+*/
+
+// Rules, in the order they run
+#define HC_FILTER_RULE_LENGTH 0 // Shorter than its header, or its lengths run off the end of the packet
+#define HC_FILTER_RULE_VERSION 1 // Overlay version or protocol we don't run
+#define HC_FILTER_RULE_OVERLAY_ID 2 // Protocol message from another overlay
+#define HC_FILTER_RULE_TRUSTED 3 // Overlay message from a source we aren't adjacent to
+#define HC_FILTER_RULE_HOP_LIMIT 4 // Out of hops, we'll read it but it goes no further
+#define HC_FILTER_RULES 5
+
+// Verdicts
+#define HC_FILTER_ACCEPT 1
+#define HC_FILTER_DELIVER_ONLY 2 // Hand it up, but don't forward it
+#define HC_FILTER_DROP -1
+
+typedef struct hc_filter_stats {
+    uint32_t checked;
+    uint32_t accepted;
+    uint32_t hits[HC_FILTER_RULES];
+} hc_filter_stats_t;
+
+// hypercast_t holds the stats, so it's only forward declared here
+struct hypercast;
+
+int hc_filter_packet(struct hypercast*, const hc_packet_t*); // Returns the verdict
+const char* hc_filter_rule_name(int);
+
+#endif
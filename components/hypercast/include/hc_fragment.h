@@ -0,0 +1,58 @@
+#ifndef __HC_FRAGMENT_H__
+#define __HC_FRAGMENT_H__
+
+#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "hc_overlay.h"
+
+/*
+* Application buffers too big for one overlay message go out as a run of messages, each with a slice of
+* the buffer as its payload and a fragment extension saying which slice it is. Every fragment is a normal
+* overlay message as far as forwarding goes, only the final receiver puts them back together.
+* Reassembly memory is bounded: a few buffers at a time, each capped in size, and anything that
+* doesn't complete in time is thrown away.
+* Sending fragments needs HC_OVERLAY_NATIVE_EXTENSIONS, receiving them doesn't.
+*/
+
+#define HC_FRAGMENT_MAX_FRAGMENTS 64 // Received fragments are tracked in a 64 bit mask
+#define HC_FRAGMENT_MAX_MESSAGE_SIZE 16384 // Biggest buffer we'll send or put back together
+#define HC_FRAGMENT_REASSEMBLY_SLOTS 2 // Buffers being put back together at once
+#define HC_FRAGMENT_REASSEMBLY_TIMEOUT_MS 3000
+
+// Receive results
+#define HC_FRAGMENT_INCOMPLETE 0
+#define HC_FRAGMENT_COMPLETE 1 // The whole buffer went to the callback
+#define HC_FRAGMENT_DROPPED -1
+
+typedef struct hc_fragment_reassembly {
+    bool used;
+    uint32_t source;
+    uint16_t messageId;
+    uint8_t count;
+    uint16_t fragmentSize;
+    uint64_t received; // One bit per fragment
+    int length; // Only known once the last fragment is in
+    TickType_t started;
+    char *data; // count * fragmentSize bytes
+} hc_fragment_reassembly_t;
+
+typedef struct hc_fragment_state {
+    atomic_uint nextMessageId; // Senders can be on any task, the wire only takes the bottom 16 bits
+    hc_fragment_reassembly_t reassembly[HC_FRAGMENT_REASSEMBLY_SLOTS];
+    uint32_t completed;
+    uint32_t timedOut;
+    uint32_t dropped; // Bad fragments, and partial buffers pushed out by new ones
+} hc_fragment_state_t;
+
+void hc_fragment_init(hc_fragment_state_t*);
+// Sends a buffer of any size up to HC_FRAGMENT_MAX_MESSAGE_SIZE, split over as many messages as it takes
+// Any task can call it, like hc_send. Returns messages queued, or -1
+int hc_fragment_send(hypercast_t*, const char*, int);
+// Takes one received fragment's payload into the given reassembly state, and hands the buffer to the callback once it's complete
+// The state is the receiving task's own (hypercast->fragments on the engine, or a worker's), only sending is shared
+int hc_fragment_receive(hypercast_t*, hc_fragment_state_t*, uint32_t, const hc_msg_ext_fragment_t*, const char*, int);
+void hc_fragment_expire(hc_fragment_state_t*); // Drops reassemblies that have run out of time
+
+#endif
@@ -5,30 +5,114 @@
 
 #include "esp_log.h"
 #include "hc_buffer.h"
+#include "hc_schema.h"
 #include "hypercast.h"
 
-#define HC_MSG_OVERLAY_MIN_LENGTH 152 // Measured in bits
+// Overlay message header, see hc_schema.h for how the layout is used
+#define HC_OVERLAY_HEADER_SCHEMA(X, P) \
+    X(P, CONST, protocolId, 4, HC_PROTOCOL_OVERLAY_MESSAGE) \
+    X(P, CONST, reserved0, 4, 0) \
+    X(P, FIELD, version, 4, 0) \
+    X(P, FIELD, dataMode, 4, 0) \
+    X(P, CONST, reserved1, 24, 0) /* No idea why these 3 bytes are here tho */ \
+    X(P, SLOT, extensionsLength, 16, 0) /* Bytes of all extensions put together */ \
+    X(P, FIELD, hopLimit, 16, 0) \
+    X(P, SLOT, firstExtensionType, 8, HC_OVERLAY_EXT_TYPE_NULL) \
+    X(P, CONST, logicalAddressLength, 8, 4) /* Length of logical addresses in bytes (hardcoded to 4) */ \
+    X(P, FIELD, sourceLogicalAddress, 32, 0) \
+    X(P, FIELD, previousHopLogicalAddress, 32, 0)
+HC_SCHEMA_DECLARE(HC_OVERLAY_HEADER, HC_OVERLAY_HEADER_SCHEMA)
 
-#define HC_OVERLAY_MAX_EXTENSIONS 10
-#define HC_OVERLAY_MAX_ROUTE_RECORD_LENGTH 256
+// Every extension starts with this, then `length` bytes of extension data
+// The length field is lengthSize bytes wide, so the schema is the short (and usual) form and
+// anything bigger than 255 bytes uses a 2 byte length, see the helpers below
+#define HC_OVERLAY_EXT_HEADER_SCHEMA(X, P) \
+    X(P, SLOT, nextType, 8, HC_OVERLAY_EXT_TYPE_NULL) /* Type of the NEXT extension, 0 if this is the last */ \
+    X(P, SLOT, lengthSize, 8, 1) /* Size of the length field in bytes */ \
+    X(P, SLOT, length, 8, 0)
+HC_SCHEMA_DECLARE(HC_OVERLAY_EXT_HEADER, HC_OVERLAY_EXT_HEADER_SCHEMA)
+#define HC_OVERLAY_EXT_LENGTH_SIZE_MAX 2
+#define HC_OVERLAY_EXT_LENGTH_MAX 0xFFFF
+
+static inline int hc_overlay_ext_header_bytes(const char* extensionHeader) {
+    return HC_OVERLAY_EXT_HEADER_length / 8 + HC_SCHEMA_GET(extensionHeader, HC_OVERLAY_EXT_HEADER, lengthSize);
+}
+static inline int hc_overlay_ext_length(const char* extensionHeader) {
+    return hc_load_bits(extensionHeader, HC_OVERLAY_EXT_HEADER_length, 8 * HC_SCHEMA_GET(extensionHeader, HC_OVERLAY_EXT_HEADER, lengthSize));
+}
+static inline void hc_overlay_ext_set_length(char* extensionHeader, int length) {
+    // The length has to fit the lengthSize that's already there
+    hc_store_bits(extensionHeader, HC_OVERLAY_EXT_HEADER_length, 8 * HC_SCHEMA_GET(extensionHeader, HC_OVERLAY_EXT_HEADER, lengthSize), length);
+}
+
+// Fragment extension, carried by each piece of an application buffer too big for one message
+#define HC_OVERLAY_FRAGMENT_SCHEMA(X, P) \
+    X(P, FIELD, messageId, 16, 0) /* Picked by the source, the same for every fragment of a buffer */ \
+    X(P, FIELD, index, 8, 0) \
+    X(P, FIELD, count, 8, 0) \
+    X(P, FIELD, fragmentSize, 16, 0) /* Payload bytes in every fragment but the last */
+HC_SCHEMA_DECLARE(HC_OVERLAY_FRAGMENT, HC_OVERLAY_FRAGMENT_SCHEMA)
+
+// Sequence extension, every message we originate takes the next number from its source
+// so the same payload sent twice is still two messages to the dedup cache
+#define HC_OVERLAY_SEQUENCE_SCHEMA(X, P) \
+    X(P, FIELD, sequence, 32, 0)
+HC_SCHEMA_DECLARE(HC_OVERLAY_SEQUENCE, HC_OVERLAY_SEQUENCE_SCHEMA)
+
+#define HC_MSG_OVERLAY_MIN_LENGTH HC_OVERLAY_HEADER_LENGTH_BITS // Measured in bits
+
+#define HC_OVERLAY_VERSION 3
+#define HC_OVERLAY_MAX_EXTENSIONS 16 // Aggregated messages carry a payload extension per application payload
+#define HC_OVERLAY_MAX_ROUTE_RECORD_LENGTH 63 // The extension length is one byte, so 252 / 4 addresses at most
+
+// Past a few hops the route record is swapped for a fixed size Bloom filter of the same addresses,
+// so the packet stops growing however deep the path goes and loop checks take the same time at every hop.
+// The price is false positives: with 512 bits and 4 hashes it's well under 1% at 30 hops, ~2% at 63
+#define HC_OVERLAY_ROUTE_BLOOM_BYTES 64
+#define HC_OVERLAY_ROUTE_BLOOM_HASHES 4
+#define HC_OVERLAY_ROUTE_RECORD_COMPACT_LENGTH (HC_OVERLAY_ROUTE_BLOOM_BYTES / 4) // Most addresses before we switch
+
+// Extension types from 4 up (the route Bloom filter, fragments, sequence numbers) are ours, and other HyperCast nodes (the Java one included)
+// only know 2 and 3. While this is 0 we never send them: route records grow like they always did, up to
+// HC_OVERLAY_MAX_ROUTE_RECORD_LENGTH (then the oldest hop after the source makes room for each new one, so loops
+// longer than that are only caught by the hop limit), buffers too big for one message can't be sent and messages aren't deduplicated.
+// Those nodes also read every extension length as one byte whatever lengthSize says, so payloads are held to
+// HC_OVERLAY_SHORT_LENGTH_MAX too. Only turn it on for an overlay where every node runs this code. Receiving works either way
+#define HC_OVERLAY_NATIVE_EXTENSIONS 0
+// Most addresses a route record holds before it's compacted, or before it's full and starts dropping its oldest hops
+#define HC_OVERLAY_ROUTE_RECORD_LIMIT (HC_OVERLAY_NATIVE_EXTENSIONS ? HC_OVERLAY_ROUTE_RECORD_COMPACT_LENGTH : HC_OVERLAY_MAX_ROUTE_RECORD_LENGTH)
+// Most bytes the route record's data takes at any hop
+#define HC_OVERLAY_ROUTE_RECORD_MAX_BYTES (HC_OVERLAY_NATIVE_EXTENSIONS ? HC_OVERLAY_ROUTE_BLOOM_BYTES : HC_OVERLAY_MAX_ROUTE_RECORD_LENGTH * 4)
+// What the sequence extension adds to every message we originate
+#define HC_OVERLAY_SEQUENCE_EXT_BYTES (HC_OVERLAY_NATIVE_EXTENSIONS ? HC_SCHEMA_BYTES(HC_OVERLAY_EXT_HEADER) + HC_SCHEMA_BYTES(HC_OVERLAY_SEQUENCE) : 0)
+
+// Most payload one message can carry and still leave every hop room to add itself to the route:
+// the header, a long payload extension header, a fragment extension, the sequence and the route record at its biggest
+#define HC_OVERLAY_MESSAGE_OVERHEAD (HC_SCHEMA_BYTES(HC_OVERLAY_HEADER) \
+    + HC_OVERLAY_EXT_HEADER_length / 8 + HC_OVERLAY_EXT_LENGTH_SIZE_MAX \
+    + HC_SCHEMA_BYTES(HC_OVERLAY_EXT_HEADER) + HC_SCHEMA_BYTES(HC_OVERLAY_FRAGMENT) + HC_OVERLAY_SEQUENCE_EXT_BYTES \
+    + HC_SCHEMA_BYTES(HC_OVERLAY_EXT_HEADER) + HC_OVERLAY_ROUTE_RECORD_MAX_BYTES)
+#define HC_OVERLAY_PAYLOAD_MAX (HC_BUFFER_DATA_MAX - HC_OVERLAY_MESSAGE_OVERHEAD)
+#define HC_OVERLAY_SHORT_LENGTH_MAX 0xFF // Longest extension a one byte length covers
+// Most payload one message carries that every node in the overlay can read
+#define HC_OVERLAY_PAYLOAD_LIMIT (HC_OVERLAY_NATIVE_EXTENSIONS ? HC_OVERLAY_PAYLOAD_MAX : HC_OVERLAY_SHORT_LENGTH_MAX)
+
+// Each message lives in one allocation with a bump arena behind it for its extensions and their data
+#define HC_OVERLAY_ARENA_DEFAULT_SIZE 384 // For messages we build ourselves, fits a route record grown and then compacted
+#define HC_OVERLAY_ARENA_EXTENSION_OVERHEAD 32 // Extension struct + alignment, per extension
+#define HC_OVERLAY_ROUTE_RECORD_SPARE 4 // Entries a route record can take before it has to move in the arena
 
 // Overlay Extension Types
 #define HC_OVERLAY_EXT_TYPE_NULL 0
 #define HC_MSG_EXT_PAYLOAD_TYPE 2
 #define HC_MSG_EXT_ROUTE_RECORD_TYPE 3
-
-typedef struct hc_msg_overlay {
-    uint8_t version;
-    uint8_t dataMode;
-    uint16_t hopLimit;
-    uint32_t sourceLogicalAddress;
-    uint32_t previousHopLogicalAddress;
-    void **extensions; // Extensions are hashed into this list for easier retrieval
-} hc_msg_overlay_t;
+#define HC_MSG_EXT_ROUTE_BLOOM_TYPE 4
+#define HC_MSG_EXT_FRAGMENT_TYPE 5
+#define HC_MSG_EXT_SEQUENCE_TYPE 6
 
 // Overlay Extensions
 typedef struct hc_msg_ext {
-    // Just a husk to let us read type and order before hashing in extensions array :)
+    // Just a husk to let us read type and order before looking at the rest :)
     uint8_t type;
     uint8_t order;
 } hc_msg_ext_t;
@@ -38,7 +122,7 @@ typedef struct hc_msg_ext_payload {
     uint8_t type;
     uint8_t order;
     // Then we have the extension data
-    uint8_t length;
+    uint16_t length;
     char *payload;
 } hc_msg_ext_payload_t;
 
@@ -48,25 +132,111 @@ typedef struct hc_msg_ext_route_record {
     uint8_t order;
     // Then we have the extension data
     int routeRecordSize;
+    int routeRecordCapacity;
     uint32_t* routeRecordLogicalAddressList;
 } hc_msg_ext_route_record_t;
 
+typedef struct hc_msg_ext_route_bloom {
+    // All extensions carry their type, and order of definition from the message
+    uint8_t type;
+    uint8_t order;
+    // Then we have the extension data, every address on the route hashed in
+    uint8_t bits[HC_OVERLAY_ROUTE_BLOOM_BYTES];
+} hc_msg_ext_route_bloom_t;
+
+typedef struct hc_msg_ext_fragment {
+    // All extensions carry their type, and order of definition from the message
+    uint8_t type;
+    uint8_t order;
+    // Then we have the extension data
+    uint16_t messageId;
+    uint8_t index;
+    uint8_t count;
+    uint16_t fragmentSize;
+} hc_msg_ext_fragment_t;
+
+typedef struct hc_msg_ext_sequence {
+    // All extensions carry their type, and order of definition from the message
+    uint8_t type;
+    uint8_t order;
+    // Then we have the extension data
+    uint32_t sequence;
+} hc_msg_ext_sequence_t;
+
+// One entry per extension, kept in message order
+typedef struct hc_msg_ext_slot {
+    uint8_t type;
+    uint8_t order;
+    // Where the extension sits in the packet it was parsed from (lazy messages only)
+    uint16_t offset; // Byte offset of the extension data
+    uint16_t length; // In bytes
+    // Then the decoded extension, NULL until somebody asks for it
+    union {
+        hc_msg_ext_t *ext;
+        hc_msg_ext_payload_t *payload;
+        hc_msg_ext_route_record_t *routeRecord;
+        hc_msg_ext_route_bloom_t *routeBloom;
+        hc_msg_ext_fragment_t *fragment;
+    };
+} hc_msg_ext_slot_t;
+
+typedef struct hc_msg_overlay {
+    uint8_t version;
+    uint8_t dataMode;
+    uint16_t hopLimit;
+    uint32_t sourceLogicalAddress;
+    uint32_t previousHopLogicalAddress;
+    int extensionCount;
+    hc_msg_ext_slot_t extensions[HC_OVERLAY_MAX_EXTENSIONS];
+    // Lazily parsed messages only record where their extensions are, and decode them when asked
+    const hc_packet_t *packet; // The packet the slots point into, NULL once there's nothing left to decode
+    // Arena for everything the message points to, it's the rest of the message's allocation
+    char *arenaNext;
+    char *arenaEnd;
+} hc_msg_overlay_t;
+
 
 hc_msg_overlay_t* hc_msg_overlay_parse(hc_packet_t*);
+// Only checks the layout and records each extension, the packet has to outlive the message
+hc_msg_overlay_t* hc_msg_overlay_parse_lazy(const hc_packet_t*);
 hc_packet_t* hc_msg_overlay_encode(hc_msg_overlay_t*);
+// Same, but payloads aren't copied: the packet's segments point at them, so it takes the message and frees it with the packet
+hc_packet_t* hc_msg_overlay_encode_gather(hc_msg_overlay_t*);
 
 // Helpers for managing hc_overlay
 hc_msg_overlay_t* hc_msg_overlay_init();
 hc_msg_overlay_t* hc_msg_overlay_init_with_payload(hypercast_t*, char*, int); // Build a full payload message for tests
-void hc_msg_overlay_free(hc_msg_overlay_t*);
-void hc_msg_overlay_free_extensions(void**);
-int hc_msg_overlay_insert_extension(hc_msg_overlay_t*, void*); // returns result (success = 1, failure = -1)
-int hc_msg_overlay_get_primary_payload(hc_msg_overlay_t*, char**, int*); // returns result (success = 1, failure = -1)
+void hc_msg_overlay_free(hc_msg_overlay_t*); // Frees the message and everything in its arena
+void* hc_msg_overlay_alloc(hc_msg_overlay_t*, int); // From the message's arena, NULL once it's full
+int hc_msg_overlay_insert_extension(hc_msg_overlay_t*, void*); // Extension must come from the arena, returns result (success = 1, failure = -1)
+int hc_msg_overlay_get_primary_payload(hc_msg_overlay_t*, char**, int*); // returns result (success = 1, failure = -1), lazy messages give a view into the packet
+int hc_msg_overlay_get_payload(hc_msg_overlay_t*, int, char**, int*); // Same for the nth payload, -1 once there are no more
 int hc_msg_overlay_retrieve_extension_of_type(hc_msg_overlay_t*, int, void**); // returns result (success = 1, failure = -1)
 int hc_msg_overlay_ext_get_next_order(hc_msg_overlay_t*); // returns next order number for extensions
 
-// Route Record Managers
-void hc_overlay_route_record_append(hc_msg_overlay_t*, int);
-int hc_overlay_route_record_contains(hc_msg_overlay_t*, int); // returns 0 for false, 1 for true
+// Route Record Managers, these cover both the plain route record and its Bloom filter form
+// Returned (instead of 1) when the route record was full and lost its oldest hop after the source to fit us in
+#define HC_OVERLAY_ROUTE_TRUNCATED 2
+int hc_overlay_route_record_append(hc_msg_overlay_t*, int); // returns result (success = 1 or HC_OVERLAY_ROUTE_TRUNCATED, failure = -1)
+int hc_overlay_route_record_contains(hc_msg_overlay_t*, int); // returns 0 for false, 1 for true (or maybe, for a Bloom filter)
+
+// Working on the encoded packet directly
+// Byte offset of the extension after the one at offset (or the first, for -1) and its type, -1 at the end of the chain
+int hc_overlay_next_extension(const hc_packet_t*, int, int*);
+// Byte offset of the first extension of a type (and of the last extension in the chain), -1 if there is none
+int hc_overlay_find_extension(const hc_packet_t*, int, int*);
+// Building a message of our own straight into a packet: a header, then extensions chained on one at a time
+int hc_overlay_start_in_place(hc_packet_t*, uint32_t); // returns result (success = 1, failure = -1)
+int hc_overlay_append_extension_in_place(hc_packet_t*, int, const char*, int); // returns result (success = 1, failure = -1)
+// The next sequence number from us (any task), and the extension carrying it for a message we're building
+// The extension only goes on with HC_OVERLAY_NATIVE_EXTENSIONS, otherwise this does nothing and returns 1
+uint32_t hc_overlay_next_sequence(hypercast_t*);
+int hc_overlay_append_sequence_in_place(hc_packet_t*, hypercast_t*); // returns result (success = 1, failure = -1)
+// Just the extension header (type, length, length size), for data the caller puts in place itself.
+// Returns the byte offset the data goes at, packet->size ends at the header, -1 if it won't fit
+int hc_overlay_chain_extension_in_place(hc_packet_t*, int, int, int);
+// Turns a received overlay packet into the one we forward, without decoding it:
+// ticks down the hop limit, sets us as previous hop and appends us to the route record (compacting it if it's due)
+int hc_overlay_forward_in_place(hc_packet_t*, uint32_t); // returns result (success = 1 or HC_OVERLAY_ROUTE_TRUNCATED, failure = -1)
 
 #endif
\ No newline at end of file
@@ -7,14 +7,30 @@
 
 #include "hypercast.h"
 #include "hc_overlay.h"
+#include "hc_schema.h"
 
 #define HC_PROTOCOL_OVERLAY_MESSAGE 13
 // Then supported protocolIDs
 #define HC_PROTOCOL_SPT 3 
+#define HC_PROTOCOL_IDS 16 // protocolId is a nibble, so this many could ever be registered
+
+// Header common to every protocol message, see hc_schema.h
+#define HC_PROTOCOL_HEADER_SCHEMA(X, P) \
+    X(P, SLOT, protocolId, 4, 0) \
+    X(P, SLOT, protocolVersion, 4, 0) \
+    X(P, SLOT, messageLength, 16, 0) /* Bytes after this field */ \
+    X(P, SLOT, messageType, 8, 0) \
+    X(P, SLOT, overlayId, 32, 0)
+HC_SCHEMA_DECLARE(HC_PROTOCOL_HEADER, HC_PROTOCOL_HEADER_SCHEMA)
+
+// Protocols are registered in hc_protocols.c, by pointing the table there at their const ops
+const hc_protocol_ops_t* hc_protocol_lookup(int); // The ops for a protocolId, NULL if we don't know it
+// Joins an overlay, running the protocol given. Takes the protocolId and overlayId, returns result (success = 1, failure = -1)
+int hc_protocol_install(hypercast_t*, int, int);
+hc_protocol_shell_t* hc_protocol_find(hypercast_t*, int); // The instance running an overlayId, NULL if we aren't in it
 
 void hc_protocol_parse(hc_packet_t*, long, hypercast_t*);
-void hc_protocol_maintenance(hypercast_t*);
-void* resolve_protocol_to_install(int, uint32_t);
-bool hc_overlay_sender_trusted(hc_msg_overlay_t*, hypercast_t*);
+int hc_protocol_lane(const hc_packet_t*); // Buffer lane a received packet belongs in
+bool hc_overlay_sender_trusted(uint32_t, hypercast_t*); // Takes the source logical address
 
 #endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef __HC_SCHEMA_H__
+#define __HC_SCHEMA_H__
+
+/*
+* Wire layouts are described once as a list of fields, and everything else (bit offsets, parse
+* and encode routines, field accessors) is generated from that list at compile time.
+* A schema is a macro taking (X, P) that expands X(P, kind, name, bits, value) for each field in order:
+*   FIELD - maps to the struct member `name`, loaded and stored by the generated routines
+*   CONST - always encoded as `value`, skipped on parse
+*   SLOT  - not a struct member, encoded as `value` then set (or read) by name with HC_SCHEMA_SET/GET
+* Every offset is a constant, so the generated routines are straight-line loads and stores.
+*/
+
+#include "hc_buffer.h"
+
+// Offsets: P_name is the bit offset of each field, P_name_BITS its width and P_LENGTH_BITS the total
+#define HC_SCHEMA_OFFSET(P, kind, name, bits, value) \
+    P##_##name, P##_##name##_BITS = (bits), P##_##name##_END = P##_##name + (bits) - 1,
+#define HC_SCHEMA_DECLARE(P, SCHEMA) enum { SCHEMA(HC_SCHEMA_OFFSET, P) P##_LENGTH_BITS };
+#define HC_SCHEMA_BYTES(P) (P##_LENGTH_BITS / 8)
+
+// Single field access relative to the start of the layout
+#define HC_SCHEMA_GET(data, P, name) hc_load_bits((data), P##_##name, P##_##name##_BITS)
+#define HC_SCHEMA_SET(data, P, name, v) hc_store_bits((data), P##_##name, P##_##name##_BITS, (v))
+
+// Parse
+#define HC_SCHEMA_LOAD_FIELD(P, name) out->name = HC_SCHEMA_GET(data, P, name);
+#define HC_SCHEMA_LOAD_CONST(P, name)
+#define HC_SCHEMA_LOAD_SLOT(P, name)
+#define HC_SCHEMA_LOAD_ENTRY(P, kind, name, bits, value) HC_SCHEMA_LOAD_##kind(P, name)
+#define HC_SCHEMA_DEFINE_LOAD(fn, type, P, SCHEMA) \
+    static inline void fn(const char *data, type *out) { \
+        (void)data; (void)out; \
+        SCHEMA(HC_SCHEMA_LOAD_ENTRY, P) \
+    }
+
+// Encode
+#define HC_SCHEMA_STORE_FIELD(P, name, value) HC_SCHEMA_SET(data, P, name, in->name);
+#define HC_SCHEMA_STORE_CONST(P, name, value) HC_SCHEMA_SET(data, P, name, value);
+#define HC_SCHEMA_STORE_SLOT(P, name, value) HC_SCHEMA_SET(data, P, name, value);
+#define HC_SCHEMA_STORE_ENTRY(P, kind, name, bits, value) HC_SCHEMA_STORE_##kind(P, name, value)
+#define HC_SCHEMA_DEFINE_STORE(fn, type, P, SCHEMA) \
+    static inline void fn(char *data, const type *in) { \
+        (void)in; \
+        SCHEMA(HC_SCHEMA_STORE_ENTRY, P) \
+    }
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __HC_SEND_H__
+#define __HC_SEND_H__
+
+#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+
+#include "esp_log.h"
+#include "hc_overlay.h"
+#include "hc_fragment.h"
+
+/*
+* Originating overlay messages from the application. A message is built right in the send buffer slot it goes
+* out from: the header, then a route record holding just us, then the payload extension.
+* The payload either gets written into the slot by the caller (reserve then commit, no copies at all),
+* copied into it once (hc_send), or stays in the caller's own memory until it's on the wire (hc_send_buffer).
+* Any task can send, the send buffer takes pushes from everyone.
+*/
+
+// Flags for hc_send
+#define HC_SEND_DEFAULT 0
+#define HC_SEND_AGGREGATE 1 // Small payloads may wait (up to HC_AGGREGATE_MAX_DELAY_MS) to share a message, from any task
+
+// Where the payload starts in a reserved slot, after a payload extension header with the short (one byte) length
+// every node can read. Only a payload too long for that (native extensions only) gets moved up a byte on commit
+#define HC_SEND_PAYLOAD_OFFSET (HC_SCHEMA_BYTES(HC_OVERLAY_HEADER) \
+    + HC_SCHEMA_BYTES(HC_OVERLAY_EXT_HEADER) + HC_OVERLAY_HEADER_sourceLogicalAddress_BITS / 8 \
+    + HC_OVERLAY_SEQUENCE_EXT_BYTES + HC_SCHEMA_BYTES(HC_OVERLAY_EXT_HEADER))
+#define HC_SEND_PAYLOAD_MAX HC_OVERLAY_PAYLOAD_LIMIT // Most one message takes, hc_send fragments anything bigger
+// Most hc_send takes at all. Fragmenting needs HC_OVERLAY_NATIVE_EXTENSIONS, so by default that's one message's worth
+#define HC_SEND_SIZE_MAX (HC_OVERLAY_NATIVE_EXTENSIONS ? HC_FRAGMENT_MAX_MESSAGE_SIZE : HC_SEND_PAYLOAD_MAX)
+// Returned instead of -1 when the payload is over the limit, so there's no point trying it again
+#define HC_SEND_TOO_BIG -2
+
+// Copies the payload into a send slot and queues it, bigger ones are fragmented (only with
+// HC_OVERLAY_NATIVE_EXTENSIONS). Returns 1, HC_SEND_TOO_BIG past HC_SEND_SIZE_MAX, or -1
+int hc_send(hypercast_t*, const char*, int, int);
+// Takes a send slot and returns where its payload goes (HC_SEND_PAYLOAD_MAX bytes of room), NULL if there's no slot.
+// Hand it to hc_send_commit once it's filled, or back to free_packet to give up on it
+char* hc_send_reserve(hypercast_t*, hc_packet_t**);
+// Writes the headers in front of the payload and queues it, the slot is gone either way.
+// Returns 1, HC_SEND_TOO_BIG past HC_SEND_PAYLOAD_MAX, or -1
+int hc_send_commit(hypercast_t*, hc_packet_t*, int);
+// Sends the payload from the caller's own memory. It mustn't change until release is called with the context,
+// which happens exactly once, once it's sent or if it can't be. Returns 1, HC_SEND_TOO_BIG past HC_SEND_PAYLOAD_MAX, or -1
+int hc_send_buffer(hypercast_t*, const char*, int, void (*)(void*), void*);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef __HC_TIMER_H__
+#define __HC_TIMER_H__
+
+#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "hypercast.h"
+
+/*
+* Everything the engine has to do at a certain time rather than when a packet shows up: protocol beacons
+* and timeouts, fragment expiry. Timers live inside whoever owns them (nothing is allocated), and pending
+* ones sit in a min-heap on their deadline, so the engine only ever looks at the soonest one.
+* The engine sleeps until that deadline (or a packet), so an idle node does nothing between events,
+* and a busy one checks the heap once per batch, not once per packet.
+* Timers are engine task only, the callbacks run on it too.
+*/
+
+#define HC_TIMER_MAX 16 // Pending at once, each protocol instance keeps a few
+#define HC_TIMER_IDLE -1 // Heap index of a timer that isn't scheduled
+
+typedef struct hc_timer {
+    uint32_t deadline; // ms, on the hc_timer_now clock (the monotonic clock, cut down to 32 bits)
+    int index; // Where it sits in the heap, HC_TIMER_IDLE if it isn't pending
+    void (*callback)(hypercast_t*, void*); // Runs once it's due, and can schedule itself (or anything else) again
+    void *context;
+} hc_timer_t;
+
+typedef struct hc_timer_queue {
+    hc_timer_t *heap[HC_TIMER_MAX]; // heap[0] is always the soonest
+    int size;
+    uint32_t fired;
+} hc_timer_queue_t;
+
+uint32_t hc_timer_now(); // ms since boot, wraps (deadlines are compared as differences)
+void hc_timer_queue_init(hc_timer_queue_t*);
+void hc_timer_init(hc_timer_t*, void (*)(hypercast_t*, void*), void*);
+// Sets the timer to go off this many ms from now, moving it if it's already pending. Returns 1, or -1 if the heap is full
+int hc_timer_schedule(hypercast_t*, hc_timer_t*, int);
+void hc_timer_cancel(hypercast_t*, hc_timer_t*); // Fine on a timer that isn't pending
+bool hc_timer_pending(const hc_timer_t*);
+// Runs everything that's due, and returns how long (ms, at most the one given) until the next one is
+int hc_timer_run(hypercast_t*, int);
+
+#endif
@@ -5,8 +5,28 @@
 
 #include "esp_log.h"
 #include "hc_buffer.h"
+#include "hc_dedup.h"
+#include "hc_filter.h"
 
-#define HC_BUFFER_SIZE 100
+#define HC_BUFFER_SIZE 72 // Packets held across both buffers
+// Each buffer gets a small control lane for protocol messages, the rest goes to data
+// The lanes add up to HC_BUFFER_SIZE so a flood of data can never take the pool slots control needs
+#define HC_BUFFER_CONTROL_LANE_SIZE 8
+#define HC_BUFFER_DATA_LANE_SIZE ((HC_BUFFER_SIZE / 2) - HC_BUFFER_CONTROL_LANE_SIZE)
+// Received messages waiting for the application task (see hc_delivery.h) hold pool slots too
+#define HC_DELIVERY_MAX_DEPTH 8 // Queued at most
+#define HC_DELIVERY_BATCH_SIZE 4 // Most the application task takes (and holds) at once
+// Overlay messages can be spread over worker tasks pinned to cores (see hc_engine.h), and their queues hold pool slots too
+#define HC_ENGINE_WORKERS 0 // 0 keeps everything on the engine task, 2 puts a worker on each of the ESP32's cores (needs HC_DELIVERY_ASYNC)
+#define HC_ENGINE_WORKER_QUEUE_SIZE 8 // Messages waiting for each worker
+#define HC_ENGINE_WORKER_BATCH_SIZE 4 // Most a worker takes (and holds) at once
+// Pool slots are HC_BUFFER_DATA_MAX each, so we can't afford much more than HC_BUFFER_SIZE on a 320 KB heap
+// (a full MTU per slot, so ~130 KB of pool, leaving room for fragment reassembly)
+// The pool holds every lane's worth, plus the packets held by the tasks in between
+#define HC_PACKET_POOL_IN_FLIGHT 4 // receive handler, engine, send handler & maintenance
+#define HC_PACKET_POOL_SIZE (HC_BUFFER_SIZE + HC_PACKET_POOL_IN_FLIGHT + HC_DELIVERY_MAX_DEPTH + HC_DELIVERY_BATCH_SIZE \
+    + HC_ENGINE_WORKERS * (HC_ENGINE_WORKER_QUEUE_SIZE + HC_ENGINE_WORKER_BATCH_SIZE))
+#define HC_PROTOCOL_MAX_INSTANCES 4 // Overlays one node can be in at once, each with its own protocol
 
 typedef struct hc_config {
     int number; // This is a placeholder
@@ -28,8 +48,16 @@ typedef struct hc_sender_table {
     int size;
     hc_sender_entry_t **entries;
     int sourceAddressLogical;
+    atomic_uint nextSequence; // Stamped on every overlay message we originate, see hc_overlay.h
 } hc_sender_table_t;
 
+// What became of the overlay messages we passed on, workers count them side by side
+typedef struct hc_forward_stats {
+    atomic_uint forwarded;
+    atomic_uint truncated; // Went out with a full route record that lost its oldest hop to fit us in
+    atomic_uint failed; // Couldn't be patched for the next hop (malformed, or no room left), so they went no further
+} hc_forward_stats_t;
+
 // Define our state machine
 typedef struct hypercast {
     // Add 2 buffers for send and receive
@@ -38,18 +66,51 @@ typedef struct hypercast {
     // Add the Conection Info
     int socket; // Really just a file pointer, but a *special* file pointer
     hc_sender_table_t *senderTable;
+    // Overlay messages we've seen lately, so ones that come in over more than one path are dropped
+    hc_dedup_cache_t *dedupCache;
+    // What the ingress filter has seen and dropped
+    hc_filter_stats_t filterStats;
+    // What the engine has forwarded
+    hc_forward_stats_t forwardStats;
+    // Fragmented buffers going out and being put back together, see hc_fragment.h
+    struct hc_fragment_state *fragments;
+    // Small payloads waiting to share a message on the way out, see hc_aggregate.h
+    struct hc_aggregator *aggregator;
+    // Where the application task picks up what we deliver, NULL if callbacks run on the engine task
+    struct hc_delivery_queue *delivery;
+    // What the engine has to do at a set time (protocol beacons and timeouts), see hc_timer.h
+    struct hc_timer_queue *timers;
+    // Tasks the engine hands overlay messages to, NULL if it handles them itself (see hc_engine.h)
+    struct hc_engine_workers *workers;
     // Introduce statefulness
     int state;
     // Then cofiguration
-    void *protocol; // protocol is actually an allocated object of a type based on config (always castable to protocol shell)
+    // One protocol instance per overlay we're in, each an allocated object of a type based on config (always castable to protocol shell)
+    // Protocol messages go to the one with their overlayId, protocols[0] is the one we report on
+    struct hc_protocol_shell *protocols[HC_PROTOCOL_MAX_INSTANCES];
+    int protocolCount;
     hc_config_t config;
     // Also install the callback!
     void (*callback)(char *, int); // data, length
 } hypercast_t;
 
+// What every protocol implements, the engine only ever reaches a protocol through these
+// Each one takes the protocol instance first, so one protocol can run in more than one overlay
+typedef struct hc_protocol_ops {
+    int id; // protocolId on the wire
+    const char *name;
+    void* (*create)(uint32_t); // A fresh instance for our source logical address
+    void (*parse)(void*, hc_packet_t*, int, long, hypercast_t*); // A received message, with its messageType and messageLength
+    void (*start)(void*, hypercast_t*); // Once it's installed, schedules its beacons and timeouts (see hc_timer.h)
+    bool (*trusted)(void*, uint32_t, hypercast_t*); // Whether overlay messages from this source logical address are taken
+    hc_packet_t* (*encode)(void*, void*, int, hypercast_t*); // A message of the given messageType, into a pool packet
+    void (*stats)(void*, hc_writer_t*); // The protocol's state, for the measurement report
+} hc_protocol_ops_t;
+
 typedef struct hc_protocol_shell {
     int id;
     int overlayId; // The overlay hash which determines if they live in the same space for real
+    const hc_protocol_ops_t *ops;
     // actual protocols have other data that follows
 } hc_protocol_shell_t;
 
@@ -6,6 +6,8 @@
 #include "esp_log.h"
 #include "hypercast.h"
 #include "hc_overlay.h"
+#include "hc_schema.h"
+#include "hc_timer.h"
 
 #define SPT_BEACON_MESSAGE_TYPE 0
 #define SPT_BEACON_MESSAGE_BASE_LENGTH 60
@@ -24,8 +26,8 @@
 #define SPT_MESSAGE_LQ_RELIABILITY_THRESHOLD 0.1
 #define SPT_MESSAGE_LQ_PING_BUFF_SIZE 10
 #define SPT_JUMP_THRESHOLD 3
-#define SPT_ADJACENCY_TIMEOUT 20
-#define SPT_NEIGHBOR_TIMEOUT 8
+#define SPT_ADJACENCY_TIMEOUT 20000 // ms
+#define SPT_NEIGHBOR_TIMEOUT 8000 // ms
 #define SPT_MESSAGE_BEACON_TIME_INTERVAL 1000
 
 #define SPT_TOPOLOGY_POLICY 0 // "Cost"
@@ -35,6 +37,39 @@
 // Path Metrics 
 #define SPT_PATH_METRIC_FULL_VALUE 10000
 
+// Wire layouts (see hc_schema.h), in the order they appear after the protocol header
+// Not sure at all where the number of interfaces goes... <<HELP>>
+// Java nodes expect these 2 bytes in front of the first interface, so we always send (and skip) them
+#define SPT_SENDER_TABLE_HEADER 0xff41
+#define SPT_SENDER_TABLE_HEADER_BITS 16
+
+// One per interface in the sender table, address length needs to be 6 (4 address + 2 port)
+#define SPT_INTERFACE_SCHEMA(X, P) \
+    X(P, FIELD, hash, 16, 0) \
+    X(P, FIELD, addressLength, 8, 0) \
+    X(P, SLOT, address, 32, 0) \
+    X(P, FIELD, port, 16, 0)
+HC_SCHEMA_DECLARE(SPT_INTERFACE, SPT_INTERFACE_SCHEMA)
+
+// Beacon body following the sender table, the adjacency entries come right after
+#define SPT_BEACON_SCHEMA(X, P) \
+    X(P, SLOT, sourceAddressLogical, 32, 0) /* Ends the sender table */ \
+    X(P, FIELD, rootAddressLogical, 32, 0) \
+    X(P, FIELD, parentAddressLogical, 32, 0) \
+    X(P, FIELD, cost, 32, 0) \
+    X(P, FIELD, timestamp, 64, 0) /* ms on the wire */ \
+    X(P, SLOT, senderCount, 32, 0) /* Number of adjacency entries */
+HC_SCHEMA_DECLARE(SPT_BEACON, SPT_BEACON_SCHEMA)
+
+#define SPT_ADJACENCY_ENTRY_SCHEMA(X, P) \
+    X(P, FIELD, id, 32, 0) \
+    X(P, FIELD, quality, 8, 0) /* Only bits 2-8 are quality ( & 0x7F ) */
+HC_SCHEMA_DECLARE(SPT_ADJACENCY_ENTRY, SPT_ADJACENCY_ENTRY_SCHEMA)
+
+#define SPT_BEACON_TRAILER_SCHEMA(X, P) \
+    X(P, FIELD, reliability, 16, 0)
+HC_SCHEMA_DECLARE(SPT_BEACON_TRAILER, SPT_BEACON_TRAILER_SCHEMA)
+
 typedef struct adjacency_table_entry {
     uint32_t id;
     uint8_t quality;
@@ -50,7 +85,7 @@ typedef struct spt_msg_beacon {
     uint32_t rootAddressLogical;
     uint32_t parentAddressLogical;
     uint32_t cost;
-    uint64_t timestamp;
+    uint64_t timestamp; // Sender's network time (ms)
     uint16_t senderCount;
     adjacency_table_t* adjacencyTable;
     uint16_t reliability;
@@ -77,7 +112,7 @@ typedef struct pt_spt_neighborhood_entry {
     uint16_t rootId;
     uint32_t cost;
     uint32_t pathMetric;
-    uint64_t timestamp;
+    uint64_t timestamp; // Last heard from (monotonic ms)
     bool isAncestor; // This is the single entry that is our ancestor
 } pt_spt_neighborhood_entry_t;
 
@@ -92,7 +127,7 @@ typedef struct pt_spt_backup_ancestor_entry {
     uint16_t coreId;
     uint32_t cost;
     uint32_t pathMetric;
-    uint64_t timestamp;
+    uint64_t timestamp; // Last heard from (monotonic ms)
 } pt_spt_backup_ancestor_entry_t;
 
 typedef struct pt_spt_backup_ancestor_table {
@@ -104,7 +139,7 @@ typedef struct pt_spt_backup_ancestor_table {
 typedef struct pt_spt_adjacency_entry {
     uint32_t id;
     uint8_t quality;
-    uint64_t timestamp;
+    uint64_t timestamp; // Last heard from (monotonic ms)
     // Ping buffer tracks the reception (true or false) of pings over the last SPT_MESSAGE_LQ_PING_BUFF_SIZE intervals
     bool* pingBuffer;
     int pingBufferStart;
@@ -128,9 +163,11 @@ typedef struct pt_spt_core_table {
 } pt_spt_core_table_t;
 
 typedef struct protocol_spt {
+    // Same as hc_protocol_shell_t up to here
     int id;
     int overlayId;
-    uint64_t lastBeacon; // timestamp of last beacon
+    const hc_protocol_ops_t* ops;
+    uint64_t lastBeacon; // When we last sent a beacon (monotonic ms)
     // Tree info table
     pt_spt_tree_info_table_t* treeInfoTable;
     // neighborhood table
@@ -142,20 +179,28 @@ typedef struct protocol_spt {
     // core table
     pt_spt_core_table_t* coreTable;
 
+    // Periodic work, run off the engine's timers
+    hc_timer_t beaconTimer;
+    hc_timer_t adjacencyTimer; // Goes off when the oldest adjacency entry would time out
+    hc_timer_t neighborTimer; // Same for the neighborhood table
+
     // CONFIGURABLES
-    int heartbeatTime; // in seconds
+    int heartbeatTime; // in ms
 } protocol_spt;
 
-void spt_parse(hc_packet_t*, int, long, long, hypercast_t*);
-hc_packet_t* spt_encode(void* msg, int, hypercast_t*);
-void spt_maintenance(hypercast_t*);
-bool spt_overlay_sender_trusted(hc_msg_overlay_t*, hypercast_t*);
+// SPT's entries in the protocol registry (see hc_protocols.c), each takes the protocol_spt instance first
+extern const hc_protocol_ops_t spt_protocol_ops;
+void spt_parse(void*, hc_packet_t*, int, long, hypercast_t*);
+hc_packet_t* spt_encode(void*, void* msg, int, hypercast_t*);
+void spt_start(void*, hypercast_t*);
+bool spt_overlay_sender_trusted(void*, uint32_t, hypercast_t*);
+void spt_stats(void*, hc_writer_t*);
 
 protocol_spt* spt_protocol_from_config(uint32_t);
 
 // Protocol Message Handlers
-void spt_handle_beacon_message(spt_msg_beacon_t*, hypercast_t*);
-void spt_handle_goodbye_message(spt_msg_goodbye_t*, hypercast_t*);
+void spt_handle_beacon_message(spt_msg_beacon_t*, protocol_spt*, hypercast_t*);
+void spt_handle_goodbye_message(spt_msg_goodbye_t*, protocol_spt*, hypercast_t*);
 
 // Protocol Support Functions
 void spt_ping_buffer_record(uint64_t, bool, pt_spt_adjacency_entry_t*);
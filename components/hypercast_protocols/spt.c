@@ -7,144 +7,149 @@
 #include "spt.h"
 #include "hc_protocols.h"
 #include "hc_buffer.h"
-#include "hc_lib.h"
+#include "hc_clock.h"
+#include "hc_timer.h"
 
 static const char* TAG = "HC_PROTOCOL_SPT";
 
-void spt_parse(hc_packet_t* packet, int messageType, long overlayID, long messageLength, hypercast_t* hypercast) {
+// Wire routines generated from the schemas in spt.h
+HC_SCHEMA_DEFINE_LOAD(spt_interface_load, hc_sender_entry_t, SPT_INTERFACE, SPT_INTERFACE_SCHEMA)
+HC_SCHEMA_DEFINE_STORE(spt_interface_store, hc_sender_entry_t, SPT_INTERFACE, SPT_INTERFACE_SCHEMA)
+HC_SCHEMA_DEFINE_LOAD(spt_beacon_load, spt_msg_beacon_t, SPT_BEACON, SPT_BEACON_SCHEMA)
+HC_SCHEMA_DEFINE_STORE(spt_beacon_store, spt_msg_beacon_t, SPT_BEACON, SPT_BEACON_SCHEMA)
+HC_SCHEMA_DEFINE_LOAD(spt_adjacency_entry_load, adjacency_table_entry_t, SPT_ADJACENCY_ENTRY, SPT_ADJACENCY_ENTRY_SCHEMA)
+HC_SCHEMA_DEFINE_STORE(spt_adjacency_entry_store, pt_spt_adjacency_entry_t, SPT_ADJACENCY_ENTRY, SPT_ADJACENCY_ENTRY_SCHEMA)
+HC_SCHEMA_DEFINE_LOAD(spt_beacon_trailer_load, spt_msg_beacon_t, SPT_BEACON_TRAILER, SPT_BEACON_TRAILER_SCHEMA)
+HC_SCHEMA_DEFINE_STORE(spt_beacon_trailer_store, spt_msg_beacon_t, SPT_BEACON_TRAILER, SPT_BEACON_TRAILER_SCHEMA)
+
+static void spt_schedule_timeouts(protocol_spt*, hypercast_t*);
+
+static hc_sender_table_t* spt_parse_sender_table(hc_reader_t *reader) {
+    // In normal SPT, this has to be 1
+    int senderCount = 1;
+    hc_sender_table_t *senderTable = malloc(sizeof(hc_sender_table_t));
+    senderTable->size = 0;
+    senderTable->entries = malloc(sizeof(hc_sender_entry_t*) * senderCount);
+    for (int i=0; i<senderCount; i++) {
+        // Theoretically this loops in CSA, but normal SPT only sees 1 iteration
+        const char *interface = hc_read_view(reader, HC_SCHEMA_BYTES(SPT_INTERFACE));
+        if (interface == NULL) { break; }
+        // for each entry, we'll allocate then populate
+        hc_sender_entry_t *entry = malloc(sizeof(hc_sender_entry_t));
+        entry->type = 1; // IPv4 (assumed)
+        entry->address = malloc(sizeof(hc_ipv4_addr_t));
+        spt_interface_load(interface, entry);
+        memcpy(entry->address->addr, interface + SPT_INTERFACE_address/8, SPT_INTERFACE_address_BITS/8);
+        senderTable->entries[senderTable->size++] = entry;
+        // The first 4 (address length needs to be 6 or I panic) are the address bits
+        if (entry->addressLength != 6) {
+            ESP_LOGE(TAG, "Address length is not 6, but %d. I can't deal with that", (int)entry->addressLength);
+            reader->error = 1;
+            break;
+        }
+    }
+    return senderTable;
+}
+
+static void spt_encode_sender_table(hc_writer_t *writer, hc_sender_table_t *senderTable, int size) {
+    hc_write_bits(writer, SPT_SENDER_TABLE_HEADER, SPT_SENDER_TABLE_HEADER_BITS);
+    for (int i=0; i<size; i++) {
+        char *interface = hc_write_view(writer, HC_SCHEMA_BYTES(SPT_INTERFACE));
+        if (interface == NULL) { return; }
+        spt_interface_store(interface, senderTable->entries[i]);
+        // Only the 4 address bytes go out, the other 2 of the length are the port
+        memcpy(interface + SPT_INTERFACE_address/8, senderTable->entries[i]->address->addr, SPT_INTERFACE_address_BITS/8);
+    }
+}
+
+void spt_parse(void* protocol, hc_packet_t* packet, int messageType, long messageLength, hypercast_t* hypercast) {
     ESP_LOGI(TAG, "Reached SPT Parser");
+    protocol_spt* spt = (protocol_spt*)protocol;
     // Here we'll check the message type and build the appropriate message
     // Then it will be up to the function passed to at the end of each switch statement to handle that message
     // This all comes directly from page 27 of SPT spec -> https://www.comm.utoronto.ca/hypercast/material/SPT_Protocol_03-20-05.pdf 
     // SPT doc page 6 has information on algorithms used to calculate costing (there are options)
     // Sender data packet is updated as seen on page 82 of v4 spec -> https://www.comm.utoronto.ca/~jorg/archive/papers/Majidthesis.pdf
-    int i; // We'll need an iterator a few times
-    int startingIndex; // We'll also need an index to begin an iterator at a few times
-    long senderCount; // Used to count up the senders in a senderTable (used in hello and goodbye)
     // Metric for adjacency should be least hops with at least a minimum link quality
     // Maybe use RSSI? But code is meant not to be specific to wireless (and RSSI may not be standardized?)
     ESP_LOGI(TAG, "Message Type: %d", messageType);
-    // Bit offset includes message type, message length, protocol message type, and overlay ID (8 bytes)
-    int bitOffset = 64; // bits that come before the protocol message format listed (already ready)
+    // The reader walks the message in order, and the layouts in spt.h say what's in each piece
+    hc_reader_t reader;
+    hc_reader_init(&reader, packet);
+    // Skip the protocol header (already read) then the sender table header
+    hc_reader_seek(&reader, HC_PROTOCOL_HEADER_LENGTH_BITS + SPT_SENDER_TABLE_HEADER_BITS);
     switch (messageType) {
         case SPT_BEACON_MESSAGE_TYPE:
             ESP_LOGI(TAG, "Received Beacon Message");
             // Now parse all the components of this message
             spt_msg_beacon_t *beaconMessage = malloc(sizeof(spt_msg_beacon_t));
-            // NOTE: We've already read the first 5 bytes (common to all protocol messages)
-            // These 5 are AFTER the 2 bytes read for message length
             // Start by resolving the sender table
-            beaconMessage->senderTable = malloc(sizeof(hc_sender_table_t));
-            // In normal SPT, this has to be 1
-            senderCount = 1;
-            beaconMessage->senderTable->size = senderCount;
-            beaconMessage->senderTable->entries = malloc(sizeof(hc_sender_entry_t*) * senderCount);
-            startingIndex = 16 + bitOffset;
-            for (i=0; i<senderCount; i++) {
-                // Theoretically this loops in CSA, but normal SPT only sees 1 iteration
-                // for each entry, we'll allocate then populate
-                beaconMessage->senderTable->entries[i] = malloc(sizeof(hc_sender_entry_t));
-                // Now add the type of the address as IPv4 (assumed)
-                beaconMessage->senderTable->entries[i]->type = 1;
-                // Then add packet data
-                beaconMessage->senderTable->entries[i]->hash = packet_to_int(packet_snip_to_bytes(packet, 16, startingIndex));
-                long addressLength = packet_to_int(packet_snip_to_bytes(packet, 8, startingIndex + 16));
-                // Now add the address
-                beaconMessage->senderTable->entries[i]->address = malloc(sizeof(hc_ipv4_addr_t));
-                beaconMessage->senderTable->entries[i]->addressLength = addressLength;
-                // The first 4 (address length needs to be 6 or I panic) are the address bits
-                if (addressLength != 6) {
-                    ESP_LOGE(TAG, "Address length is not 6, but %d. I can't deal with that", (int)addressLength);
-                    return;
-                }
-                // Populate address
-                for (int j=0; j<addressLength-2; j++) {
-                    beaconMessage->senderTable->entries[i]->address->addr[j] = (uint8_t)packet_to_int(packet_snip_to_bytes(packet, 8, startingIndex + 24 + (j*8)));
-                }
-                // Then the last 2 bytes are the port
-                beaconMessage->senderTable->entries[i]->port = packet_to_int(packet_snip_to_bytes(packet, 16, startingIndex + 24 + (addressLength-2)*8));
-                startingIndex += 3*8 + addressLength*8; // We update this index because each interface is dynamically sized
+            beaconMessage->senderTable = spt_parse_sender_table(&reader);
+            beaconMessage->adjacencyTable = malloc(sizeof(adjacency_table_t));
+            beaconMessage->adjacencyTable->size = 0;
+            beaconMessage->adjacencyTable->entries = NULL;
+            // Then the rest of the beacon data
+            const char *body = hc_read_view(&reader, HC_SCHEMA_BYTES(SPT_BEACON));
+            if (body == NULL) {
+                ESP_LOGE(TAG, "Beacon Message truncated, dropping");
+                spt_free_beacon_message(beaconMessage);
+                break;
             }
+            spt_beacon_load(body, beaconMessage);
             // Finish the sendertable by adding the source logical as well
-            beaconMessage->senderTable->sourceAddressLogical = packet_to_int(packet_snip_to_bytes(packet, 32, startingIndex));
-            // HERE WE RE-GROUND THE BITOFFSET!!!!
-            bitOffset = startingIndex + 32;
-            // NOW START FROM 0 WITH THE REST OF THE DATA!!! THIS IS IMPORTANT
-            beaconMessage->rootAddressLogical = packet_to_int(packet_snip_to_bytes(packet, 32, bitOffset));
-            beaconMessage->parentAddressLogical = packet_to_int(packet_snip_to_bytes(packet, 32, bitOffset + 32));
-            beaconMessage->cost = packet_to_int(packet_snip_to_bytes(packet, 32, bitOffset + 64));
-            beaconMessage->timestamp = packet_to_int(packet_snip_to_bytes(packet, 64, bitOffset + 96));
-            // They deal in ms out there, but we're gonna keep it to seconds over here
-            beaconMessage->timestamp /= 1000;
+            beaconMessage->senderTable->sourceAddressLogical = HC_SCHEMA_GET(body, SPT_BEACON, sourceAddressLogical);
+            // The timestamp is their network time in ms, which is what we keep too
             ESP_LOGI(TAG, "Beacon Message Parsed, timestamp is %" PRIu64 "", beaconMessage->timestamp);
             // Now we need to parse the adjacency table
             ESP_LOGI(TAG, "Packet size is %d", (int)packet->size);
-            uint32_t tableSize = packet_to_int(packet_snip_to_bytes(packet, 32, bitOffset + 160)); // "Sender Count"
-            // ESP_LOGI(TAG, "%s", packet_snip_to_bytes(packet, 32, bitOffset + 160)->data);
-            beaconMessage->adjacencyTable = malloc(sizeof(adjacency_table_t));
-            beaconMessage->adjacencyTable->size = tableSize;
+            uint32_t tableSize = HC_SCHEMA_GET(body, SPT_BEACON, senderCount);
+            // A size the packet can't hold means the message is broken
+            if (tableSize > hc_reader_remaining_bits(&reader) / SPT_ADJACENCY_ENTRY_LENGTH_BITS) {
+                ESP_LOGE(TAG, "Adjacency table size %u doesn't fit in the packet", tableSize);
+                tableSize = 0;
+                reader.error = 1;
+            }
+            beaconMessage->senderCount = tableSize;
             beaconMessage->adjacencyTable->entries = malloc(sizeof(adjacency_table_entry_t*) * tableSize);
-            ESP_LOGI(TAG, "Table size is %u, found at %d", tableSize, bitOffset + 160);
-            startingIndex = bitOffset + 192;
-            for (i=0; i<tableSize; i++) {
+            ESP_LOGI(TAG, "Table size is %u", tableSize);
+            for (int i=0; i<tableSize; i++) {
+                const char *entry = hc_read_view(&reader, HC_SCHEMA_BYTES(SPT_ADJACENCY_ENTRY));
                 beaconMessage->adjacencyTable->entries[i] = malloc(sizeof(adjacency_table_entry_t));
-                beaconMessage->adjacencyTable->entries[i]->id = packet_to_int(packet_snip_to_bytes(packet, 32, startingIndex+i*40));
-                beaconMessage->adjacencyTable->entries[i]->quality = packet_to_int(packet_snip_to_bytes(packet, 8, startingIndex+(i*40)+32));
-                // Now we need to do an & operation on "quality" because it actually only occupies bits 2-8 ( & 0x7F )
-                beaconMessage->adjacencyTable->entries[i]->quality = beaconMessage->adjacencyTable->entries[i]->quality & 0x7F;
+                beaconMessage->adjacencyTable->size++;
+                spt_adjacency_entry_load(entry, beaconMessage->adjacencyTable->entries[i]);
+                beaconMessage->adjacencyTable->entries[i]->quality &= 0x7F;
             }
-            // Then send it to the handler that acts based on the message information
-            bitOffset = startingIndex + tableSize*40;
             // Reliability is last!
-            beaconMessage->reliability = packet_to_int(packet_snip_to_bytes(packet, 16, bitOffset));
+            const char *trailer = hc_read_view(&reader, HC_SCHEMA_BYTES(SPT_BEACON_TRAILER));
+            // If any of that ran off the end of the packet, drop it
+            if (reader.error) {
+                ESP_LOGE(TAG, "Beacon Message truncated, dropping");
+                spt_free_beacon_message(beaconMessage);
+                break;
+            }
+            spt_beacon_trailer_load(trailer, beaconMessage);
             // Then send it to the handler that acts based on the message information
-            spt_handle_beacon_message(beaconMessage, hypercast);
+            spt_handle_beacon_message(beaconMessage, spt, hypercast);
             spt_free_beacon_message(beaconMessage);
+            // Anyone new in our tables needs the timeouts running
+            spt_schedule_timeouts(spt, hypercast);
             break;
         case SPT_GOODBYE_MESSAGE_TYPE:
             ESP_LOGI(TAG, "Received Goodbye Message");
             // Now parse all the components of this message
             spt_msg_goodbye_t *goodbyeMessage = malloc(sizeof(spt_msg_goodbye_t));
             // This one's pretty easy because we actually only have the sender table to parse lol
-            // NOTE: We've already read the first 5 bytes (common to all protocol messages)
-            // These 5 are AFTER the 2 bytes read for message length
-            // Start by resolving the sender table
-            goodbyeMessage->senderTable = malloc(sizeof(hc_sender_table_t));
-            // In normal SPT, this has to be 1
-            senderCount = 1;
-            goodbyeMessage->senderTable->size = senderCount;
-            goodbyeMessage->senderTable->entries = malloc(sizeof(hc_sender_entry_t*) * senderCount);
-            startingIndex = 16 + bitOffset;
-            for (i=0; i<senderCount; i++) {
-                // Theoretically this loops in CSA, but normal SPT only sees 1 iteration
-                // for each entry, we'll allocate then populate
-                goodbyeMessage->senderTable->entries[i] = malloc(sizeof(hc_sender_entry_t));
-                // Now add the type of the address as IPv4 (assumed)
-                goodbyeMessage->senderTable->entries[i]->type = 1;
-                // Then add packet data
-                goodbyeMessage->senderTable->entries[i]->hash = packet_to_int(packet_snip_to_bytes(packet, 16, startingIndex));
-                long addressLength = packet_to_int(packet_snip_to_bytes(packet, 8, startingIndex + 16));
-                // Now add the address
-                goodbyeMessage->senderTable->entries[i]->address = malloc(sizeof(hc_ipv4_addr_t));
-                goodbyeMessage->senderTable->entries[i]->addressLength = addressLength;
-                // The first 4 (address length needs to be 6 or I panic) are the address bits
-                if (addressLength != 6) {
-                    ESP_LOGE(TAG, "Address length is not 6, but %d. I can't deal with that", (int)addressLength);
-                    return;
-                }
-                // Populate address
-                for (int j=0; j<addressLength-2; j++) {
-                    goodbyeMessage->senderTable->entries[i]->address->addr[j] = (uint8_t)packet_to_int(packet_snip_to_bytes(packet, 8, startingIndex + 24 + (j*8)));
-                }
-                // Then the last 2 bytes are the port
-                goodbyeMessage->senderTable->entries[i]->port = packet_to_int(packet_snip_to_bytes(packet, 16, startingIndex + 24 + (addressLength-2)*8));
-                startingIndex += 3*8 + addressLength*8; // We update this index because each interface is dynamically sized
-            }
+            goodbyeMessage->senderTable = spt_parse_sender_table(&reader);
             // Finish the sendertable by adding the source logical as well
-            goodbyeMessage->senderTable->sourceAddressLogical = packet_to_int(packet_snip_to_bytes(packet, 32, startingIndex));
+            goodbyeMessage->senderTable->sourceAddressLogical = hc_read_bits(&reader, SPT_BEACON_sourceAddressLogical_BITS);
             // And now we're done
+            if (reader.error) {
+                ESP_LOGE(TAG, "Goodbye Message truncated, dropping");
+                spt_free_goodbye_message(goodbyeMessage);
+                break;
+            }
             // Then send it to the handler that acts based on the message information
-            spt_handle_goodbye_message(goodbyeMessage, hypercast);
+            spt_handle_goodbye_message(goodbyeMessage, spt, hypercast);
             spt_free_goodbye_message(goodbyeMessage);
             break;
         case SPT_ROUTE_REQ_MESSAGE_TYPE:
@@ -159,90 +164,79 @@ void spt_parse(hc_packet_t* packet, int messageType, long overlayID, long messag
     }
 }
 
-hc_packet_t* spt_encode(void *msg, int messageType, hypercast_t *hypercast) {
+hc_packet_t* spt_encode(void *protocol, void *msg, int messageType, hypercast_t *hypercast) {
     // Fetch Protocol Data
-    protocol_spt *spt = (protocol_spt*)hypercast->protocol;
-    // Define data cache
-    char data[HC_BUFFER_DATA_MAX]; // Temporary buffer of max size to shove data into
-    int dataSize = 0;
+    protocol_spt *spt = (protocol_spt*)protocol;
+    // Encode straight into a pool slot so the packet can be handed to the send buffer as is
+    hc_packet_t *packet = hc_packet_acquire();
+    if (packet == NULL) {
+        ESP_LOGE(TAG, "Packet pool exhausted, can't encode SPT message");
+        return NULL;
+    }
+    hc_writer_t writer;
+    hc_writer_init(&writer, packet->data, HC_BUFFER_DATA_MAX);
     // we gotta bundle it up in here
-    // First there are general bits we can throw on the front
-    write_bytes(data, 3, 4, 0, HC_BUFFER_DATA_MAX); // Protocol Number
-    write_bytes(data, 3, 4, 4, HC_BUFFER_DATA_MAX); // Protocol Version? I'm not sure what this is <<HELP>>
-    // We also leave a space here for the length of the message (16 bits)
-    // Then setup to write
-    int bitOffset = 8 + 16; // Protocol + message length
+    // First the protocol header, the length of the message gets set once we know it
+    char *header = hc_write_view(&writer, HC_SCHEMA_BYTES(HC_PROTOCOL_HEADER));
+    HC_SCHEMA_SET(header, HC_PROTOCOL_HEADER, protocolId, HC_PROTOCOL_SPT);
+    HC_SCHEMA_SET(header, HC_PROTOCOL_HEADER, protocolVersion, 3); // I'm not sure what this is <<HELP>>
+    HC_SCHEMA_SET(header, HC_PROTOCOL_HEADER, messageType, messageType);
+    HC_SCHEMA_SET(header, HC_PROTOCOL_HEADER, overlayId, spt->overlayId); // Overlay Hash ID <<HELP>> (Derivable?)
     int i; // Iterator :)
     // this switch will handle each messageType case
     switch (messageType) {
         case SPT_BEACON_MESSAGE_TYPE:
-            // First the basics (kinda obvious)
-            write_bytes(data, SPT_BEACON_MESSAGE_TYPE, 8, bitOffset, HC_BUFFER_DATA_MAX); // Message Type
-            write_bytes(data, spt->overlayId, 32, bitOffset + 8, HC_BUFFER_DATA_MAX); // Overlay Hash ID <<HELP>> (Derivable?)
+            ESP_LOGD(TAG, "Encoding Beacon Message");
             spt_msg_beacon_t *message = (spt_msg_beacon_t*)msg;
             // Now we'll read through the message and add it to the packet
             // First the sender table
-            // Not sure at all where the number of interfaces goes... <<HELP>> (16 bits??)
-            // BAD: To make this work, insert ff41 into the data buffer before the first interface
-            write_bytes(data, 0xff41, 16, bitOffset + 40, HC_BUFFER_DATA_MAX); // Number of interfaces
-            bitOffset = bitOffset + 40 + 16; // We'll start at the beginning of the sender table
-            for (i=0; i<hypercast->senderTable->size; i++) {
-                // First the type
-                // write_bytes(data, message->senderTable->entries[i]->type, 8, bitOffset, HC_BUFFER_DATA_MAX);
-                // Then the hash
-                write_bytes(data, message->senderTable->entries[i]->hash, 16, bitOffset, HC_BUFFER_DATA_MAX);
-                // Then the address length
-                write_bytes(data, message->senderTable->entries[i]->addressLength, 8, bitOffset + 16, HC_BUFFER_DATA_MAX);
-                // Then the address
-                for (int j=0; j<message->senderTable->entries[i]->addressLength-2; j++) { // 2 are for the port
-                    write_bytes(data, message->senderTable->entries[i]->address->addr[j], 8, bitOffset + 24 + j*8, HC_BUFFER_DATA_MAX);
-                }
-                bitOffset += (message->senderTable->entries[i]->addressLength-2)*8 + 24; // Most of the offset update
-                // Then the port
-                write_bytes(data, message->senderTable->entries[i]->port, 16, bitOffset, HC_BUFFER_DATA_MAX);
-                bitOffset += 16; // Finish offset update
-            }
-            // Next is the sourceAddressLogical
-            write_bytes(data, spt->treeInfoTable->id, 32, bitOffset, HC_BUFFER_DATA_MAX); // message->senderTable->sourceLogicalAddress
-            bitOffset += 32;
-            // Now move on to the beacon message data with offset reset
-            write_bytes(data, spt->treeInfoTable->id, 32, bitOffset, HC_BUFFER_DATA_MAX); // message->rootLogicalAdddress
-            write_bytes(data, message->parentAddressLogical, 32, bitOffset + 32, HC_BUFFER_DATA_MAX);
-            write_bytes(data, message->cost, 32, bitOffset + 64, HC_BUFFER_DATA_MAX);
-            write_bytes(data, message->timestamp*1000, 64, bitOffset + 96, HC_BUFFER_DATA_MAX); // *1000 because they use ms out there
-            // Then we finish with the adjacency table
-            write_bytes(data, spt->adjacencyTable->size, 32, bitOffset + 160, HC_BUFFER_DATA_MAX);
-            bitOffset += 160 + 32; // + adjacency table size entries of 40 bits
-            // Now we can add the actual adjacency table entries
+            spt_encode_sender_table(&writer, message->senderTable, hypercast->senderTable->size);
+            // Now move on to the beacon message data
+            // We always advertise ourselves as source and root
+            spt_msg_beacon_t wire = *message;
+            wire.rootAddressLogical = spt->treeInfoTable->id;
+            char *body = hc_write_view(&writer, HC_SCHEMA_BYTES(SPT_BEACON));
+            if (body == NULL) { break; }
+            spt_beacon_store(body, &wire);
+            HC_SCHEMA_SET(body, SPT_BEACON, sourceAddressLogical, spt->treeInfoTable->id);
+            HC_SCHEMA_SET(body, SPT_BEACON, senderCount, spt->adjacencyTable->size);
+            // Then we finish with the adjacency table entries
             for (i=0;i<spt->adjacencyTable->size;i++) {
-                write_bytes(data, spt->adjacencyTable->entries[i]->id, 32, bitOffset, HC_BUFFER_DATA_MAX);
-                write_bytes(data, spt->adjacencyTable->entries[i]->quality, 8, bitOffset + 32, HC_BUFFER_DATA_MAX);
-                bitOffset += 40; // Size of an adjacency table entry
+                char *entry = hc_write_view(&writer, HC_SCHEMA_BYTES(SPT_ADJACENCY_ENTRY));
+                if (entry == NULL) { break; }
+                spt_adjacency_entry_store(entry, spt->adjacencyTable->entries[i]);
             }
             // And the reliability is last
-            write_bytes(data, message->reliability, 16, bitOffset, HC_BUFFER_DATA_MAX);
-            bitOffset += 16; // Just to maintain it to the end :)
-            dataSize = bitOffset / 8;
+            char *trailer = hc_write_view(&writer, HC_SCHEMA_BYTES(SPT_BEACON_TRAILER));
+            if (trailer == NULL) { break; }
+            spt_beacon_trailer_store(trailer, message);
             break;
         case SPT_GOODBYE_MESSAGE_TYPE:
-            break;
+            ESP_LOGE(TAG, "SPT does not support encoding Goodbye messages at the moment, sorry!");
+            free_packet(packet);
+            return NULL;
         case SPT_ROUTE_REQ_MESSAGE_TYPE:
             ESP_LOGE(TAG, "SPT does not support Route Requesting at the moment, sorry!");
-            break;
+            free_packet(packet);
+            return NULL;
         case SPT_ROUTE_REPLY_MESSAGE_TYPE:
             ESP_LOGE(TAG, "SPT does not support Route Replying at the moment, sorry!");
-            break;
+            free_packet(packet);
+            return NULL;
         default:
             ESP_LOGE(TAG, "Unknown SPT Message Type");
+            free_packet(packet);
             return NULL;
     }
+    if (writer.error) {
+        ESP_LOGE(TAG, "SPT message too large to encode");
+        free_packet(packet);
+        return NULL;
+    }
     // In all cases the last thing to write is the length of the message!
-    write_bytes(data, dataSize-3, 16, 8, HC_BUFFER_DATA_MAX);
+    HC_SCHEMA_SET(header, HC_PROTOCOL_HEADER, messageLength, hc_writer_length(&writer)-3);
     // Now at the end let's pretty it up!
-    hc_packet_t *packet = malloc(sizeof(hc_packet_t));
-    packet->size = dataSize;
-    packet->data = malloc(sizeof(char)*dataSize);
-    memcpy(packet->data, data, dataSize);
+    packet->size = hc_writer_length(&writer);
     return packet;
 }
 
@@ -250,8 +244,8 @@ protocol_spt* spt_protocol_from_config(uint32_t sourceLogicalAddress) {
     protocol_spt* spt;
     spt = malloc(sizeof(protocol_spt));
     spt->id = HC_PROTOCOL_SPT;
-    spt->lastBeacon = 0; // Never sent, so diff will be massive!
-    spt->heartbeatTime = 5;
+    spt->lastBeacon = 0; // Never sent
+    spt->heartbeatTime = 5000;
 
     // Init tables
 
@@ -288,146 +282,140 @@ protocol_spt* spt_protocol_from_config(uint32_t sourceLogicalAddress) {
     return spt;
 }
 
-void spt_maintenance(hypercast_t* hypercast) {
-    // SPT maintenance consists of sending a beacon message with
-    // the protocol's current state information
-    // We'll do that here, but it's a periodic task, so we'll only
-    // do it when necessary
+static void spt_send_beacon(hypercast_t* hypercast, void* protocol) {
+    // The beacon carries the protocol's current state information, and goes out once a heartbeat
+    uint64_t currentTime = hc_clock_monotonic_ms();
+    protocol_spt* spt = (protocol_spt*)protocol;
+    ESP_LOGI(TAG, "Sending SPT Beacon");
+
+    // 1. Build the beacon message, it only points at our own state
+    // The encoder bit-packs straight from the sender and adjacency tables into the slot, so nothing needs copying
+    spt_msg_beacon_t beaconMessage = {
+        .senderTable = hypercast->senderTable,
+        .rootAddressLogical = spt->treeInfoTable->rootId,
+        .parentAddressLogical = spt->treeInfoTable->ancestorId,
+        .cost = spt->treeInfoTable->cost,
+        .timestamp = hc_clock_network_ms(), // What everyone else steers their network time by
+        .senderCount = spt->adjacencyTable->size,
+        .adjacencyTable = NULL, // The encoder reads spt->adjacencyTable itself
+        .reliability = spt_pathmetric_minimumcost(NULL),
+    };
+
+    // 2. Encode it
+    hc_packet_t *packet = spt_encode(spt, &beaconMessage, SPT_BEACON_MESSAGE_TYPE, hypercast);
+    // 3. Send it off in the control lane so data can't hold it up (the send buffer owns the packet from here)
+    if (packet != NULL) {
+        ESP_LOGI(TAG, "Sending Beacon Message");
+        hc_push_buffer_lane(hypercast->sendBuffer, packet, HC_BUFFER_LANE_CONTROL);
+    }
+    // 4. Update last beacon time, and come back next heartbeat
+    spt->lastBeacon = currentTime;
+    hc_timer_schedule(hypercast, &spt->beaconTimer, spt->heartbeatTime);
 
-    // Load necessary values
-    uint64_t currentTime = get_epoch();
-    protocol_spt* spt = (protocol_spt*)hypercast->protocol;
+    // TEMP: Whenever we send a beacon, send an overlay message out!
+    // char payload[] = "Hello World from ESP32!";
+    // hc_send(hypercast, payload, strlen(payload), HC_SEND_DEFAULT);
+}
 
-    // First check necessity of maintenance
-    ESP_LOGI(TAG, "Current: %llu, Last: %llu, Diff: %llu", currentTime, spt->lastBeacon, currentTime - spt->lastBeacon);
-    if (currentTime - spt->lastBeacon < spt->heartbeatTime) {
-        return;
+static int spt_timeout_delay(uint64_t oldestTimestamp, int timeout) {
+    // Entries go once they're older than the timeout, so just after it's reached
+    uint64_t currentTime = hc_clock_monotonic_ms();
+    uint64_t expires = oldestTimestamp + timeout + 1;
+    return expires > currentTime ? (int)(expires - currentTime) : 0;
+}
+
+static void spt_schedule_timeouts(protocol_spt* spt, hypercast_t* hypercast) {
+    // Each table's timeout goes off when its oldest entry would run out, and only while there's an entry at all
+    // Entries get fresher with every beacon, so when it goes off early it just finds the new oldest
+    int i;
+    uint64_t oldest;
+    if (spt->adjacencyTable->size > 0 && !hc_timer_pending(&spt->adjacencyTimer)) {
+        oldest = spt->adjacencyTable->entries[0]->timestamp;
+        for (i=1; i<spt->adjacencyTable->size; i++) {
+            if (spt->adjacencyTable->entries[i]->timestamp < oldest) { oldest = spt->adjacencyTable->entries[i]->timestamp; }
+        }
+        hc_timer_schedule(hypercast, &spt->adjacencyTimer, spt_timeout_delay(oldest, SPT_ADJACENCY_TIMEOUT));
     }
-    
-    // Setup iterator
+    if (spt->neighborhoodTable->size > 0 && !hc_timer_pending(&spt->neighborTimer)) {
+        oldest = spt->neighborhoodTable->entries[0]->timestamp;
+        for (i=1; i<spt->neighborhoodTable->size; i++) {
+            if (spt->neighborhoodTable->entries[i]->timestamp < oldest) { oldest = spt->neighborhoodTable->entries[i]->timestamp; }
+        }
+        hc_timer_schedule(hypercast, &spt->neighborTimer, spt_timeout_delay(oldest, SPT_NEIGHBOR_TIMEOUT));
+    }
+}
+
+static void spt_adjacency_timeout(hypercast_t* hypercast, void* protocol) {
+    uint64_t currentTime = hc_clock_monotonic_ms();
+    protocol_spt* spt = (protocol_spt*)protocol;
     int i;
 
-    // Now execute
-    ESP_LOGI(TAG, "Maintaining SPT");
-
-    // 1. Generate beacon message base
-    spt_msg_beacon_t* beaconMessage = malloc(sizeof(spt_msg_beacon_t));
-    // 2. Populate state information
-    // Sender table with 1 entry (because we only use 1 interface)
-    // We need to copy it here so that the beacon free can free it later!
-    beaconMessage->senderTable = malloc(sizeof(hc_sender_table_t));
-    beaconMessage->senderTable->size = hypercast->senderTable->size;
-    beaconMessage->senderTable->entries = malloc(sizeof(hc_sender_entry_t*)*beaconMessage->senderTable->size);
-    beaconMessage->senderTable->sourceAddressLogical = hypercast->senderTable->sourceAddressLogical;
-    for (int i=0;i<beaconMessage->senderTable->size;i++) {
-        // Allocation is unnecessary here
-        beaconMessage->senderTable->entries[i] = malloc(sizeof(hc_sender_entry_t));
-        beaconMessage->senderTable->entries[i]->type = hypercast->senderTable->entries[i]->type;
-        beaconMessage->senderTable->entries[i]->hash = hypercast->senderTable->entries[i]->hash;
-        beaconMessage->senderTable->entries[i]->addressLength = hypercast->senderTable->entries[i]->addressLength;
-        beaconMessage->senderTable->entries[i]->address = malloc(sizeof(hc_ipv4_addr_t));
-        memcpy(beaconMessage->senderTable->entries[i]->address, hypercast->senderTable->entries[i]->address, sizeof(hc_ipv4_addr_t));
-        beaconMessage->senderTable->entries[i]->port = hypercast->senderTable->entries[i]->port;
-    }
-
-    // Misc data
-    beaconMessage->rootAddressLogical = spt->treeInfoTable->rootId;
-    beaconMessage->parentAddressLogical = spt->treeInfoTable->ancestorId;
-    beaconMessage->cost = spt->treeInfoTable->cost;
-    beaconMessage->timestamp = currentTime; // Needs to be real epoch timestamp
-    beaconMessage->senderCount = spt->adjacencyTable->size; // Default for new beacon I think???
-    beaconMessage->reliability = spt_pathmetric_minimumcost(NULL);
-    // Adjacency Table
-    beaconMessage->adjacencyTable = malloc(sizeof(adjacency_table_t));
-    beaconMessage->adjacencyTable->size = spt->adjacencyTable->size;
-    beaconMessage->adjacencyTable->entries = malloc(sizeof(adjacency_table_entry_t*) * spt->adjacencyTable->size);
+    // Time out the adjacency entries
     for (i=0; i<spt->adjacencyTable->size; i++) {
-        // Allocation is unnecessary here
-        beaconMessage->adjacencyTable->entries[i] = malloc(sizeof(adjacency_table_entry_t));
-        beaconMessage->adjacencyTable->entries[i]->id = spt->adjacencyTable->entries[i]->id;
-        beaconMessage->adjacencyTable->entries[i]->quality = spt->adjacencyTable->entries[i]->quality;
-    }
-
-    // 3. Encode it
-    hc_packet_t *packet = spt_encode(beaconMessage, SPT_BEACON_MESSAGE_TYPE, hypercast);
-    // 4. Send it off
-    ESP_LOGI(TAG, "Sending Beacon Message");
-    hc_push_buffer(hypercast->sendBuffer, packet->data, packet->size);
-    // 5. Update last beacon time
-    spt->lastBeacon = currentTime;
-
-    // 6. Free memory
-    free_packet(packet);
-    spt_free_beacon_message(beaconMessage);
-    
-
-    // Run everything but the timeouts
-
-    // First we'll timeout the adjacency entries
-    if (spt->adjacencyTable->size > 0) {
-        for (i=0; i<spt->adjacencyTable->size; i++) {
-            if (spt->adjacencyTable->entries[i]->timestamp + SPT_ADJACENCY_TIMEOUT < currentTime) {
-                // Then we have a node that has timed out
-                // We'll remove it from the adjacency table
-                // And we'll set i back by one because we've moved table entries to fill this index again
-                // pt_spt_adjacency_entry_t* entry = spt->adjacencyTable->entries[i];
-                for (int j=i; j<spt->adjacencyTable->size; j++) {
-                    spt->adjacencyTable->entries[j] = spt->adjacencyTable->entries[j+1];
-                }
-                spt->adjacencyTable->size--;
-                ESP_LOGI(TAG, "Timeout Mechanism has detected that a node left the network");
-                // Now we'll free the entry
-                // free(entry);
-                i--;
+        if (spt->adjacencyTable->entries[i]->timestamp + SPT_ADJACENCY_TIMEOUT < currentTime) {
+            // Then we have a node that has timed out
+            // We'll remove it from the adjacency table
+            // And we'll set i back by one because we've moved table entries to fill this index again
+            // pt_spt_adjacency_entry_t* entry = spt->adjacencyTable->entries[i];
+            for (int j=i; j<spt->adjacencyTable->size; j++) {
+                spt->adjacencyTable->entries[j] = spt->adjacencyTable->entries[j+1];
             }
+            spt->adjacencyTable->size--;
+            ESP_LOGI(TAG, "Timeout Mechanism has detected that a node left the network");
+            // Now we'll free the entry
+            // free(entry);
+            i--;
         }
     }
+    spt_schedule_timeouts(spt, hypercast);
+}
 
-    // Now we'll timeout the neighborhood entries
-    if (spt->neighborhoodTable->size > 0) {
-        for (i=0; i<spt->neighborhoodTable->size; i++) {
-            if (spt->neighborhoodTable->entries[i]->timestamp + SPT_NEIGHBOR_TIMEOUT < currentTime) {
-                // Then we have a node that has timed out
-                // We'll remove it from the neighborhood table
-                // And we'll set i back by one because we've moved table entries to fill this index again
-                pt_spt_neighborhood_entry_t *entry = spt->neighborhoodTable->entries[i];
-                for (int j=i; j<spt->neighborhoodTable->size; j++) {
-                    spt->neighborhoodTable->entries[j] = spt->neighborhoodTable->entries[j+1];
-                }
-                spt->neighborhoodTable->size--;
-                // We have to do a bit more work if this was an ancestor entry
-                if (entry->isAncestor) {
-                    // Do reset because we're no longer connected to our ancestor
-                    spt->treeInfoTable->ancestorId = spt->treeInfoTable->id;
-                    spt->treeInfoTable->rootId = spt->treeInfoTable->id;
-                    spt->treeInfoTable->cost = 0;
-                    spt->treeInfoTable->pathMetric = spt_pathmetric_minimumcost(NULL);
-                }
-                ESP_LOGI(TAG, "Timeout Mechanism has detected that a node left the neighborhood");
-                // Now we'll free the entry
-                // free(entry);
-                i--;
+static void spt_neighbor_timeout(hypercast_t* hypercast, void* protocol) {
+    uint64_t currentTime = hc_clock_monotonic_ms();
+    protocol_spt* spt = (protocol_spt*)protocol;
+    int i;
+
+    // Time out the neighborhood entries
+    for (i=0; i<spt->neighborhoodTable->size; i++) {
+        if (spt->neighborhoodTable->entries[i]->timestamp + SPT_NEIGHBOR_TIMEOUT < currentTime) {
+            // Then we have a node that has timed out
+            // We'll remove it from the neighborhood table
+            // And we'll set i back by one because we've moved table entries to fill this index again
+            pt_spt_neighborhood_entry_t *entry = spt->neighborhoodTable->entries[i];
+            for (int j=i; j<spt->neighborhoodTable->size; j++) {
+                spt->neighborhoodTable->entries[j] = spt->neighborhoodTable->entries[j+1];
+            }
+            spt->neighborhoodTable->size--;
+            // We have to do a bit more work if this was an ancestor entry
+            if (entry->isAncestor) {
+                // Do reset because we're no longer connected to our ancestor
+                spt->treeInfoTable->ancestorId = spt->treeInfoTable->id;
+                spt->treeInfoTable->rootId = spt->treeInfoTable->id;
+                spt->treeInfoTable->cost = 0;
+                spt->treeInfoTable->pathMetric = spt_pathmetric_minimumcost(NULL);
             }
+            ESP_LOGI(TAG, "Timeout Mechanism has detected that a node left the neighborhood");
+            // Now we'll free the entry
+            // free(entry);
+            i--;
         }
     }
+    spt_schedule_timeouts(spt, hypercast);
+}
 
-    // TEMP: Whenever we finish maintenance, send an overlay message out!
-    // char payload[] = "Hello World from ESP32!";
-    // hc_msg_overlay_t *overlayMessage = hc_msg_overlay_init_with_payload(hypercast, payload, strlen(payload));
-    // Then encode it
-    // hc_packet_t *packet2 = hc_msg_overlay_encode(overlayMessage);
-    // Then send it off
-    // hc_push_buffer(hypercast->sendBuffer, packet2->data, packet2->size);
-    // Then free the message
-    // free_packet(packet2);
-    // hc_msg_overlay_free(overlayMessage);
-
-    ESP_LOGI(TAG, "SPT Maintenance Finished");
+void spt_start(void* protocol, hypercast_t* hypercast) {
+    // SPT's periodic work is a beacon every heartbeat, and timing out the tables once we've heard from someone
+    protocol_spt* spt = (protocol_spt*)protocol;
+    hc_timer_init(&spt->beaconTimer, spt_send_beacon, spt);
+    hc_timer_init(&spt->adjacencyTimer, spt_adjacency_timeout, spt);
+    hc_timer_init(&spt->neighborTimer, spt_neighbor_timeout, spt);
+    // The first beacon goes out right away
+    hc_timer_schedule(hypercast, &spt->beaconTimer, 0);
 }
 
 // Message Type Handlers (For Hypercast Updates to State)
 
-void spt_handle_beacon_message(spt_msg_beacon_t* msg, hypercast_t* hypercast) {
+void spt_handle_beacon_message(spt_msg_beacon_t* msg, protocol_spt* spt, hypercast_t* hypercast) {
     // This section is a replication of the logic found in the SPT protocol manual
     // at https://www.comm.utoronto.ca/hypercast/material/SPT_Protocol_03-20-05.pdf on pages 18-20
 
@@ -435,15 +423,10 @@ void spt_handle_beacon_message(spt_msg_beacon_t* msg, hypercast_t* hypercast) {
 
     // Set up globals
     int i;
-    protocol_spt* spt = (protocol_spt*)hypercast->protocol;
 
-    // Once we've received a message from anywhere, use it to update the local clock time
-    // Note: We need to check that the msg is from real time and not another microcontroller with no clue
-    if (get_epoch() < HC_FIXED_TIME_MIN_VALUE + 80000 && msg->timestamp > HC_FIXED_TIME_MIN_VALUE + 80000) {
-        // We need to set the time to something reasonable
-        ESP_LOGI(TAG, "Updated local time to match network time");
-        set_epoch(msg->timestamp);
-    }
+    // Every message from anywhere steers our network time a little
+    // (the clock ignores it if it's from another microcontroller with no clue)
+    hc_clock_observe(msg->timestamp);
 
     // 1. Update Adjacency Table
 
@@ -463,17 +446,17 @@ void spt_handle_beacon_message(spt_msg_beacon_t* msg, hypercast_t* hypercast) {
         adjEntry->quality = 0;
         adjEntry->pingBuffer = malloc(sizeof(bool)*SPT_MESSAGE_LQ_PING_BUFF_SIZE);
         adjEntry->pingBufferStart = 0;
-        adjEntry->timestamp = get_epoch();
+        adjEntry->timestamp = hc_clock_monotonic_ms();
         spt->adjacencyTable->entries[spt->adjacencyTable->size] = adjEntry;
         spt->adjacencyTable->size++;
     }
 
     // We also need to record the ping to the ping buffer
-    spt_ping_buffer_record(get_epoch(), true, adjEntry);
+    spt_ping_buffer_record(hc_clock_monotonic_ms(), true, adjEntry);
 
     // Now we'll update the quality & timestamp
     adjEntry->quality = spt_ping_buffer_get_count(adjEntry);
-    adjEntry->timestamp = get_epoch();
+    adjEntry->timestamp = hc_clock_monotonic_ms();
 
     // 2. Adjacency & Reliability Test
 
@@ -538,7 +521,7 @@ void spt_handle_beacon_message(spt_msg_beacon_t* msg, hypercast_t* hypercast) {
             anc->rootId = msg->rootAddressLogical;
             anc->isAncestor = true; // isAncestor == isParent
             anc->cost = msg->cost;
-            anc->timestamp = get_epoch();
+            anc->timestamp = hc_clock_monotonic_ms();
             anc->pathMetric = spt_pathmetric_minimumcost(msg);
             
             // Insert time
@@ -548,7 +531,7 @@ void spt_handle_beacon_message(spt_msg_beacon_t* msg, hypercast_t* hypercast) {
         // Once we know that our neighborhood table is correct, fetch the neighbor and update the timestamp
         for (i=0;i<spt->neighborhoodTable->size;i++) {
             if (spt->neighborhoodTable->entries[i]->neighborId == msg->senderTable->sourceAddressLogical) {
-                spt->neighborhoodTable->entries[i]->timestamp = get_epoch();
+                spt->neighborhoodTable->entries[i]->timestamp = hc_clock_monotonic_ms();
                 break;
             }
         }
@@ -577,7 +560,7 @@ void spt_handle_beacon_message(spt_msg_beacon_t* msg, hypercast_t* hypercast) {
             desc->rootId = msg->rootAddressLogical;
             desc->isAncestor = false;
             desc->cost = msg->cost;
-            desc->timestamp = get_epoch();
+            desc->timestamp = hc_clock_monotonic_ms();
             desc->pathMetric = spt_pathmetric_minimumcost(msg);
 
             spt_add_neighbor(spt, desc);
@@ -585,7 +568,7 @@ void spt_handle_beacon_message(spt_msg_beacon_t* msg, hypercast_t* hypercast) {
             // Update
             desc->rootId = msg->rootAddressLogical;
             desc->cost = msg->cost;
-            desc->timestamp = get_epoch();
+            desc->timestamp = hc_clock_monotonic_ms();
             desc->pathMetric = spt_pathmetric_minimumcost(msg);
         }
         // Done!
@@ -596,18 +579,18 @@ void spt_handle_beacon_message(spt_msg_beacon_t* msg, hypercast_t* hypercast) {
     }
 }
 
-void spt_handle_goodbye_message(spt_msg_goodbye_t* msg, hypercast_t* hypercast) {
+void spt_handle_goodbye_message(spt_msg_goodbye_t* msg, protocol_spt* spt, hypercast_t* hypercast) {
     return;
 }
 
-bool spt_overlay_sender_trusted(hc_msg_overlay_t* msg, hypercast_t* hypercast) {
+bool spt_overlay_sender_trusted(void* protocol, uint32_t sourceLogicalAddress, hypercast_t* hypercast) {
     // In SPT, message needs to be in adjacency table
-    protocol_spt* spt = (protocol_spt*)hypercast->protocol;
+    protocol_spt* spt = (protocol_spt*)protocol;
     
     // Easy, iterate through table, find sender
     // If we find it, return true
     for (int i=0;i<spt->neighborhoodTable->size;i++) {
-        if (spt->neighborhoodTable->entries[i]->neighborId == msg->sourceLogicalAddress) {
+        if (spt->neighborhoodTable->entries[i]->neighborId == sourceLogicalAddress) {
             return true;
         }
     }
@@ -616,6 +599,72 @@ bool spt_overlay_sender_trusted(hc_msg_overlay_t* msg, hypercast_t* hypercast) {
     return false;
 }
 
+void spt_stats(void* protocol, hc_writer_t* writer) {
+    // The measurement server reads these in this order, right after the node's protocol id and timestamp
+    protocol_spt* spt = (protocol_spt*)protocol;
+    int i;
+    // 3. Node neighbor table
+    // First we write the number of entries
+    hc_write_bits(writer, spt->neighborhoodTable->size, 8);
+    // Then start writing entries
+    for (i=0;i<spt->neighborhoodTable->size;i++) {
+        // Write the entry
+        hc_write_bits(writer, spt->neighborhoodTable->entries[i]->neighborId, 16);
+        hc_write_bits(writer, spt->neighborhoodTable->entries[i]->physicalAddress, 32);
+        hc_write_bits(writer, spt->neighborhoodTable->entries[i]->rootId, 16);
+        hc_write_bits(writer, spt->neighborhoodTable->entries[i]->cost, 32);
+        hc_write_bits(writer, spt->neighborhoodTable->entries[i]->pathMetric, 32);
+        hc_write_bits(writer, hc_clock_network_at(spt->neighborhoodTable->entries[i]->timestamp)/1000, 32);
+        hc_write_bits(writer, spt->neighborhoodTable->entries[i]->isAncestor, 8);
+        // Entries are 25 bytes on the wire, the timestamp keeps 8 bytes of room but only fills 4
+        hc_write_bits(writer, 0, 32);
+    }
+    // 4. Node adjacency table
+    // First we write the number of entries
+    hc_write_bits(writer, spt->adjacencyTable->size, 8);
+    // Then start writing entries
+    for (i=0;i<spt->adjacencyTable->size;i++) {
+        // Write the entry
+        // uint32_t id;
+        hc_write_bits(writer, spt->adjacencyTable->entries[i]->id, 32);
+        // uint8_t quality;
+        hc_write_bits(writer, spt->adjacencyTable->entries[i]->quality, 8);
+        // uint64_t timestamp;
+        hc_write_bits(writer, hc_clock_network_at(spt->adjacencyTable->entries[i]->timestamp)/1000, 32);
+    }
+    // 5. Node treeInfoTable
+    // This one doesn't need size because the props only exist once
+    // uint16_t id;
+    hc_write_bits(writer, spt->treeInfoTable->id, 16);
+    // uint32_t physicalAddress;
+    hc_write_bits(writer, spt->treeInfoTable->physicalAddress, 32);
+    // uint16_t rootId;
+    hc_write_bits(writer, spt->treeInfoTable->rootId, 16);
+    // uint32_t ancestorId;
+    hc_write_bits(writer, spt->treeInfoTable->ancestorId, 32);
+    // uint32_t cost;
+    hc_write_bits(writer, spt->treeInfoTable->cost, 32);
+    // uint32_t pathMetric;
+    hc_write_bits(writer, spt->treeInfoTable->pathMetric, 32);
+    // uint32_t sequenceNumber;
+    hc_write_bits(writer, spt->treeInfoTable->sequenceNumber, 32);
+}
+
+static void* spt_create(uint32_t sourceLogicalAddress) {
+    return spt_protocol_from_config(sourceLogicalAddress);
+}
+
+const hc_protocol_ops_t spt_protocol_ops = {
+    .id = HC_PROTOCOL_SPT,
+    .name = "SPT",
+    .create = spt_create,
+    .parse = spt_parse,
+    .start = spt_start,
+    .trusted = spt_overlay_sender_trusted,
+    .encode = spt_encode,
+    .stats = spt_stats,
+};
+
 
 
 
@@ -673,7 +722,7 @@ void spt_ping_buffer_record(uint64_t time, bool recordingPing, pt_spt_adjacency_
 
 int spt_ping_buffer_get_count(pt_spt_adjacency_entry_t* adjEntry) {
     // Before counting, inject a ping
-    spt_ping_buffer_record(get_epoch(), false, adjEntry);
+    spt_ping_buffer_record(hc_clock_monotonic_ms(), false, adjEntry);
     // Then count
     int i = adjEntry->pingBufferStart;
     int count_ = 0;